@@ -23,35 +23,103 @@ SOFTWARE.
 *********************************************************************************/
 /*
 As for the <search.h> implementation, you are responsible for managing the memory
-of given keys and values.
+of given keys and values, unless the map copies keys (TMAP_COPY_KEYS).
+
+The binary tree is an AVL tree whose links live inside 'tnode', so all the memory
+used by a map comes out of its node blocks, through the configured allocator.
 
 Whereas it doesn't matter this implementation as far as values go, if you release
 memory for a key while it is being used, your program will likely crash or behave
 in unexpected ways.
 
-Note that internal structures' memory for a given map instance is only released
-after calling 'tfree'. This means that each time NODE_BLOCK_NB_ELEMENTS is added
-and then deleted, this amount of memory is held back:
-
-    "NODE_BLOCK_NB_ELEMENTS * sizeof(tnode) + sizeof(tnodeblock)"
+Map nodes are allocated NODE_BLOCK_NB_ELEMENTS at a time. Nodes of deleted keys
+are kept in a free list and used first by the next additions, so the memory
+held by a map follows the number of keys it holds, not how many were added
+and deleted over time. A block is released once all its nodes are deleted,
+except by 'tclear' which keeps them all to fill the map again.
 
-It also means that the first element added costs that same number of bytes.
+The first element added costs a whole block:
 
-This is not very good and means you shouldn't re-use your map objects in order
-to be more memory efficient. When you're done with an instance, 'tfree' it and
-get a new one if needed.
+    "NODE_BLOCK_NB_ELEMENTS * sizeof(tnode) + sizeof(tnodeblock)"
 */
 
 #ifndef TMAP_H
 #define TMAP_H
 #include <search.h>
 #include <pthread.h>
+#include <stdint.h>
 
 #define TMAP_NO_OVERWRITE 1
 #define TMAP_ALLOW_OVERWRITE 0
 
+// 'tmap_config' key kinds
+// Keys are pointers to client data, compared by the client's function
+#define TMAP_KEY_PTR 0
+// Keys are 64 bit integers held in the key pointer itself, see TMAP_U64.
+// They are compared inline, without compare function.
+#define TMAP_KEY_U64 1
+// Keys are NUL terminated strings, in strcmp order. Nodes cache the
+// first 8 bytes and the length of their key, most compares don't read
+// the key itself. 'cmp' is not used.
+#define TMAP_KEY_STRING 2
+
+// Integer key of a TMAP_KEY_U64 map, as given to the map functions
+#define TMAP_U64(id) ((void*)(uintptr_t)(id))
+
+// 'tmap_config' flags
+// Node blocks are mapped on huge pages: explicit ones (MAP_HUGETLB) if
+// the system has some available, transparent ones otherwise. Blocks
+// are then sized to whole huge pages.
+#define TMAP_HUGE_PAGES 1
+// Keys are copied into memory owned by the map when added, the client
+// may reuse its key buffers right after. String keys are copied up to
+// their NUL, TMAP_KEY_PTR keys on 'keySize' bytes. Integer keys have
+// nothing to copy. Keys handed out by the map ('ttwalk', 'trange') are
+// the copies, valid until the key is deleted. Cursors hold their own
+// copy, see 'tcursor'.
+#define TMAP_COPY_KEYS 2
+// Keys are indexed by a B+ tree instead of the AVL tree, see 'tinit_btree'
+#define TMAP_BTREE 4
+// String keys are indexed by an adaptive radix tree, see 'tinit_art'
+#define TMAP_ART 8
+// Keys may be given a time to live, see 'tadd_ttl'. Not for
+// MULTI_THREAD_RCU maps.
+#define TMAP_TTL 16
+// Lookups of missing keys are mostly answered by a Bloom filter of the
+// keys, without walking the map. TMAP_KEY_PTR keys are hashed by the
+// map's hash function, which they need: they are then hash indexed maps.
+// Not for MULTI_THREAD_SEQLOCK and MULTI_THREAD_RCU maps.
+#define TMAP_BLOOM 32
+// Each thread caches its last 'tget' results, used until the map is
+// changed: repeated lookups of a key take no lock. Keys cached are
+// integers, strings shorter than 24 bytes and TMAP_KEY_PTR keys of a
+// 'keySize' up to 24 bytes. See 'tcache_stats'. Not for bounded and
+// TMAP_TTL maps.
+#define TMAP_LOOKUP_CACHE 64
+// Operations are counted, with the key comparisons they make, see
+// 'tstats'. Costs a few atomic additions per operation.
+#define TMAP_STATS 128
+
+// 'tbuild' input
+#define TMAP_BUILD_SORTED 0
+#define TMAP_BUILD_SORT 1
+
 #define SINGLE_THREADED 0
 #define MULTI_THREAD_SAFE 1
+// Readers share a pthread rwlock, writers have exclusive access
+#define MULTI_THREAD_RWLOCK 2
+// Writers take a mutex and bump a sequence counter, 'tget' doesn't
+// lock: it walks the tree and retries if a writer ran meanwhile,
+// so readers never write to shared memory. Keys deleted from the map
+// may still be read by a concurrent 'tget' and must not be unmapped.
+// Node blocks are only released by 'tfree'. Tree maps only.
+#define MULTI_THREAD_SEQLOCK 3
+// Writers take a mutex and copy the nodes they modify instead of changing
+// them, then publish the new tree. 'tget' takes no lock and never retries,
+// replaced nodes are released once no reader can be looking at them.
+// Keys deleted from the map may still be read by a concurrent 'tget'.
+// Tree maps only.
+#define MULTI_THREAD_RCU 4
 
 
 // Structure for client who wants to provide their own allocator
@@ -62,14 +130,121 @@ typedef struct tallocator {
 } tallocator;
 
 
+// Parameters of a map for 'tinit_ex'. Members left at 0 get defaults.
+typedef struct tmap_config {
+    int (*cmp)(const void*, const void*);
+    // Hash indexed map if set, see 'tinit_hash'
+    uint64_t (*hash)(const void* key);
+    int noOverwrite;
+    int multitask;
+    // TMAP_KEY_PTR, TMAP_KEY_U64 or TMAP_KEY_STRING, 'cmp' is only
+    // used for the first
+    int keyKind;
+    // Size of TMAP_KEY_PTR keys, for TMAP_COPY_KEYS
+    size_t keySize;
+    // Memory for this map only, 'ctx' is passed along. Default is
+    // the allocator set by 'tconf'.
+    void* (*alloc)(void* ctx, size_t nbBytes);
+    void  (*free)(void* ctx, void* ptr, size_t nbBytes);
+    void* allocCtx;
+    // Number of nodes allocated at once, NODE_BLOCK_NB_ELEMENTS
+    // by default. Small maps waste less memory with small blocks.
+    unsigned int blockSize;
+    // TMAP_HUGE_PAGES, TMAP_COPY_KEYS, TMAP_BTREE, TMAP_ART, TMAP_TTL,
+    // TMAP_BLOOM, TMAP_LOOKUP_CACHE, TMAP_STATS
+    int flags;
+    // Bounded map if set: adding a key beyond 'capacity' removes the
+    // least recently added or looked up one, 'evict' is then called with
+    // its key and value and 'evictCtx', map locked. Keys copied by
+    // TMAP_COPY_KEYS are only valid during the call. Lookups change the
+    // map: 'tget' takes the lock exclusively. Not for MULTI_THREAD_RCU
+    // maps.
+    size_t capacity;
+    void (*evict)(void* key, void* value, void* ctx);
+    void* evictCtx;
+} tmap_config;
+
+
+// Operations counted by TMAP_STATS maps: lookups ('tget', each key of
+// 'tget_batch'), changes ('tadd', 'tadd_ttl', 'tput', 'tinsert_if_absent',
+// 'tcompute') and deletes ('tdel')
+#define TMAP_OP_GET 0
+#define TMAP_OP_PUT 1
+#define TMAP_OP_DEL 2
+#define TMAP_NB_OPS 3
+
+// What 'tstats' tells about a map
+typedef struct tmap_stats {
+    // Keys in the map
+    size_t count;
+    // Node blocks, and bytes taken by them, key copies, the index (hash
+    // table, B+ tree and radix tree nodes), the bloom filter and the
+    // TMAP_TTL expiry heap
+    size_t blocks;
+    size_t bytes;
+    // Node slots of deleted keys waiting for new ones, and their bytes
+    size_t freeSlots;
+    size_t wastedBytes;
+    // Tree and B+ tree maps: levels, and average level of the keys,
+    // the root's being 1. 0 for other maps.
+    unsigned int height;
+    double averageDepth;
+    // TMAP_STATS maps: operations since the map was created by
+    // TMAP_OP_*, and the key comparisons they made
+    unsigned long ops[TMAP_NB_OPS];
+    unsigned long compares[TMAP_NB_OPS];
+} tmap_stats;
+
+
+// Keys up to this size are copied into cursors of TMAP_COPY_KEYS maps
+#define TMAP_CURSOR_KEY_SIZE 64
+
+// Position in a tree map, holds a copy of the key and value it's on.
+// The map may change between cursor calls: moving goes from the key
+// held, whether it is still in the map or not.
+// Cursors of TMAP_COPY_KEYS maps hold their own copy of keys up to
+// TMAP_CURSOR_KEY_SIZE bytes, 'key' points to it. Bigger keys are the
+// map's copy: they must not be deleted while a cursor is on them.
+typedef struct tcursor {
+    void* key;
+    void* value;
+    int __copied;
+    char __key[TMAP_CURSOR_KEY_SIZE];
+} tcursor;
+
+
 typedef struct tnodeblock tnodeblock;
+typedef struct tmapops tmapops;
+typedef struct trcu trcu;
+typedef struct tsnapstate tsnapstate;
+typedef struct tlru tlru;
+typedef struct tttl tttl;
+typedef struct tbloom tbloom;
+typedef struct tcache tcache;
+typedef struct topstats topstats;
+typedef struct tkeychunk tkeychunk;
 
 
 // Internal node structure containing client's map data
+// 'key' must remain the first member: compare functions receive either
+// a node or a pointer to a key. Nodes fill a cache line and blocks
+// align them on one, so that each step of a tree walk reads a single
+// line. The node type itself is not aligned: pointers to keys aren't.
 typedef struct tnode {
     void* key;
     void* value;
+    // AVL tree links
+    struct tnode* __left;
+    struct tnode* __right;
     tnodeblock* __mynodeblock;
+    // Height of the subtree rooted at this node, leaves are 1
+    int __height;
+    // Write generation that created the node, for copy on write
+    unsigned int __gen;
+    // TMAP_KEY_STRING maps: key prefix and length
+    uint64_t __prefix;
+    unsigned int __keyLen;
+    char __pad[64 - 5*sizeof(void*) - 3*sizeof(int) - sizeof(uint64_t)];
 } tnode;
 
 
@@ -81,7 +256,7 @@ typedef struct tnodeblock {
     tnodeblock* __previous;
     // Array of nodes available for client data allocation
     tnode* __nodes;
-    // Index of next available node
+    // Index of next never used node
     unsigned int __index;
     // Number of live nodes
     int __activeNodes;
@@ -89,14 +264,19 @@ typedef struct tnodeblock {
 
 
 typedef struct tmap {
-    // binary tree root, used directly by <search.h>
-    void* __root;
+    // AVL tree root
+    tnode* __root;
 
     // Key compare function pointer
     int (*__cmp)(const void*, const void*);
+    int __keyKind;
 
-    // accelerator members: TODO: Keep? Any diff in performance?
-    tnode* __pBufNode;
+    // Key hash function pointer, hash indexed maps only
+    uint64_t (*__hash)(const void*);
+
+    // Storage engine (tree or hash table) and its private data
+    const tmapops* __ops;
+    void* __engineData;
 
     // Overwrite permission flag
     int __noOverwrite;
@@ -104,13 +284,71 @@ typedef struct tmap {
     // Memory management
     tnodeblock* __firstNodeBlock;
     tnodeblock* __currentNodeBlock;
+    // Nodes of deleted keys, to be used before the current block's
+    tnode* __freeNodes;
+    unsigned long __nbFreeNodes;
+    // Nodes per block
+    unsigned int __blockSize;
+    int __flags;
+    void* (*__alloc)(void* ctx, size_t nbBytes);
+    void  (*__free)(void* ctx, void* ptr, size_t nbBytes);
+    void* __allocCtx;
+    // TMAP_COPY_KEYS arena
+    tkeychunk* __firstKeyChunk;
+    tkeychunk* __currentKeyChunk;
+    size_t __keySize;
 
     // Multi thread flag
     int __multitask;
     pthread_mutex_t* __mutex;
+    pthread_rwlock_t* __rwlock;
+    // MULTI_THREAD_SEQLOCK sequence, odd while a writer is at work
+    unsigned int __seq;
+
+    // Copy on write state, nodes of another generation are read only
+    int __cow;
+    unsigned int __gen;
+    // MULTI_THREAD_RCU published tree and reclamation
+    trcu* __rcu;
+    // Live snapshots and the nodes kept for them, see 'tsnapshot'
+    tsnapstate* __snap;
+    // Recency list of bounded maps, see 'tmap_config'
+    tlru* __lru;
+    // Expiry heap of TMAP_TTL maps
+    tttl* __ttl;
+    // Filter of TMAP_BLOOM maps
+    tbloom* __bloom;
+    // TMAP_LOOKUP_CACHE: write version, bumped as writers take the lock
+    // and release it, and hit counters
+    unsigned long __version;
+    tcache* __cache;
+    // Keys in the map, and operation counters of TMAP_STATS maps
+    size_t __count;
+    topstats* __opStats;
 } tmap;
 
 
+// Map split over independent sub-maps, each with its own lock and
+// node blocks, so that threads working on different shards don't
+// contend. Keys go to a shard by hash, or by range for ordered use.
+typedef struct tmap_sharded {
+    // Shard maps, each on its own cache lines
+    tmap** __shards;
+    int __nbShards;
+
+    // Hash sharding
+    uint64_t (*__hash)(const void*);
+
+    // Range sharding: '__nbShards - 1' sorted split keys, a key goes
+    // to the first shard whose split key is greater than it.
+    void** __bounds;
+    int (*__cmp)(const void*, const void*);
+
+    // Shard memory as allocated
+    void* __mem;
+} tmap_sharded;
+
+
 /*****************************************************************/
 // Following are not multithread safe
 /*****************************************************************/
@@ -123,6 +361,112 @@ extern tmap* tinit(int (*cmp)(const void*, const void*),
                    const int noOverwrite,
                    const int multitask);
 
+// Obtain an instance of tmap set up by 'config'
+extern tmap* tinit_ex(const tmap_config* config);
+
+// Obtain an instance of tmap keyed by 64 bit integers (TMAP_KEY_U64)
+extern tmap* tinit_u64(const int noOverwrite,
+                       const int multitask);
+
+// Obtain an instance of tmap keyed by strings (TMAP_KEY_STRING)
+extern tmap* tinit_str(const int noOverwrite,
+                       const int multitask);
+
+// Obtain an instance of tmap indexed by a B+ tree: nodes of many keys
+// on a few cache lines, and linked leaves for ordered scans. Lookups in
+// big maps miss the cache much less than in the AVL tree. 'ttreeroot'
+// returns NULL. MULTI_THREAD_SEQLOCK and MULTI_THREAD_RCU aren't
+// supported.
+extern tmap* tinit_btree(int (*cmp)(const void*, const void*),
+                         const int noOverwrite,
+                         const int multitask);
+
+// Obtain an instance of tmap keyed by strings (TMAP_KEY_STRING) and
+// indexed by an adaptive radix tree: a lookup follows the key's bytes,
+// it costs about the key length instead of log n compares, and shared
+// prefixes are read once. 'ttreeroot' returns NULL. MULTI_THREAD_SEQLOCK
+// and MULTI_THREAD_RCU aren't supported.
+extern tmap* tinit_art(const int noOverwrite,
+                       const int multitask);
+
+// Obtain an instance of tmap indexed by a hash table instead of a tree.
+// Point lookups are O(1), but the map has no order: 'ttreeroot' returns
+// NULL. MULTI_THREAD_SEQLOCK and MULTI_THREAD_RCU aren't supported.
+// 'cmp' only needs to tell if keys are equal (returns 0).
+extern tmap* tinit_hash(uint64_t (*hash)(const void* key),
+                        int (*cmp)(const void*, const void*),
+                        const int noOverwrite,
+                        const int multitask);
+
+// Obtain a map of 'nbShards' hash indexed sub-maps, the shard of a key
+// is picked from its hash. MULTI_THREAD_SEQLOCK and MULTI_THREAD_RCU
+// aren't supported.
+extern tmap_sharded* tinit_sharded(const int nbShards,
+                                   uint64_t (*hash)(const void* key),
+                                   int (*cmp)(const void*, const void*),
+                                   const int noOverwrite,
+                                   const int multitask);
+
+// Obtain a map of 'nbShards' tree sub-maps split by key range. 'bounds'
+// holds 'nbShards - 1' sorted keys, shard i holds the keys lower than
+// bounds[i] and not lower than bounds[i-1]. Shards are in key order.
+extern tmap_sharded* tinit_sharded_range(const int nbShards,
+                                         void** bounds,
+                                         int (*cmp)(const void*, const void*),
+                                         const int noOverwrite,
+                                         const int multitask);
+
+// Obtain a read only map from a file written by 'tsave'. The file is
+// mapped and used as is: opening costs the same for any number of keys,
+// pages are read in as lookups reach them, and processes opening the
+// same file share them. 'cmp' is needed for TMAP_KEY_PTR keys only.
+// Cursors, 'tget' and 'trange' work as on other tree maps and hand out
+// keys and values pointing into the file. Functions changing the map
+// exit with an error, 'tfree' unmaps the file. Returns NULL with errno
+// set if the file can't be mapped, EINVAL if it isn't a map file or its
+// header doesn't fit its size.
+extern tmap* topen(const char* path,
+                   int (*cmp)(const void*, const void*));
+
+// Obtain a read only view of a tree map as it is now, for long scans
+// that must see consistent data without holding up writers. The view
+// shares the map's nodes: taking it costs the same for any number of
+// keys, and writers copy the nodes they change while views are alive.
+// Cursors, 'tget', 'trange' and 'ttwalk' work on it without locking,
+// functions changing it exit with an error. Release it with 'tfree',
+// before the map is freed. Returns NULL for maps that aren't AVL tree
+// maps, or that are MULTI_THREAD_RCU, bounded or TMAP_TTL maps, with
+// errno set to ENOMEM for shared maps whose segment is full.
+extern tmap* tsnapshot(tmap* map);
+
+// Obtain an instance of tmap in POSIX shared memory segment 'name' of
+// 'size' bytes: processes forked once it's created, and processes of the
+// same program attaching it with 'tattach_shared', all see and change the
+// same map. Node blocks and keys, copied as with TMAP_COPY_KEYS, are
+// taken from the segment. Functions adding keys check the segment holds
+// what they may take first: on a full segment they change nothing and
+// set errno to ENOMEM, 'tbuild' returns -1. Values are stored as given,
+// integers or pointers into memory at the same address in all processes.
+// The map is MULTI_THREAD_SAFE, its mutex is process shared and robust: a
+// process dying while changing the map doesn't leave the others waiting,
+// the map may be half changed and is unusable from then on, processes
+// using it print an error and exit. 'tfree', which doesn't lock, unmaps
+// the segment from the calling process, the creator also removes its
+// name. Returns NULL with errno set if the segment can't be created,
+// ENOMEM if 'size' can't hold the map, EINVAL for TMAP_LOOKUP_CACHE maps.
+extern tmap* tinit_shared(const char* name, const size_t size, const tmap_config* config);
+
+// Map of shared memory segment 'name', created by 'tinit_shared' in
+// another process of the same program, for processes forked before it.
+// The segment is mapped at the address it has in the others. Release it
+// with 'tfree'. Returns NULL with errno set if the segment can't be
+// opened, EAGAIN if its map isn't created yet, EINVAL if it was created
+// by another program, EADDRINUSE if its address is taken in this process.
+extern tmap* tattach_shared(const char* name);
+
+// Free memory for given sharded map object
+extern void tsfree(tmap_sharded* smap);
+
 // Override key comparison function
 extern void tsetcmp(tmap* map,
                     int (*cmp)(const void*, const void*));
@@ -134,16 +478,135 @@ extern void tfree(tmap* map);
 // Following are multithread safe
 /*****************************************************************/
 
-// Get binary tree root for use in 'twalk'
-extern void* troot(tmap* map);
+// Get binary tree root for use in 'ttwalk', NULL for maps not indexed
+// by the AVL tree
+extern const tnode* ttreeroot(tmap* map);
+
+// Same as <search.h> 'twalk' for a tmap tree, the action function
+// receives a pointer to a 'tnode*' like it would with 'twalk'.
+extern void ttwalk(const tnode* root,
+                   void (*action)(const void* nodep, VISIT which, int depth));
 
 // Add a key to the binary tree
 extern void tadd(tmap* map, void* key, void* value);
 
+// Add or overwrite a key, returns the previous value or NULL.
+// With TMAP_NO_OVERWRITE, an existing value is left untouched
+// and returned instead of raising SIGABRT.
+extern void* tput(tmap* map, void* key, void* value);
+
+// Add a key only if it is not in the map yet.
+// Returns the existing value, or NULL if 'value' was added.
+extern void* tinsert_if_absent(tmap* map, void* key, void* value);
+
+// Read-modify-write of a key in a single tree descent.
+// 'fn' gets the current value (NULL if absent) and returns the new one,
+// returning NULL deletes the key (or doesn't add it). 'fn' is called
+// with the map locked and must not call back into the map.
+// TMAP_NO_OVERWRITE doesn't apply. Returns the new value.
+extern void* tcompute(tmap* map, void* key,
+                      void* (*fn)(const void* key, void* value, void* ctx),
+                      void* ctx);
+
+// Same as 'tadd' for a key expiring 'ttl' milliseconds from now, on
+// TMAP_TTL maps. 'tget' doesn't find expired keys and other functions
+// adding keys take them as absent. Expired keys are removed a few at a
+// time by functions changing the map, and by 'texpire'. Until then they
+// may still be seen by cursors, 'trange', 'tprefix' and 'ttwalk'. Keys
+// added otherwise don't expire, setting their value keeps their deadline.
+extern void tadd_ttl(tmap* map, void* key, void* value, const uint64_t ttl);
+
+// Remove up to 'budget' expired keys of a TMAP_TTL map, those expired
+// first go first. Returns the number of keys removed.
+extern size_t texpire(tmap* map, const size_t budget);
+
 // Delete a key from the binary tree
 extern void tdel(tmap* map, void* key);
 
+// Delete all keys. Node blocks are kept for the keys added next,
+// 'tfree' is what gives memory back.
+extern void tclear(tmap* map);
+
+// Replace the map content with 'n' keys and their values in O(n), the
+// tree built is perfectly balanced. Keys must be sorted, or 'flags' set
+// to TMAP_BUILD_SORT to have them sorted first (stable, O(n log n)).
+// The last value of equal keys is kept. Returns -1 and leaves the map
+// untouched if keys are not sorted, or with errno set to EINVAL if 'n'
+// keys are too many to sort, ENOMEM if the sort buffer can't be
+// allocated. Returns 0 otherwise.
+extern int tbuild(tmap* map, void** keys, void** values,
+                  const size_t n, const int flags);
+
+// Allocate memory up front for 'n' more keys, so that adding them
+// allocates nothing. Best effort in MULTI_THREAD_RCU mode, where
+// writers also allocate copies of the nodes they change, and for shared
+// maps, which reserve nodes only as long as the segment keeps room.
+extern void treserve(tmap* map, const size_t n);
+
 // Get value of a key
 extern void* tget(tmap* map, void* key);
 
+// Get values of 'n' keys into 'values', NULL for missing keys. The map
+// is locked once, and tree lookups are walked down together so that
+// their memory accesses overlap.
+extern void tget_batch(tmap* map, void** keys, void** values, const size_t n);
+
+// Lookups of a TMAP_LOOKUP_CACHE map answered by the cache of the
+// calling thread, and those that walked the map, by all threads since
+// the map was created. Both are 0 for other maps.
+extern void tcache_stats(tmap* map, unsigned long* hits, unsigned long* misses);
+
+// Statistics of the map into 'stats'. The key count is kept as keys
+// come and go, blocks and tree levels are walked: O(n) for tree maps.
+// Takes the map lock as readers do.
+extern void tstats(tmap* map, tmap_stats* stats);
+
+// Cursors over a tree map, in key order. Each call descends from the
+// tree root in O(log n). They return 1 with 'cursor' on the entry found,
+// 0 with 'cursor' left as is if there is none (hash maps have none).
+// First and last keys
+extern int tfirst(tmap* map, tcursor* cursor);
+extern int tlast(tmap* map, tcursor* cursor);
+// First key not lower than 'key', first key greater than 'key'
+extern int tlower_bound(tmap* map, void* key, tcursor* cursor);
+extern int tupper_bound(tmap* map, void* key, tcursor* cursor);
+// Key following, or preceding, the cursor's key
+extern int tnext(tmap* map, tcursor* cursor);
+extern int tprev(tmap* map, tcursor* cursor);
+
+// Call 'fn' for the keys from 'lo' included to 'hi' excluded, in order.
+// NULL 'lo' or 'hi' leaves the range open on that side. The walk stops
+// when 'fn' returns non zero. 'fn' is called with the map read locked
+// and must not change the map. Returns the number of calls to 'fn'.
+extern size_t trange(tmap* map, void* lo, void* hi,
+                     int (*fn)(const void* key, void* value, void* ctx),
+                     void* ctx);
+
+// Same as 'trange' on the keys of a string keyed map starting with
+// 'prefix'. Radix tree maps go straight to the keys, other tree maps
+// walk the range the prefix spans. Returns 0 for other maps.
+extern size_t tprefix(tmap* map, const char* prefix,
+                      int (*fn)(const void* key, void* value, void* ctx),
+                      void* ctx);
+
+// Write the keys and values of a tree map to 'path', for 'topen'. String
+// keys are written up to their NUL, TMAP_KEY_PTR keys on the map's
+// 'keySize' bytes. Values are the 'valueSize' bytes they point to, or
+// the value pointers themselves if 'valueSize' is 0, for values that are
+// integers. The file is written aside then renamed, maps opened from a
+// previous file are unaffected. Returns -1 with errno set on failure,
+// EINVAL for hash maps and TMAP_KEY_PTR maps without a key size.
+extern int tsave(tmap* map, const char* path, const size_t valueSize);
+
+// Sub-map holding 'key' in a sharded map, any tmap function can be used on it
+extern tmap* tshard(tmap_sharded* smap, void* key);
+
+// Sub-map at index 'shard', for iterating over all shards
+extern tmap* tshardat(tmap_sharded* smap, const int shard);
+
+// Same as tadd, tdel, tget for sharded maps
+extern void tsadd(tmap_sharded* smap, void* key, void* value);
+extern void tsdel(tmap_sharded* smap, void* key);
+extern void* tsget(tmap_sharded* smap, void* key);
+
 #endif
@@ -0,0 +1,398 @@
+/*********************************************************************************
+MIT License
+
+Copyright (c) 2019 Mathieu Comeau
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************/
+
+/*
+Internal declarations shared by the tmap engines, not part of the client API.
+*/
+
+#ifndef TMAP_INT_H
+#define TMAP_INT_H
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tmap.h"
+
+
+#ifndef NODE_BLOCK_NB_ELEMENTS
+#define NODE_BLOCK_NB_ELEMENTS 2*1024
+#endif
+
+
+#ifdef QADEBUG
+#define PRINTD(...) do { fprintf(stderr, "DEBUG: "); fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); } while(0);
+#else
+#define PRINTD(...)
+#endif
+
+
+extern void* (*__tmyalloc)(size_t);
+extern void  (*__tmyfree)(void*, size_t);
+
+
+#define MYALLOC(s) __tmyalloc(s)
+#define MYFREE(p,s) __tmyfree(p,s)
+
+// Allocator of a given map, as set by tinit_ex
+#define MAPALLOC(map,s) (map)->__alloc((map)->__allocCtx, s)
+#define MAPFREE(map,p,s) (map)->__free((map)->__allocCtx, p, s)
+
+#define PTR_OFFSET(p,offset) (((char*)(p))+(offset))
+
+#define NODE_BLOCK_DELETED -1
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#else
+#define CPU_RELAX()
+#endif
+
+
+// Size nodes are aligned on, see tnode
+#define NODE_ALIGNMENT 64
+
+
+// Key being looked up, with what string keys are first compared on
+typedef struct tkey {
+    void* key;
+    uint64_t prefix;
+    size_t len;
+} tkey;
+
+
+// First 8 bytes of a string, zero padded, as a big endian integer:
+// integer order is the strings' byte order. Sets the string length.
+static inline uint64_t __tstrPrefix(const char* s, size_t* len) {
+    uint64_t prefix = 0;
+    size_t i;
+
+    for(i=0; i<8 && s[i] != 0; ++i) {
+        prefix |= (uint64_t)(unsigned char)s[i] << (56 - 8*i);
+    }
+    *len = i < 8 ? i : 8 + strlen(s + 8);
+    return prefix;
+}
+
+
+static inline void __tkeyInit(tmap* map, tkey* k, void* key) {
+    k->key = key;
+    if(map->__keyKind == TMAP_KEY_STRING) {
+        k->prefix = __tstrPrefix((const char*)key, &k->len);
+    }
+}
+
+
+extern void* __tarenaCopy(tmap* map, void* key, size_t len);
+extern void __tbloomAdd(tmap* map, const void* key);
+// Comparisons made by the thread, TMAP_STATS maps
+extern __thread unsigned long __tcompares;
+
+
+// Set a node's key, and what is cached from it. TMAP_COPY_KEYS
+// maps set a copy of the key.
+static inline void __tsetKey(tmap* map, tnode* node, void* key) {
+    size_t len = map->__keySize;
+
+    if(map->__keyKind == TMAP_KEY_STRING) {
+        node->__prefix = __tstrPrefix((const char*)key, &len);
+        node->__keyLen = (unsigned int)len;
+        ++len;
+    }
+    if(map->__bloom != NULL) {
+        __tbloomAdd(map, key);
+    }
+    ++map->__count;
+    if(map->__flags & TMAP_COPY_KEYS) {
+        key = __tarenaCopy(map, key, len);
+    }
+    node->key = key;
+}
+
+
+// Compare key 'k' with the key of 'node'. Integer keys are compared
+// without branch, string keys on their cached prefix first: equal
+// prefixes mean equal keys if either is shorter than the prefix.
+static inline int __tcmp(tmap* map, const tkey* k, const tnode* node) {
+    if(map->__opStats != NULL) {
+        ++__tcompares;
+    }
+    if(map->__keyKind == TMAP_KEY_U64) {
+        return ((uintptr_t)k->key > (uintptr_t)node->key) - ((uintptr_t)k->key < (uintptr_t)node->key);
+    }
+    if(map->__keyKind == TMAP_KEY_STRING) {
+        if(k->prefix != node->__prefix) {
+            return k->prefix < node->__prefix ? -1 : 1;
+        }
+        if(k->len < 8 || node->__keyLen < 8) {
+            return 0;
+        }
+        return strcmp((const char*)k->key + 8, (const char*)node->key + 8);
+    }
+    // '&k->key' looks like a node to the compare function
+    return map->__cmp(&k->key, node);
+}
+
+
+// Compare two keys, neither of them in a node
+static inline int __tcmpKeys(tmap* map, void* a, void* b) {
+    if(map->__keyKind == TMAP_KEY_U64) {
+        return ((uintptr_t)a > (uintptr_t)b) - ((uintptr_t)a < (uintptr_t)b);
+    }
+    if(map->__keyKind == TMAP_KEY_STRING) {
+        return strcmp((const char*)a, (const char*)b);
+    }
+    // Pointers to keys look like nodes to the compare function
+    return map->__cmp(&a, &b);
+}
+
+
+// Lock a map mutex. The robust mutexes of shared maps are left
+// unrecoverable when the process holding them died: what it was changing
+// may be half done, processes locking them next report it and exit.
+static inline void __tmutexLock(pthread_mutex_t* mutex) {
+    int rc = pthread_mutex_lock(mutex);
+
+    if(rc == EOWNERDEAD) {
+        // Unlocked without being made consistent, for good
+        pthread_mutex_unlock(mutex);
+        rc = ENOTRECOVERABLE;
+    }
+    if(rc == ENOTRECOVERABLE) {
+        fprintf(stderr, "Shared map is unusable: a process died while changing it\n");
+        exit(-1);
+    }
+}
+
+
+// Memory for a map's synchronization object
+typedef union tsyncobj {
+    pthread_mutex_t mutex;
+    pthread_rwlock_t rwlock;
+} tsyncobj;
+
+
+// Operations each map engine provides. Engines return nodes taken from
+// the map's node blocks with '__nodeAlloc' and give them back with
+// '__nodeRelease'. Callers hold the map lock.
+typedef struct tmapops {
+    // Node holding 'key' or NULL
+    tnode* (*get)(tmap* map, void* key);
+    // Node holding 'key', created if missing, in which case '*created'
+    // is set and the node's value is left to the caller
+    tnode* (*insert)(tmap* map, void* key, int* created);
+    // Remove 'key' and release its node
+    int    (*remove)(tmap* map, void* key);
+    // Forget all keys, nodes are reset by the caller
+    void   (*clear)(tmap* map);
+    // Make room for 'n' more keys, nodes excluded
+    void   (*reserve)(tmap* map, const size_t n);
+    // Release engine memory, nodes excluded
+    void   (*destroy)(tmap* map);
+    // Ordered engines only, NULL for others: node at a TSEEK_* position
+    // relative to 'key', and walk of the keys in ['lo', 'hi'[, see 'trange'
+    tnode* (*seek)(tmap* map, void* key, const int mode);
+    size_t (*range)(tmap* map, void* lo, void* hi,
+                    int (*fn)(const void* key, void* value, void* ctx),
+                    void* ctx);
+    // Walk of the keys starting with 'prefix', NULL if the engine has
+    // no better way than 'range', see 'tprefix'
+    size_t (*prefix)(tmap* map, const char* prefix,
+                     int (*fn)(const void* key, void* value, void* ctx),
+                     void* ctx);
+    // Bytes taken by the engine's index, nodes excluded, see 'tstats',
+    // and bytes adding one more key may take for it at most. NULL if the
+    // engine allocates none.
+    size_t (*bytes)(tmap* map);
+    size_t (*growth)(tmap* map);
+} tmapops;
+
+
+// Cursor positions
+#define TSEEK_FIRST 0
+#define TSEEK_LAST 1
+#define TSEEK_GE 2
+#define TSEEK_GT 3
+#define TSEEK_LT 4
+
+
+// Node blocks
+extern tnode* __nodeAlloc(tmap* map);
+extern int __nodeRelease(tmap* map, tnode* pnode);
+extern int __nodeFree(tmap* map, tnode* pnode);
+
+// Map setup and release in caller's memory
+extern void __tmapInit(tmap* map, const tmap_config* config, tsyncobj* sync);
+extern void __tmapRelease(tmap* map);
+extern void __tmultitaskCheck(const int multitask);
+extern void __tengineMultitaskCheck(const int multitask);
+extern void __tallocator_init(tallocator* allocator, const int multitaskMode);
+
+// Epoch based reclamation, MULTI_THREAD_RCU
+extern void __trcuInit(tmap* map);
+extern void __trcuDestroy(tmap* map);
+extern unsigned long* __trcuReadLock(tmap* map);
+extern void __trcuReadUnlock(unsigned long* readers);
+extern tnode* __trcuRoot(tmap* map);
+extern void __trcuRetire(tmap* map, tnode* node);
+extern void __trcuRetireKey(tmap* map, void* key);
+extern void __trcuPublish(tmap* map);
+extern void __trcuReset(tmap* map);
+
+// Snapshots, see 'tsnapshot'
+extern void __tsnapRetire(tmap* map, tnode* node);
+extern void __tsnapRetireKey(tmap* map, void* key);
+extern void __tsnapRetireTree(tmap* map, tnode* node);
+extern void __tsnapDestroy(tmap* map);
+
+// Maps in shared memory, see 'tinit_shared'
+extern void* __tshmAlloc(void* ctx, size_t nbBytes);
+extern int __tshmRelease(tmap* map);
+extern int __tshmRoom(tmap* map, void** keys, const size_t n);
+
+// Whether adding the 'n' keys 'keys' can't run out of memory: shared
+// maps check their segment, errno is set to ENOMEM if it's too full.
+// 'keys' NULL for keys of no bytes.
+static inline int __troom(tmap* map, void** keys, const size_t n) {
+    return map->__alloc != __tshmAlloc || __tshmRoom(map, keys, n);
+}
+
+// Bounded maps, recency links of a node block's nodes follow them
+typedef struct tlrulink {
+    tnode* previous;
+    tnode* next;
+} tlrulink;
+
+// TMAP_TTL maps, deadline of a node and its position in the expiry heap,
+// after the recency links if any
+typedef struct tttlentry {
+    uint64_t deadline;
+    size_t index;
+} tttlentry;
+
+
+// Bytes each node of a block has after the nodes
+static inline size_t __tnodeSideBytes(tmap* map) {
+    return (map->__lru != NULL ? sizeof(tlrulink) : 0) + (map->__ttl != NULL ? sizeof(tttlentry) : 0);
+}
+
+
+// Data of 'node' in the array at 'offset' bytes per node after the
+// nodes of its block, each element 'size' bytes
+static inline void* __tnodeSide(tmap* map, tnode* node, size_t offset, size_t size) {
+    tnodeblock* nodeBlock = node->__mynodeblock;
+
+    return PTR_OFFSET(nodeBlock->__nodes + map->__blockSize,
+                      offset*map->__blockSize + size*(node - nodeBlock->__nodes));
+}
+
+extern void __tlruInit(tmap* map, const tmap_config* config);
+extern void __tlruDestroy(tmap* map);
+extern void __tlruReset(tmap* map);
+extern void __tlruAdd(tmap* map, tnode* node);
+extern void __tlruRemove(tmap* map, tnode* node);
+extern void __tlruUse(tmap* map, tnode* node);
+extern void __tlruEvict(tmap* map);
+
+// Expiring keys, TMAP_TTL
+extern uint64_t __tttlNow(void);
+extern void __tttlInit(tmap* map);
+extern void __tttlDestroy(tmap* map);
+extern void __tttlReset(tmap* map);
+extern void __tttlAdd(tmap* map, tnode* node);
+extern void __tttlRemove(tmap* map, tnode* node);
+extern void __tttlSet(tmap* map, tnode* node, const uint64_t ms);
+extern int __tttlExpired(tmap* map, tnode* node);
+extern size_t __tttlSweep(tmap* map, size_t budget);
+extern size_t __tttlBytes(tmap* map);
+
+// Filter of TMAP_BLOOM maps
+extern void __tbloomInit(tmap* map);
+extern void __tbloomDestroy(tmap* map);
+extern void __tbloomReset(tmap* map);
+extern void __tbloomRemoved(tmap* map);
+extern void __tbloomCheck(tmap* map);
+extern int __tbloomMayHave(tmap* map, const void* key);
+extern size_t __tbloomBytes(tmap* map);
+extern uint64_t __tkeyHash(tmap* map, const void* key);
+
+// Lookup cache of TMAP_LOOKUP_CACHE maps
+extern void __tcacheInit(tmap* map);
+extern void __tcacheDestroy(tmap* map);
+extern void* __tcacheGet(tmap* map, void* key);
+extern void* __tgetUncached(tmap* map, void* key);
+
+// Statistics, TMAP_STATS
+extern void __tstatsInit(tmap* map);
+extern void __tstatsDestroy(tmap* map);
+extern void __tstatsAdd(tmap* map, const int op, const size_t n, const unsigned long compares);
+extern size_t __tarenaBytes(tmap* map);
+extern size_t __tarenaGrowth(const size_t n, const size_t keyBytes);
+extern size_t __ttreeDepths(tnode* root);
+extern int __tbtreeHeight(tmap* map);
+extern size_t __nodeBlockBytes(tmap* map);
+
+// End of 'n' operations 'op' started when the thread had made 'compares'
+// comparisons
+static inline void __tstatsEnd(tmap* map, const int op, const size_t n, const unsigned long compares) {
+    if(map->__opStats != NULL) {
+        __tstatsAdd(map, op, n, compares);
+    }
+}
+
+// Key arena, TMAP_COPY_KEYS
+extern void __tarenaFree(tmap* map, void* key);
+extern void __tarenaReset(tmap* map);
+extern void __tarenaDestroy(tmap* map);
+
+// AVL tree engine, its lookups are those of snapshots too
+extern const tmapops __ttreeOps;
+extern tnode* __ttreeGet(tmap* map, void* key);
+extern void __ttreeReserve(tmap* map, const size_t n);
+extern tnode* __ttreeSeek(tmap* map, void* key, const int mode);
+extern size_t __ttreeRange(tmap* map, void* lo, void* hi,
+                           int (*fn)(const void* key, void* value, void* ctx),
+                           void* ctx);
+
+// Map locking
+extern void __tSyncWait(tmap* map);
+extern void __tSyncPost(tmap* map);
+extern void __tSyncReadWait(tmap* map);
+extern void __tSyncReadPost(tmap* map);
+extern void __tnewGeneration(tmap* map);
+
+// Hash engine
+extern const tmapops __thashOps;
+extern void __thashInit(tmap* map);
+
+// B+ tree engine
+extern const tmapops __tbtreeOps;
+extern void __tbtreeInit(tmap* map);
+
+// Adaptive radix tree engine
+extern const tmapops __tartOps;
+extern void __tartInit(tmap* map);
+
+#endif
@@ -0,0 +1,195 @@
+/*********************************************************************************
+MIT License
+
+Copyright (c) 2019 Mathieu Comeau
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************/
+
+/*
+Key arena of TMAP_COPY_KEYS maps.
+
+Keys are copied one after the other in chunks allocated with the map's
+allocator. Each copy is preceded by a pointer to its chunk, and chunks count
+their live keys: a chunk is freed, or reused if it is the one being filled,
+once all of its keys are deleted. Chunks are never freed but by 'tfree' for
+MULTI_THREAD_SEQLOCK maps, whose readers may read deleted keys.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tmap.h"
+#include "tmapint.h"
+
+
+// Room for keys in a chunk, bigger keys get a chunk of their own
+#define KEY_CHUNK_SIZE (64*1024)
+
+#define KEY_ALIGNMENT sizeof(void*)
+
+
+struct tkeychunk {
+    tkeychunk* next;
+    tkeychunk* previous;
+    // Bytes for keys, used and live keys
+    size_t size;
+    size_t used;
+    size_t live;
+};
+
+
+/*************************** INTERNAL *********************************/
+
+
+tkeychunk* __tarenaChunkNew(tmap* map, tkeychunk* previous, size_t size) {
+    tkeychunk* chunk = (tkeychunk*)MAPALLOC(map, sizeof(tkeychunk) + size);
+
+    if(map->__multitask == MULTI_THREAD_SEQLOCK) {
+        // Optimistic readers may run over a key being written, they
+        // must find a NUL before the end of the chunk
+        memset(chunk, 0, sizeof(tkeychunk) + size);
+    }
+    chunk->size = size;
+    chunk->used = 0;
+    chunk->live = 0;
+    chunk->previous = previous;
+    chunk->next = NULL;
+    if(previous != NULL) {
+        chunk->next = previous->next;
+        previous->next = chunk;
+    } else {
+        map->__firstKeyChunk = chunk;
+    }
+    if(chunk->next != NULL) {
+        chunk->next->previous = chunk;
+    }
+    return chunk;
+}
+
+
+void __tarenaChunkUnlink(tmap* map, tkeychunk* chunk) {
+    if(chunk->previous != NULL) {
+        chunk->previous->next = chunk->next;
+    } else {
+        map->__firstKeyChunk = chunk->next;
+    }
+    if(chunk->next != NULL) {
+        chunk->next->previous = chunk->previous;
+    }
+}
+
+
+// Copy of 'key' in the arena
+void* __tarenaCopy(tmap* map, void* key, size_t len) {
+    tkeychunk* chunk = map->__currentKeyChunk;
+    size_t size = (sizeof(tkeychunk*) + len + KEY_ALIGNMENT - 1) & ~(KEY_ALIGNMENT - 1);
+    tkeychunk** copy;
+
+    if(chunk == NULL || chunk->used + size > chunk->size) {
+        // Empty chunks kept after the current one are used first
+        if(chunk != NULL && chunk->next != NULL && chunk->next->used == 0 && chunk->next->size >= size) {
+            chunk = chunk->next;
+        } else {
+            chunk = __tarenaChunkNew(map, chunk, size > KEY_CHUNK_SIZE ? size : KEY_CHUNK_SIZE);
+        }
+        map->__currentKeyChunk = chunk;
+    }
+
+    copy = (tkeychunk**)PTR_OFFSET(chunk, sizeof(tkeychunk) + chunk->used);
+    *copy = chunk;
+    memcpy(copy + 1, key, len);
+    chunk->used += size;
+    ++chunk->live;
+    return copy + 1;
+}
+
+
+// Key copied by __tarenaCopy is not used anymore
+void __tarenaFree(tmap* map, void* key) {
+    tkeychunk* chunk = ((tkeychunk**)key)[-1];
+
+    if(--chunk->live > 0) {
+        return;
+    }
+    if(chunk == map->__currentKeyChunk) {
+        chunk->used = 0;
+    } else if(map->__multitask == MULTI_THREAD_SEQLOCK) {
+        // Kept mapped, to be filled after the current chunk
+        __tarenaChunkUnlink(map, chunk);
+        chunk->used = 0;
+        chunk->previous = map->__currentKeyChunk;
+        chunk->next = map->__currentKeyChunk->next;
+        map->__currentKeyChunk->next = chunk;
+        if(chunk->next != NULL) {
+            chunk->next->previous = chunk;
+        }
+    } else {
+        __tarenaChunkUnlink(map, chunk);
+        MAPFREE(map, chunk, sizeof(tkeychunk) + chunk->size);
+    }
+}
+
+
+// Drop all keys, chunks are kept
+void __tarenaReset(tmap* map) {
+    tkeychunk* chunk;
+
+    for(chunk = map->__firstKeyChunk; chunk != NULL; chunk = chunk->next) {
+        chunk->used = 0;
+        chunk->live = 0;
+    }
+    map->__currentKeyChunk = map->__firstKeyChunk;
+}
+
+
+// Bytes taken by chunks, see 'tstats'
+// Bytes copying 'n' keys of 'keyBytes' bytes in all may take at most:
+// a chunk is left when the next key doesn't fit, wasting less than it
+size_t __tarenaGrowth(const size_t n, const size_t keyBytes) {
+    size_t copies = keyBytes + n * (sizeof(tkeychunk*) + KEY_ALIGNMENT);
+
+    return 2*copies + (2*copies / KEY_CHUNK_SIZE + 2) * sizeof(tkeychunk) + KEY_CHUNK_SIZE;
+}
+
+
+size_t __tarenaBytes(tmap* map) {
+    tkeychunk* chunk;
+    size_t bytes = 0;
+
+    for(chunk = map->__firstKeyChunk; chunk != NULL; chunk = chunk->next) {
+        bytes += sizeof(tkeychunk) + chunk->size;
+    }
+    return bytes;
+}
+
+
+void __tarenaDestroy(tmap* map) {
+    tkeychunk* chunk = map->__firstKeyChunk;
+    tkeychunk* next;
+
+    while(chunk != NULL) {
+        next = chunk->next;
+        MAPFREE(map, chunk, sizeof(tkeychunk) + chunk->size);
+        chunk = next;
+    }
+    map->__firstKeyChunk = NULL;
+    map->__currentKeyChunk = NULL;
+}
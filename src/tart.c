@@ -0,0 +1,929 @@
+/*********************************************************************************
+MIT License
+
+Copyright (c) 2019 Mathieu Comeau
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************/
+
+/*
+Adaptive radix tree engine for tmap, string keys only.
+
+Each inner node branches on one byte of the key, and comes in 4 sizes: up to 4
+or 16 children with sorted key bytes (searched with SSE2 when available), up to
+48 children through a 256 byte index, or 256 children. Nodes grow and shrink
+between sizes as children come and go.
+
+Bytes shared by all keys below a node are skipped at once (path compression).
+The first ART_MAX_PREFIX of them are kept in the node, longer runs are read from
+any key below when needed: lookups skip them and only compare the whole key at
+the leaf. Keys include their NUL, so no key is a prefix of another and each key
+ends on a leaf. Leaves are the map nodes themselves, pointers to them are
+tagged with their lowest bit.
+
+A lookup costs about one node per distinct byte of the key, whatever the number
+of keys. Children are visited in byte order, which is strcmp order.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "tmap.h"
+#include "tmapint.h"
+
+
+// Prefix bytes held in inner nodes
+#define ART_MAX_PREFIX 8
+
+#define ART_NODE4 0
+#define ART_NODE16 1
+#define ART_NODE48 2
+#define ART_NODE256 3
+
+#define ART_IS_LEAF(p) ((uintptr_t)(p) & 1)
+#define ART_LEAF(p) ((tnode*)((uintptr_t)(p) & ~(uintptr_t)1))
+#define ART_TAG(node) ((tartnode*)((uintptr_t)(node) | 1))
+
+#define ART_MIN(a,b) ((a) < (b) ? (a) : (b))
+
+
+typedef struct tartnode {
+    uint8_t type;
+    uint16_t count;
+    // Bytes all keys below share after the parent's branch byte
+    uint32_t prefixLen;
+    unsigned char prefix[ART_MAX_PREFIX];
+} tartnode;
+
+
+typedef struct tartnode4 {
+    tartnode n;
+    unsigned char keys[4];
+    tartnode* children[4];
+} tartnode4;
+
+
+typedef struct tartnode16 {
+    tartnode n;
+    unsigned char keys[16];
+    tartnode* children[16];
+} tartnode16;
+
+
+// 'index' holds the child slot + 1 of each byte, 0 for none
+typedef struct tartnode48 {
+    tartnode n;
+    unsigned char index[256];
+    tartnode* children[48];
+} tartnode48;
+
+
+typedef struct tartnode256 {
+    tartnode n;
+    tartnode* children[256];
+} tartnode256;
+
+
+typedef struct tart {
+    tartnode* root;
+    // Bytes of inner nodes
+    size_t bytes;
+} tart;
+
+
+static const size_t __tartSizes[] = {
+    sizeof(tartnode4),
+    sizeof(tartnode16),
+    sizeof(tartnode48),
+    sizeof(tartnode256)
+};
+
+
+/**********************************************************************/
+// Nodes
+
+
+tartnode* __tartAlloc(tmap* map, const int type) {
+    tartnode* n = (tartnode*)MAPALLOC(map, __tartSizes[type]);
+
+    ((tart*)map->__engineData)->bytes += __tartSizes[type];
+    memset(n, 0, __tartSizes[type]);
+    n->type = type;
+    return n;
+}
+
+
+void __tartFree(tmap* map, tartnode* n) {
+    ((tart*)map->__engineData)->bytes -= __tartSizes[n->type];
+    MAPFREE(map, n, __tartSizes[n->type]);
+}
+
+
+// Node 'n' turns into 'to', which takes its prefix
+tartnode* __tartResize(tmap* map, tartnode* n, const int type) {
+    tartnode* to = __tartAlloc(map, type);
+
+    to->count = n->count;
+    to->prefixLen = n->prefixLen;
+    memcpy(to->prefix, n->prefix, ART_MAX_PREFIX);
+    return to;
+}
+
+
+// Child slot of a Node16 on byte 'c', NULL if none
+#ifdef __SSE2__
+
+tartnode** __tartFind16(tartnode16* n, const unsigned char c) __attribute__((always_inline));
+inline tartnode** __tartFind16(tartnode16* n, const unsigned char c) {
+    unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8((char)c),
+                                                         _mm_loadu_si128((const __m128i*)n->keys)));
+
+    mask &= (1U << n->n.count) - 1;
+    return mask != 0 ? &n->children[__builtin_ctz(mask)] : NULL;
+}
+
+#else
+
+tartnode** __tartFind16(tartnode16* n, const unsigned char c) {
+    int i;
+
+    for(i=0; i<n->n.count; ++i) {
+        if(n->keys[i] == c) {
+            return &n->children[i];
+        }
+    }
+    return NULL;
+}
+
+#endif
+
+
+// Slot of the child on byte 'c', NULL if none
+tartnode** __tartFind(tartnode* n, const unsigned char c) {
+    tartnode4* n4;
+    tartnode48* n48;
+    tartnode256* n256;
+    int i;
+
+    switch(n->type) {
+        case ART_NODE4:
+            n4 = (tartnode4*)n;
+            for(i=0; i<n->count; ++i) {
+                if(n4->keys[i] == c) {
+                    return &n4->children[i];
+                }
+            }
+            return NULL;
+        case ART_NODE16:
+            return __tartFind16((tartnode16*)n, c);
+        case ART_NODE48:
+            n48 = (tartnode48*)n;
+            return n48->index[c] != 0 ? &n48->children[n48->index[c] - 1] : NULL;
+        default:
+            n256 = (tartnode256*)n;
+            return n256->children[c] != NULL ? &n256->children[c] : NULL;
+    }
+}
+
+
+// First child on a byte greater than '*c', which is set to that byte.
+// -1 gets the first child.
+tartnode* __tartNext(const tartnode* n, int* c) {
+    const tartnode4* n4 = (const tartnode4*)n;
+    const tartnode16* n16 = (const tartnode16*)n;
+    const tartnode48* n48 = (const tartnode48*)n;
+    const tartnode256* n256 = (const tartnode256*)n;
+    int i;
+
+    switch(n->type) {
+        case ART_NODE4:
+            for(i=0; i<n->count; ++i) {
+                if(n4->keys[i] > *c) {
+                    *c = n4->keys[i];
+                    return n4->children[i];
+                }
+            }
+            return NULL;
+        case ART_NODE16:
+            for(i=0; i<n->count; ++i) {
+                if(n16->keys[i] > *c) {
+                    *c = n16->keys[i];
+                    return n16->children[i];
+                }
+            }
+            return NULL;
+        case ART_NODE48:
+            for(i=*c+1; i<256; ++i) {
+                if(n48->index[i] != 0) {
+                    *c = i;
+                    return n48->children[n48->index[i] - 1];
+                }
+            }
+            return NULL;
+        default:
+            for(i=*c+1; i<256; ++i) {
+                if(n256->children[i] != NULL) {
+                    *c = i;
+                    return n256->children[i];
+                }
+            }
+            return NULL;
+    }
+}
+
+
+// Last child on a byte lower than '*c', which is set to that byte.
+// 256 gets the last child.
+tartnode* __tartPrev(const tartnode* n, int* c) {
+    const tartnode4* n4 = (const tartnode4*)n;
+    const tartnode16* n16 = (const tartnode16*)n;
+    const tartnode48* n48 = (const tartnode48*)n;
+    const tartnode256* n256 = (const tartnode256*)n;
+    int i;
+
+    switch(n->type) {
+        case ART_NODE4:
+            for(i=n->count-1; i>=0; --i) {
+                if(n4->keys[i] < *c) {
+                    *c = n4->keys[i];
+                    return n4->children[i];
+                }
+            }
+            return NULL;
+        case ART_NODE16:
+            for(i=n->count-1; i>=0; --i) {
+                if(n16->keys[i] < *c) {
+                    *c = n16->keys[i];
+                    return n16->children[i];
+                }
+            }
+            return NULL;
+        case ART_NODE48:
+            for(i=*c-1; i>=0; --i) {
+                if(n48->index[i] != 0) {
+                    *c = i;
+                    return n48->children[n48->index[i] - 1];
+                }
+            }
+            return NULL;
+        default:
+            for(i=*c-1; i>=0; --i) {
+                if(n256->children[i] != NULL) {
+                    *c = i;
+                    return n256->children[i];
+                }
+            }
+            return NULL;
+    }
+}
+
+
+tnode* __tartMinLeaf(tartnode* n) {
+    int c;
+
+    while(!ART_IS_LEAF(n)) {
+        c = -1;
+        n = __tartNext(n, &c);
+    }
+    return ART_LEAF(n);
+}
+
+
+tnode* __tartMaxLeaf(tartnode* n) {
+    int c;
+
+    while(!ART_IS_LEAF(n)) {
+        c = 256;
+        n = __tartPrev(n, &c);
+    }
+    return ART_LEAF(n);
+}
+
+
+// Whole prefix of 'n', found at 'depth' in the keys below. Bytes past
+// ART_MAX_PREFIX are read from a key.
+const unsigned char* __tartPrefix(tartnode* n, const size_t depth) {
+    if(n->prefixLen > ART_MAX_PREFIX) {
+        return (const unsigned char*)__tartMinLeaf(n)->key + depth;
+    }
+    return n->prefix;
+}
+
+
+// Length of the part of the prefix of 'n' that 'key' matches at 'depth'.
+// Keys end with a NUL that no prefix has, matching stops there.
+uint32_t __tartMismatch(tartnode* n, const unsigned char* key, const size_t depth) {
+    const unsigned char* prefix = __tartPrefix(n, depth);
+    uint32_t i;
+
+    for(i=0; i<n->prefixLen; ++i) {
+        if(key[depth + i] != prefix[i]) {
+            break;
+        }
+    }
+    return i;
+}
+
+
+// Add 'child' on byte 'c' to '*ref', which grows if full
+void __tartAddChild(tmap* map, tartnode** ref, const unsigned char c, tartnode* child) {
+    tartnode* n = *ref;
+    tartnode4* n4;
+    tartnode16* n16;
+    tartnode48* n48;
+    tartnode256* n256;
+    tartnode* to;
+    int i;
+
+    switch(n->type) {
+        case ART_NODE4:
+            n4 = (tartnode4*)n;
+            if(n->count < 4) {
+                for(i=0; i<n->count && n4->keys[i] < c; ++i);
+                memmove(&n4->keys[i + 1], &n4->keys[i], n->count - i);
+                memmove(&n4->children[i + 1], &n4->children[i], (n->count - i) * sizeof(tartnode*));
+                n4->keys[i] = c;
+                n4->children[i] = child;
+                ++n->count;
+                return;
+            }
+            to = __tartResize(map, n, ART_NODE16);
+            memcpy(((tartnode16*)to)->keys, n4->keys, 4);
+            memcpy(((tartnode16*)to)->children, n4->children, 4 * sizeof(tartnode*));
+            break;
+        case ART_NODE16:
+            n16 = (tartnode16*)n;
+            if(n->count < 16) {
+                for(i=0; i<n->count && n16->keys[i] < c; ++i);
+                memmove(&n16->keys[i + 1], &n16->keys[i], n->count - i);
+                memmove(&n16->children[i + 1], &n16->children[i], (n->count - i) * sizeof(tartnode*));
+                n16->keys[i] = c;
+                n16->children[i] = child;
+                ++n->count;
+                return;
+            }
+            to = __tartResize(map, n, ART_NODE48);
+            for(i=0; i<16; ++i) {
+                ((tartnode48*)to)->index[n16->keys[i]] = i + 1;
+                ((tartnode48*)to)->children[i] = n16->children[i];
+            }
+            break;
+        case ART_NODE48:
+            n48 = (tartnode48*)n;
+            if(n->count < 48) {
+                // Slots of removed children are left empty
+                for(i=0; n48->children[i] != NULL; ++i);
+                n48->children[i] = child;
+                n48->index[c] = i + 1;
+                ++n->count;
+                return;
+            }
+            to = __tartResize(map, n, ART_NODE256);
+            for(i=0; i<256; ++i) {
+                if(n48->index[i] != 0) {
+                    ((tartnode256*)to)->children[i] = n48->children[n48->index[i] - 1];
+                }
+            }
+            break;
+        default:
+            n256 = (tartnode256*)n;
+            n256->children[c] = child;
+            ++n->count;
+            return;
+    }
+
+    __tartFree(map, n);
+    *ref = to;
+    __tartAddChild(map, ref, c, child);
+}
+
+
+// Remove the child on byte 'c', in 'slot', from '*ref', which shrinks
+// when it gets small. A node left with one child is replaced by it.
+void __tartRemoveChild(tmap* map, tartnode** ref, const unsigned char c, tartnode** slot) {
+    tartnode* n = *ref;
+    tartnode4* n4 = (tartnode4*)n;
+    tartnode16* n16 = (tartnode16*)n;
+    tartnode48* n48 = (tartnode48*)n;
+    tartnode256* n256 = (tartnode256*)n;
+    tartnode* to = NULL;
+    tartnode* child;
+    uint32_t len;
+    int i, j;
+
+    switch(n->type) {
+        case ART_NODE4:
+            i = slot - n4->children;
+            memmove(&n4->keys[i], &n4->keys[i + 1], n->count - i - 1);
+            memmove(&n4->children[i], &n4->children[i + 1], (n->count - i - 1) * sizeof(tartnode*));
+            if(--n->count > 1) {
+                return;
+            }
+            // The last child takes this node's prefix and branch byte
+            // in front of its own
+            child = n4->children[0];
+            if(!ART_IS_LEAF(child)) {
+                len = n->prefixLen;
+                if(len < ART_MAX_PREFIX) {
+                    n->prefix[len++] = n4->keys[0];
+                }
+                if(len < ART_MAX_PREFIX) {
+                    memcpy(&n->prefix[len], child->prefix, ART_MIN(child->prefixLen, ART_MAX_PREFIX - len));
+                }
+                memcpy(child->prefix, n->prefix, ART_MAX_PREFIX);
+                child->prefixLen += n->prefixLen + 1;
+            }
+            __tartFree(map, n);
+            *ref = child;
+            return;
+        case ART_NODE16:
+            i = slot - n16->children;
+            memmove(&n16->keys[i], &n16->keys[i + 1], n->count - i - 1);
+            memmove(&n16->children[i], &n16->children[i + 1], (n->count - i - 1) * sizeof(tartnode*));
+            if(--n->count > 3) {
+                return;
+            }
+            to = __tartResize(map, n, ART_NODE4);
+            memcpy(((tartnode4*)to)->keys, n16->keys, n->count);
+            memcpy(((tartnode4*)to)->children, n16->children, n->count * sizeof(tartnode*));
+            break;
+        case ART_NODE48:
+            n48->children[n48->index[c] - 1] = NULL;
+            n48->index[c] = 0;
+            if(--n->count > 12) {
+                return;
+            }
+            to = __tartResize(map, n, ART_NODE16);
+            for(i=0, j=0; i<256; ++i) {
+                if(n48->index[i] != 0) {
+                    ((tartnode16*)to)->keys[j] = i;
+                    ((tartnode16*)to)->children[j++] = n48->children[n48->index[i] - 1];
+                }
+            }
+            break;
+        default:
+            n256->children[c] = NULL;
+            if(--n->count > 37) {
+                return;
+            }
+            to = __tartResize(map, n, ART_NODE48);
+            for(i=0, j=0; i<256; ++i) {
+                if(n256->children[i] != NULL) {
+                    ((tartnode48*)to)->index[i] = j + 1;
+                    ((tartnode48*)to)->children[j++] = n256->children[i];
+                }
+            }
+            break;
+    }
+
+    __tartFree(map, n);
+    *ref = to;
+}
+
+
+void __tartFreeSubtree(tmap* map, tartnode* n) {
+    tartnode* child;
+    int c = -1;
+
+    if(ART_IS_LEAF(n)) {
+        return;
+    }
+    while((child = __tartNext(n, &c)) != NULL) {
+        __tartFreeSubtree(map, child);
+    }
+    __tartFree(map, n);
+}
+
+
+/**********************************************************************/
+// Ordered walks
+
+
+// First leaf below 'n' not lower than 'key', or greater if 'strict'
+tnode* __tartLowerBound(tartnode* n, const unsigned char* key, size_t depth, const int strict) {
+    const unsigned char* prefix;
+    tnode* node;
+    tartnode** slot;
+    uint32_t i;
+    int c;
+
+    if(ART_IS_LEAF(n)) {
+        c = strcmp((const char*)ART_LEAF(n)->key, (const char*)key);
+        return (c > 0 || (c == 0 && !strict)) ? ART_LEAF(n) : NULL;
+    }
+
+    prefix = __tartPrefix(n, depth);
+    for(i=0; i<n->prefixLen; ++i) {
+        if(key[depth + i] != prefix[i]) {
+            // All keys below are on the same side of 'key'
+            return key[depth + i] < prefix[i] ? __tartMinLeaf(n) : NULL;
+        }
+    }
+    depth += n->prefixLen;
+
+    c = key[depth];
+    slot = __tartFind(n, c);
+    if(slot != NULL && (node = __tartLowerBound(*slot, key, depth + 1, strict)) != NULL) {
+        return node;
+    }
+    n = __tartNext(n, &c);
+    return n != NULL ? __tartMinLeaf(n) : NULL;
+}
+
+
+// Last leaf below 'n' lower than 'key'
+tnode* __tartBefore(tartnode* n, const unsigned char* key, size_t depth) {
+    const unsigned char* prefix;
+    tnode* node;
+    tartnode** slot;
+    uint32_t i;
+    int c;
+
+    if(ART_IS_LEAF(n)) {
+        return strcmp((const char*)ART_LEAF(n)->key, (const char*)key) < 0 ? ART_LEAF(n) : NULL;
+    }
+
+    prefix = __tartPrefix(n, depth);
+    for(i=0; i<n->prefixLen; ++i) {
+        if(key[depth + i] != prefix[i]) {
+            return key[depth + i] > prefix[i] ? __tartMaxLeaf(n) : NULL;
+        }
+    }
+    depth += n->prefixLen;
+
+    c = key[depth];
+    slot = __tartFind(n, c);
+    if(slot != NULL && (node = __tartBefore(*slot, key, depth + 1)) != NULL) {
+        return node;
+    }
+    n = __tartPrev(n, &c);
+    return n != NULL ? __tartMaxLeaf(n) : NULL;
+}
+
+
+typedef struct tartwalk {
+    const unsigned char* hi;
+    int (*fn)(const void* key, void* value, void* ctx);
+    void* ctx;
+    size_t count;
+} tartwalk;
+
+
+// Call the walk function on keys below 'n' from 'lo', NULL for all of
+// them, up to 'hi' excluded. Returns 1 once the walk is over.
+int __tartWalk(tartnode* n, const unsigned char* lo, size_t depth, tartwalk* walk) {
+    const unsigned char* prefix;
+    tartnode* child;
+    tnode* node;
+    uint32_t i;
+    int lc = 0;
+    int c = -1;
+
+    if(ART_IS_LEAF(n)) {
+        node = ART_LEAF(n);
+        if(lo != NULL && strcmp((const char*)node->key, (const char*)lo) < 0) {
+            return 0;
+        }
+        if(walk->hi != NULL && strcmp((const char*)node->key, (const char*)walk->hi) >= 0) {
+            return 1;
+        }
+        ++walk->count;
+        return walk->fn(node->key, node->value, walk->ctx) != 0;
+    }
+
+    if(lo != NULL) {
+        prefix = __tartPrefix(n, depth);
+        for(i=0; i<n->prefixLen; ++i) {
+            if(lo[depth + i] != prefix[i]) {
+                if(lo[depth + i] > prefix[i]) {
+                    return 0;
+                }
+                lo = NULL;
+                break;
+            }
+        }
+        if(lo != NULL) {
+            depth += n->prefixLen;
+            lc = lo[depth];
+            c = lc - 1;
+        }
+    }
+
+    while((child = __tartNext(n, &c)) != NULL) {
+        if(__tartWalk(child, (lo != NULL && c == lc) ? lo : NULL, depth + 1, walk)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/**********************************************************************/
+// Engine operations
+
+
+tnode* __tartGet(tmap* map, void* key) {
+    const unsigned char* k = (const unsigned char*)key;
+    tartnode* n = ((tart*)map->__engineData)->root;
+    tartnode** slot;
+    tnode* node;
+    size_t len = 0;
+    size_t depth = 0;
+    uint32_t i;
+
+    while(n != NULL) {
+        if(ART_IS_LEAF(n)) {
+            node = ART_LEAF(n);
+            return strcmp((const char*)node->key, (const char*)k) == 0 ? node : NULL;
+        }
+        // Bytes not held in the node are checked on the leaf
+        for(i=0; i<ART_MIN(n->prefixLen, ART_MAX_PREFIX); ++i) {
+            if(k[depth + i] != n->prefix[i]) {
+                return NULL;
+            }
+        }
+        depth += n->prefixLen;
+        if(n->prefixLen > ART_MAX_PREFIX) {
+            if(len == 0) {
+                len = strlen(key);
+            }
+            if(depth > len) {
+                return NULL;
+            }
+        }
+        slot = __tartFind(n, k[depth]);
+        if(slot == NULL) {
+            return NULL;
+        }
+        n = *slot;
+        ++depth;
+    }
+    return NULL;
+}
+
+
+tnode* __tartLeafNew(tmap* map, void* key, int* created) {
+    tnode* node = __nodeAlloc(map);
+
+    __tsetKey(map, node, key);
+    *created = 1;
+    return node;
+}
+
+
+tnode* __tartInsert(tmap* map, void* key, int* created) {
+    const unsigned char* k = (const unsigned char*)key;
+    tartnode** ref = &((tart*)map->__engineData)->root;
+    const unsigned char* prefix;
+    const unsigned char* lk;
+    tartnode** slot;
+    tartnode* split;
+    tartnode* n;
+    tnode* leaf;
+    tnode* node;
+    size_t depth = 0;
+    size_t len;
+    uint32_t p;
+
+    *created = 0;
+    while((n = *ref) != NULL) {
+        if(ART_IS_LEAF(n)) {
+            leaf = ART_LEAF(n);
+            lk = (const unsigned char*)leaf->key;
+            // Bytes before 'depth' match, the NUL included
+            if(depth > 0 && k[depth - 1] == 0) {
+                return leaf;
+            }
+            for(len=depth; lk[len] == k[len]; ++len) {
+                if(k[len] == 0) {
+                    return leaf;
+                }
+            }
+            // Both keys go under a node branching where they differ
+            split = __tartAlloc(map, ART_NODE4);
+            split->prefixLen = len - depth;
+            memcpy(split->prefix, k + depth, ART_MIN(split->prefixLen, ART_MAX_PREFIX));
+            node = __tartLeafNew(map, key, created);
+            __tartAddChild(map, &split, lk[len], n);
+            __tartAddChild(map, &split, k[len], ART_TAG(node));
+            *ref = split;
+            return node;
+        }
+
+        if(n->prefixLen > 0) {
+            p = __tartMismatch(n, k, depth);
+            if(p < n->prefixLen) {
+                // Key leaves the prefix at 'p', a new node branches there
+                prefix = __tartPrefix(n, depth);
+                split = __tartAlloc(map, ART_NODE4);
+                split->prefixLen = p;
+                memcpy(split->prefix, prefix, ART_MIN(p, ART_MAX_PREFIX));
+                __tartAddChild(map, &split, prefix[p], n);
+                n->prefixLen -= p + 1;
+                memmove(n->prefix, prefix + p + 1, ART_MIN(n->prefixLen, ART_MAX_PREFIX));
+                node = __tartLeafNew(map, key, created);
+                __tartAddChild(map, &split, k[depth + p], ART_TAG(node));
+                *ref = split;
+                return node;
+            }
+            depth += n->prefixLen;
+        }
+
+        slot = __tartFind(n, k[depth]);
+        if(slot == NULL) {
+            node = __tartLeafNew(map, key, created);
+            __tartAddChild(map, ref, k[depth], ART_TAG(node));
+            return node;
+        }
+        ref = slot;
+        ++depth;
+    }
+
+    node = __tartLeafNew(map, key, created);
+    *ref = ART_TAG(node);
+    return node;
+}
+
+
+int __tartRemove(tmap* map, void* key) {
+    const unsigned char* k = (const unsigned char*)key;
+    tartnode** ref = &((tart*)map->__engineData)->root;
+    tartnode** parent = NULL;
+    tartnode* n;
+    tnode* node;
+    size_t depth = 0;
+    int c = 0;
+
+    while((n = *ref) != NULL) {
+        if(ART_IS_LEAF(n)) {
+            node = ART_LEAF(n);
+            if(strcmp((const char*)node->key, (const char*)k) != 0) {
+                return 0;
+            }
+            if(parent == NULL) {
+                *ref = NULL;
+            } else {
+                __tartRemoveChild(map, parent, c, ref);
+            }
+            return __nodeRelease(map, node);
+        }
+        if(__tartMismatch(n, k, depth) != n->prefixLen) {
+            return 0;
+        }
+        depth += n->prefixLen;
+        c = k[depth];
+        parent = ref;
+        ref = __tartFind(n, c);
+        if(ref == NULL) {
+            return 0;
+        }
+        ++depth;
+    }
+    return 0;
+}
+
+
+tnode* __tartSeek(tmap* map, void* key, const int mode) {
+    tartnode* root = ((tart*)map->__engineData)->root;
+
+    if(root == NULL) {
+        return NULL;
+    }
+    switch(mode) {
+        case TSEEK_FIRST:
+            return __tartMinLeaf(root);
+        case TSEEK_LAST:
+            return __tartMaxLeaf(root);
+        case TSEEK_LT:
+            return __tartBefore(root, key, 0);
+        default:
+            return __tartLowerBound(root, key, 0, mode == TSEEK_GT);
+    }
+}
+
+
+size_t __tartRange(tmap* map, void* lo, void* hi,
+                   int (*fn)(const void* key, void* value, void* ctx),
+                   void* ctx) {
+    tartnode* root = ((tart*)map->__engineData)->root;
+    tartwalk walk = { hi, fn, ctx, 0 };
+
+    if(root != NULL) {
+        __tartWalk(root, lo, 0, &walk);
+    }
+    return walk.count;
+}
+
+
+// Keys starting with 'prefix' are all below the node reached with it
+size_t __tartPrefixScan(tmap* map, const char* prefix,
+                        int (*fn)(const void* key, void* value, void* ctx),
+                        void* ctx) {
+    const unsigned char* k = (const unsigned char*)prefix;
+    tartnode* n = ((tart*)map->__engineData)->root;
+    tartwalk walk = { NULL, fn, ctx, 0 };
+    const unsigned char* bytes;
+    const size_t len = strlen(prefix);
+    size_t depth = 0;
+    tartnode** slot;
+    uint32_t i;
+
+    while(n != NULL && !ART_IS_LEAF(n)) {
+        bytes = __tartPrefix(n, depth);
+        for(i=0; i<n->prefixLen && depth + i < len; ++i) {
+            if(k[depth + i] != bytes[i]) {
+                return 0;
+            }
+        }
+        depth += n->prefixLen;
+        if(depth >= len) {
+            break;
+        }
+        slot = __tartFind(n, k[depth]);
+        n = slot != NULL ? *slot : NULL;
+        ++depth;
+    }
+
+    if(n == NULL || (ART_IS_LEAF(n) && strncmp((const char*)ART_LEAF(n)->key, prefix, len) != 0)) {
+        return 0;
+    }
+    __tartWalk(n, NULL, depth, &walk);
+    return walk.count;
+}
+
+
+void __tartClear(tmap* map) {
+    tart* art = (tart*)map->__engineData;
+
+    if(art->root != NULL) {
+        __tartFreeSubtree(map, art->root);
+    }
+    art->root = NULL;
+}
+
+
+void __tartReserve(tmap* map, const size_t n) {
+}
+
+
+void __tartDestroy(tmap* map) {
+    __tartClear(map);
+    MAPFREE(map, map->__engineData, sizeof(tart));
+    map->__engineData = NULL;
+}
+
+
+size_t __tartBytes(tmap* map) {
+    return sizeof(tart) + ((tart*)map->__engineData)->bytes;
+}
+
+
+// A node split off a prefix, and a full node grown
+size_t __tartGrowth(tmap* map) {
+    return __tartSizes[ART_NODE4] + __tartSizes[ART_NODE256];
+}
+
+
+const tmapops __tartOps = {
+    .get = __tartGet,
+    .insert = __tartInsert,
+    .remove = __tartRemove,
+    .clear = __tartClear,
+    .reserve = __tartReserve,
+    .destroy = __tartDestroy,
+    .seek = __tartSeek,
+    .range = __tartRange,
+    .prefix = __tartPrefixScan,
+    .bytes = __tartBytes,
+    .growth = __tartGrowth
+};
+
+
+void __tartInit(tmap* map) {
+    tart* art = (tart*)MAPALLOC(map, sizeof(tart));
+
+    art->root = NULL;
+    art->bytes = 0;
+    map->__engineData = art;
+}
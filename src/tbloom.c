@@ -0,0 +1,233 @@
+/*********************************************************************************
+MIT License
+
+Copyright (c) 2019 Mathieu Comeau
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************/
+
+/*
+Bloom filter of the keys of TMAP_BLOOM maps, checked before lookups.
+
+The filter is split in blocks of a cache line, eight 64 bit words. A key
+hash picks a block and sets one bit in each of its words: a lookup of a
+missing key reads a single line, and is told apart from present keys
+in all but a few cases.
+
+Bits can't be taken back: keys removed stay in the filter until it is
+rebuilt from the nodes, once as many keys were removed as are left. It is
+also rebuilt, larger, when it holds more keys than it was sized for.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tmap.h"
+#include "tmapint.h"
+
+
+#define BLOOM_BLOCK_WORDS 8
+// Keys per block the filter is sized for, 16 bits each
+#define BLOOM_BLOCK_KEYS 32
+#define BLOOM_MIN_BLOCKS 16
+
+
+struct tbloom {
+    // Blocks, aligned in 'mem'
+    uint64_t* blocks;
+    void* mem;
+    size_t nbBlocks;
+    // Keys added since the filter was built, and removed since
+    size_t count;
+    size_t removed;
+};
+
+
+static inline uint64_t __tbloomMix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+static inline uint64_t __tbloomFnv(const unsigned char* p, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for(i=0; i<len; ++i) {
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+
+// Hash of a key of any kind, whatever the engine
+uint64_t __tkeyHash(tmap* map, const void* key) {
+    switch(map->__keyKind) {
+        case TMAP_KEY_U64:
+            return __tbloomMix((uint64_t)(uintptr_t)key);
+        case TMAP_KEY_STRING:
+            return __tbloomMix(__tbloomFnv((const unsigned char*)key, strlen((const char*)key)));
+        default:
+            if(map->__hash != NULL) {
+                return __tbloomMix(map->__hash(key));
+            }
+            // Lookup cache only: filters of TMAP_KEY_PTR keys need the
+            // client's hash, raw bytes may differ for equal keys
+            return __tbloomMix(__tbloomFnv((const unsigned char*)key, map->__keySize));
+    }
+}
+
+
+// Block of hash 'h'
+static inline uint64_t* __tbloomBlock(tbloom* bloom, uint64_t h) {
+    return bloom->blocks + BLOOM_BLOCK_WORDS * (((h >> 32) * bloom->nbBlocks) >> 32);
+}
+
+
+// Bits of hash 'h' in each word of its block, 6 at a time from the
+// top 48 bits of another hash
+static inline uint64_t __tbloomBits(uint64_t h) {
+    return h * 0x9e3779b97f4a7c15ULL;
+}
+
+
+static inline void __tbloomSet(tbloom* bloom, const uint64_t h) {
+    uint64_t* block = __tbloomBlock(bloom, h);
+    uint64_t bits = __tbloomBits(h);
+    int i;
+
+    for(i=0; i<BLOOM_BLOCK_WORDS; ++i) {
+        block[i] |= (uint64_t)1 << ((bits >> (16 + 6*i)) & 63);
+    }
+}
+
+
+// Whether 'key' may be in the map. Map is locked.
+int __tbloomMayHave(tmap* map, const void* key) {
+    tbloom* bloom = map->__bloom;
+    uint64_t h = __tkeyHash(map, key);
+    uint64_t* block = __tbloomBlock(bloom, h);
+    uint64_t bits = __tbloomBits(h);
+    uint64_t found = 1;
+    int i;
+
+    for(i=0; i<BLOOM_BLOCK_WORDS; ++i) {
+        found &= block[i] >> ((bits >> (16 + 6*i)) & 63);
+    }
+    return (int)found;
+}
+
+
+// Blocks for 'nbBlocks', all bits cleared
+void __tbloomAlloc(tmap* map, size_t nbBlocks) {
+    tbloom* bloom = map->__bloom;
+    size_t bytes = nbBlocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t);
+
+    if(nbBlocks != bloom->nbBlocks) {
+        if(bloom->mem != NULL) {
+            MAPFREE(map, bloom->mem, bloom->nbBlocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t) + NODE_ALIGNMENT);
+        }
+        bloom->mem = MAPALLOC(map, bytes + NODE_ALIGNMENT);
+        bloom->blocks = (uint64_t*)(((uintptr_t)bloom->mem + NODE_ALIGNMENT - 1) & ~(uintptr_t)(NODE_ALIGNMENT - 1));
+        bloom->nbBlocks = nbBlocks;
+    }
+    memset(bloom->blocks, 0, bytes);
+    bloom->count = 0;
+    bloom->removed = 0;
+}
+
+
+void __tbloomInit(tmap* map) {
+    tbloom* bloom = (tbloom*)MAPALLOC(map, sizeof(tbloom));
+
+    bloom->mem = NULL;
+    bloom->nbBlocks = 0;
+    map->__bloom = bloom;
+    __tbloomAlloc(map, BLOOM_MIN_BLOCKS);
+}
+
+
+size_t __tbloomBytes(tmap* map) {
+    return sizeof(tbloom) + map->__bloom->nbBlocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t) + NODE_ALIGNMENT;
+}
+
+
+void __tbloomDestroy(tmap* map) {
+    tbloom* bloom = map->__bloom;
+
+    MAPFREE(map, bloom->mem, bloom->nbBlocks * BLOOM_BLOCK_WORDS * sizeof(uint64_t) + NODE_ALIGNMENT);
+    MAPFREE(map, bloom, sizeof(tbloom));
+    map->__bloom = NULL;
+}
+
+
+// Node blocks were reset
+void __tbloomReset(tmap* map) {
+    __tbloomAlloc(map, map->__bloom->nbBlocks);
+}
+
+
+// Key given to a new node
+void __tbloomAdd(tmap* map, const void* key) {
+    __tbloomSet(map->__bloom, __tkeyHash(map, key));
+    ++map->__bloom->count;
+}
+
+
+void __tbloomRemoved(tmap* map) {
+    ++map->__bloom->removed;
+}
+
+
+// Filter rebuilt from the keys of live nodes, twice as large as
+// they need
+void __tbloomRebuild(tmap* map) {
+    tbloom* bloom = map->__bloom;
+    tnodeblock* nodeBlock;
+    size_t live = bloom->count > bloom->removed ? bloom->count - bloom->removed : 0;
+    size_t nbBlocks = 2 * live / BLOOM_BLOCK_KEYS;
+    unsigned int node;
+
+    __tbloomAlloc(map, nbBlocks > BLOOM_MIN_BLOCKS ? nbBlocks : BLOOM_MIN_BLOCKS);
+    for(nodeBlock = map->__firstNodeBlock; nodeBlock != NULL; nodeBlock = nodeBlock->__next) {
+        for(node=0; node < nodeBlock->__index; ++node) {
+            // Released nodes are 0 high
+            if(nodeBlock->__nodes[node].__height != 0) {
+                __tbloomAdd(map, nodeBlock->__nodes[node].key);
+            }
+        }
+    }
+}
+
+
+// After a change of the map: too many keys, or too many of them removed
+void __tbloomCheck(tmap* map) {
+    tbloom* bloom = map->__bloom;
+    size_t live = bloom->count > bloom->removed ? bloom->count - bloom->removed : 0;
+
+    if(live > bloom->nbBlocks * BLOOM_BLOCK_KEYS
+       || (bloom->removed > BLOOM_MIN_BLOCKS * BLOOM_BLOCK_KEYS && bloom->removed > live)) {
+        __tbloomRebuild(map);
+    }
+}
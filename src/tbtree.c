@@ -0,0 +1,710 @@
+/*********************************************************************************
+MIT License
+
+Copyright (c) 2019 Mathieu Comeau
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************/
+
+/*
+B+ tree engine for tmap.
+
+Inner nodes and leaves hold up to BTREE_ORDER sorted keys and are aligned on
+cache lines. Each key is kept as a pointer to its map node, along with its
+inline part in a separate array: the key itself for TMAP_KEY_U64 maps and the
+cached prefix for TMAP_KEY_STRING maps. Searching a node mostly reads that
+array, so a lookup costs about one miss per level where the AVL tree costs one
+per key compared. TMAP_KEY_PTR keys have no inline part and are compared by
+the client's function.
+
+Separators in inner nodes are live keys, the lowest of the subtree on their
+right. Deleting one replaces it by its successor, so that client keys are never
+read once deleted. Leaves are linked in key order for cursors and range scans.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tmap.h"
+#include "tmapint.h"
+
+
+#define CACHE_LINE_SIZE 64
+
+// Keys per node
+#ifndef BTREE_ORDER
+#define BTREE_ORDER 32
+#endif
+
+// Fewer keys than this and a node borrows from or merges with a sibling
+#define BTREE_MIN (BTREE_ORDER / 2)
+
+// Levels, a tree of order 4 this high is more than memory can hold
+#define BTREE_MAX_HEIGHT 64
+
+
+typedef struct tbnode {
+    int count;
+    // Inline part of keys, searched first
+    uint64_t ikeys[BTREE_ORDER];
+    tnode* nodes[BTREE_ORDER];
+    // Memory as allocated, before alignment
+    void* mem;
+} tbnode;
+
+
+typedef struct tbleaf {
+    tbnode n;
+    struct tbleaf* next;
+    struct tbleaf* previous;
+} tbleaf;
+
+
+// Child i holds the keys lower than key i and not lower than key i-1
+typedef struct tbinner {
+    tbnode n;
+    tbnode* children[BTREE_ORDER + 1];
+} tbinner;
+
+
+typedef struct tbtree {
+    tbnode* root;
+    // Levels, 1 when the root is a leaf, 0 when the tree is empty
+    int height;
+    tbleaf* first;
+    tbleaf* last;
+    // Bytes of inner nodes and leaves
+    size_t bytes;
+} tbtree;
+
+
+/**********************************************************************/
+// Keys
+
+
+uint64_t __tbInline(tmap* map, const tkey* k) __attribute__((always_inline));
+inline uint64_t __tbInline(tmap* map, const tkey* k) {
+    switch(map->__keyKind) {
+        case TMAP_KEY_U64:
+            return (uint64_t)(uintptr_t)k->key;
+        case TMAP_KEY_STRING:
+            return k->prefix;
+        default:
+            return 0;
+    }
+}
+
+
+uint64_t __tbNodeInline(tmap* map, const tnode* node) __attribute__((always_inline));
+inline uint64_t __tbNodeInline(tmap* map, const tnode* node) {
+    switch(map->__keyKind) {
+        case TMAP_KEY_U64:
+            return (uint64_t)(uintptr_t)node->key;
+        case TMAP_KEY_STRING:
+            return node->__prefix;
+        default:
+            return 0;
+    }
+}
+
+
+// Compare 'k' with key 'i' of 'b', on the inline part when it tells
+int __tbCmp(tmap* map, const tkey* k, uint64_t kin, const tbnode* b, int i) __attribute__((always_inline));
+inline int __tbCmp(tmap* map, const tkey* k, uint64_t kin, const tbnode* b, int i) {
+    if(map->__keyKind != TMAP_KEY_PTR) {
+        if(kin != b->ikeys[i]) {
+            return kin < b->ikeys[i] ? -1 : 1;
+        }
+        if(map->__keyKind == TMAP_KEY_U64) {
+            return 0;
+        }
+    }
+    return __tcmp(map, k, b->nodes[i]);
+}
+
+
+// Index of the first key of 'b' not lower than 'k', '*found' is set
+// if it is equal
+int __tbSearch(tmap* map, const tbnode* b, const tkey* k, uint64_t kin, int* found) {
+    int lo = 0;
+    int hi = b->count;
+    int mid;
+    int c;
+
+    *found = 0;
+    while(lo < hi) {
+        mid = (lo + hi) / 2;
+        c = __tbCmp(map, k, kin, b, mid);
+        if(c <= 0) {
+            *found |= (c == 0);
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+
+/**********************************************************************/
+// Nodes
+
+
+tbnode* __tbNodeAlloc(tmap* map, size_t size) {
+    void* mem = MAPALLOC(map, size + CACHE_LINE_SIZE);
+    tbnode* b = (tbnode*)(((uintptr_t)mem + CACHE_LINE_SIZE - 1) & ~(uintptr_t)(CACHE_LINE_SIZE - 1));
+
+    ((tbtree*)map->__engineData)->bytes += size + CACHE_LINE_SIZE;
+    b->mem = mem;
+    b->count = 0;
+    return b;
+}
+
+
+void __tbNodeFree(tmap* map, tbnode* b, size_t size) {
+    ((tbtree*)map->__engineData)->bytes -= size + CACHE_LINE_SIZE;
+    MAPFREE(map, b->mem, size + CACHE_LINE_SIZE);
+}
+
+
+// New leaf linked after 'previous', or first if NULL
+tbleaf* __tbLeafNew(tmap* map, tbtree* bt, tbleaf* previous) {
+    tbleaf* leaf = (tbleaf*)__tbNodeAlloc(map, sizeof(tbleaf));
+
+    leaf->previous = previous;
+    leaf->next = previous != NULL ? previous->next : NULL;
+    if(previous != NULL) {
+        previous->next = leaf;
+    } else {
+        bt->first = leaf;
+    }
+    if(leaf->next != NULL) {
+        leaf->next->previous = leaf;
+    } else {
+        bt->last = leaf;
+    }
+    return leaf;
+}
+
+
+void __tbLeafFree(tmap* map, tbtree* bt, tbleaf* leaf) {
+    if(leaf->previous != NULL) {
+        leaf->previous->next = leaf->next;
+    } else {
+        bt->first = leaf->next;
+    }
+    if(leaf->next != NULL) {
+        leaf->next->previous = leaf->previous;
+    } else {
+        bt->last = leaf->previous;
+    }
+    __tbNodeFree(map, &leaf->n, sizeof(tbleaf));
+}
+
+
+// Move keys [from, from+n[ of 'src' to 'to' in 'dst'
+void __tbMove(tbnode* dst, int to, tbnode* src, int from, int n) {
+    memmove(&dst->ikeys[to], &src->ikeys[from], n * sizeof(uint64_t));
+    memmove(&dst->nodes[to], &src->nodes[from], n * sizeof(tnode*));
+}
+
+
+void __tbInsertKey(tbnode* b, int i, uint64_t ikey, tnode* node) {
+    __tbMove(b, i + 1, b, i, b->count - i);
+    b->ikeys[i] = ikey;
+    b->nodes[i] = node;
+    ++b->count;
+}
+
+
+void __tbRemoveKey(tbnode* b, int i) {
+    __tbMove(b, i, b, i + 1, b->count - i - 1);
+    --b->count;
+}
+
+
+void __tbFreeSubtree(tmap* map, tbnode* b, int level) {
+    tbinner* inner = (tbinner*)b;
+    int i;
+
+    if(level == 1) {
+        __tbNodeFree(map, b, sizeof(tbleaf));
+        return;
+    }
+    for(i=0; i<=b->count; ++i) {
+        __tbFreeSubtree(map, inner->children[i], level - 1);
+    }
+    __tbNodeFree(map, b, sizeof(tbinner));
+}
+
+
+/**********************************************************************/
+// Tree
+
+
+// Walk down to the leaf where 'k' is or would be. Inner nodes visited
+// and the child taken in each are stored in 'path' and 'idx' if given.
+tbleaf* __tbDescend(tmap* map, tbtree* bt, const tkey* k, uint64_t kin,
+                    tbinner** path, int* idx, int* depth) {
+    tbnode* b = bt->root;
+    int level;
+    int found;
+    int i;
+
+    *depth = 0;
+    for(level = bt->height; level > 1; --level) {
+        i = __tbSearch(map, b, k, kin, &found);
+        // Keys equal to a separator are on its right
+        i += found;
+        if(path != NULL) {
+            path[*depth] = (tbinner*)b;
+            idx[*depth] = i;
+        }
+        ++*depth;
+        b = ((tbinner*)b)->children[i];
+    }
+    return (tbleaf*)b;
+}
+
+
+// Add separator 'node' and the 'right' node split from child 'idx[depth-1]'
+// of 'path[depth-1]', splitting ancestors as long as they are full
+void __tbInsertUp(tmap* map, tbtree* bt, tbinner** path, int* idx, int depth,
+                  tnode* node, tbnode* right) {
+    uint64_t ikeys[BTREE_ORDER + 1];
+    tnode* nodes[BTREE_ORDER + 1];
+    tbnode* children[BTREE_ORDER + 2];
+    const int mid = (BTREE_ORDER + 1) / 2;
+    tbinner* parent;
+    tbinner* split;
+    int pos;
+
+    while(depth > 0) {
+        parent = path[--depth];
+        pos = idx[depth];
+        if(parent->n.count < BTREE_ORDER) {
+            memmove(&parent->children[pos + 2], &parent->children[pos + 1],
+                    (parent->n.count - pos) * sizeof(tbnode*));
+            parent->children[pos + 1] = right;
+            __tbInsertKey(&parent->n, pos, __tbNodeInline(map, node), node);
+            return;
+        }
+
+        // Full: lay all keys and children out, the middle key goes up
+        memcpy(ikeys, parent->n.ikeys, pos * sizeof(uint64_t));
+        memcpy(nodes, parent->n.nodes, pos * sizeof(tnode*));
+        memcpy(children, parent->children, (pos + 1) * sizeof(tbnode*));
+        ikeys[pos] = __tbNodeInline(map, node);
+        nodes[pos] = node;
+        children[pos + 1] = right;
+        memcpy(&ikeys[pos + 1], &parent->n.ikeys[pos], (BTREE_ORDER - pos) * sizeof(uint64_t));
+        memcpy(&nodes[pos + 1], &parent->n.nodes[pos], (BTREE_ORDER - pos) * sizeof(tnode*));
+        memcpy(&children[pos + 2], &parent->children[pos + 1], (BTREE_ORDER - pos) * sizeof(tbnode*));
+
+        split = (tbinner*)__tbNodeAlloc(map, sizeof(tbinner));
+        memcpy(parent->n.ikeys, ikeys, mid * sizeof(uint64_t));
+        memcpy(parent->n.nodes, nodes, mid * sizeof(tnode*));
+        memcpy(parent->children, children, (mid + 1) * sizeof(tbnode*));
+        parent->n.count = mid;
+        split->n.count = BTREE_ORDER - mid;
+        memcpy(split->n.ikeys, &ikeys[mid + 1], split->n.count * sizeof(uint64_t));
+        memcpy(split->n.nodes, &nodes[mid + 1], split->n.count * sizeof(tnode*));
+        memcpy(split->children, &children[mid + 1], (split->n.count + 1) * sizeof(tbnode*));
+
+        node = nodes[mid];
+        right = &split->n;
+    }
+
+    // Root split
+    parent = (tbinner*)__tbNodeAlloc(map, sizeof(tbinner));
+    parent->n.count = 1;
+    parent->n.ikeys[0] = __tbNodeInline(map, node);
+    parent->n.nodes[0] = node;
+    parent->children[0] = bt->root;
+    parent->children[1] = right;
+    bt->root = &parent->n;
+    ++bt->height;
+}
+
+
+// Bring 'b', child 'idx[depth-1]' of 'path[depth-1]', back to BTREE_MIN
+// keys with a sibling's, and its ancestors after it
+void __tbRebalance(tmap* map, tbtree* bt, tbinner** path, int* idx, int depth, tbnode* b) {
+    int isLeaf = 1;
+    tbinner* parent;
+    tbnode* left;
+    tbnode* right;
+    tbinner* inner;
+    int ci;
+
+    while(depth > 0 && b->count < BTREE_MIN) {
+        parent = path[--depth];
+        ci = idx[depth];
+        left = ci > 0 ? parent->children[ci - 1] : NULL;
+        right = ci < parent->n.count ? parent->children[ci + 1] : NULL;
+
+        if(isLeaf) {
+            if(left != NULL && left->count > BTREE_MIN) {
+                __tbInsertKey(b, 0, left->ikeys[left->count - 1], left->nodes[left->count - 1]);
+                --left->count;
+                parent->n.ikeys[ci - 1] = b->ikeys[0];
+                parent->n.nodes[ci - 1] = b->nodes[0];
+            } else if(right != NULL && right->count > BTREE_MIN) {
+                __tbInsertKey(b, b->count, right->ikeys[0], right->nodes[0]);
+                __tbRemoveKey(right, 0);
+                parent->n.ikeys[ci] = right->ikeys[0];
+                parent->n.nodes[ci] = right->nodes[0];
+            } else {
+                if(left == NULL) {
+                    // Merge the right sibling instead
+                    left = b;
+                    b = right;
+                    ++ci;
+                }
+                __tbMove(left, left->count, b, 0, b->count);
+                left->count += b->count;
+                __tbLeafFree(map, bt, (tbleaf*)b);
+                memmove(&parent->children[ci], &parent->children[ci + 1],
+                        (parent->n.count - ci) * sizeof(tbnode*));
+                __tbRemoveKey(&parent->n, ci - 1);
+            }
+        } else {
+            inner = (tbinner*)b;
+            if(left != NULL && left->count > BTREE_MIN) {
+                // Separator comes down, left's last key goes up
+                memmove(&inner->children[1], &inner->children[0], (b->count + 1) * sizeof(tbnode*));
+                inner->children[0] = ((tbinner*)left)->children[left->count];
+                __tbInsertKey(b, 0, parent->n.ikeys[ci - 1], parent->n.nodes[ci - 1]);
+                parent->n.ikeys[ci - 1] = left->ikeys[left->count - 1];
+                parent->n.nodes[ci - 1] = left->nodes[left->count - 1];
+                --left->count;
+            } else if(right != NULL && right->count > BTREE_MIN) {
+                inner->children[b->count + 1] = ((tbinner*)right)->children[0];
+                __tbInsertKey(b, b->count, parent->n.ikeys[ci], parent->n.nodes[ci]);
+                parent->n.ikeys[ci] = right->ikeys[0];
+                parent->n.nodes[ci] = right->nodes[0];
+                memmove(&((tbinner*)right)->children[0], &((tbinner*)right)->children[1],
+                        right->count * sizeof(tbnode*));
+                __tbRemoveKey(right, 0);
+            } else {
+                if(left == NULL) {
+                    left = b;
+                    b = right;
+                    ++ci;
+                }
+                __tbInsertKey(left, left->count, parent->n.ikeys[ci - 1], parent->n.nodes[ci - 1]);
+                memcpy(&((tbinner*)left)->children[left->count], ((tbinner*)b)->children,
+                       (b->count + 1) * sizeof(tbnode*));
+                __tbMove(left, left->count, b, 0, b->count);
+                left->count += b->count;
+                __tbNodeFree(map, b, sizeof(tbinner));
+                memmove(&parent->children[ci], &parent->children[ci + 1],
+                        (parent->n.count - ci) * sizeof(tbnode*));
+                __tbRemoveKey(&parent->n, ci - 1);
+            }
+        }
+        b = &parent->n;
+        isLeaf = 0;
+    }
+
+    if(bt->height > 1 && bt->root->count == 0) {
+        b = bt->root;
+        bt->root = ((tbinner*)b)->children[0];
+        __tbNodeFree(map, b, sizeof(tbinner));
+        --bt->height;
+    }
+}
+
+
+/**********************************************************************/
+// Engine operations
+
+
+tnode* __tbtreeGet(tmap* map, void* key) {
+    tbtree* bt = (tbtree*)map->__engineData;
+    tbleaf* leaf;
+    uint64_t kin;
+    tkey k;
+    int depth;
+    int found;
+    int i;
+
+    if(bt->root == NULL) {
+        return NULL;
+    }
+    __tkeyInit(map, &k, key);
+    kin = __tbInline(map, &k);
+    leaf = __tbDescend(map, bt, &k, kin, NULL, NULL, &depth);
+    i = __tbSearch(map, &leaf->n, &k, kin, &found);
+    return found ? leaf->n.nodes[i] : NULL;
+}
+
+
+tnode* __tbtreeInsert(tmap* map, void* key, int* created) {
+    tbtree* bt = (tbtree*)map->__engineData;
+    tbinner* path[BTREE_MAX_HEIGHT];
+    int idx[BTREE_MAX_HEIGHT];
+    const int half = (BTREE_ORDER + 1) / 2;
+    tbleaf* leaf;
+    tbleaf* right;
+    tnode* node;
+    uint64_t kin;
+    tkey k;
+    int depth;
+    int found;
+    int i;
+
+    if(bt->root == NULL) {
+        bt->root = &__tbLeafNew(map, bt, NULL)->n;
+        bt->height = 1;
+    }
+    __tkeyInit(map, &k, key);
+    kin = __tbInline(map, &k);
+    leaf = __tbDescend(map, bt, &k, kin, path, idx, &depth);
+    i = __tbSearch(map, &leaf->n, &k, kin, &found);
+    if(found) {
+        *created = 0;
+        return leaf->n.nodes[i];
+    }
+
+    node = __nodeAlloc(map);
+    __tsetKey(map, node, key);
+    *created = 1;
+    if(leaf->n.count < BTREE_ORDER) {
+        __tbInsertKey(&leaf->n, i, __tbNodeInline(map, node), node);
+        return node;
+    }
+
+    // Full leaf, half of the keys go to a new one on its right. Keys
+    // added in order fill leaves instead of leaving them half empty.
+    right = __tbLeafNew(map, bt, leaf);
+    if(i == BTREE_ORDER && right->next == NULL) {
+        __tbInsertKey(&right->n, 0, __tbNodeInline(map, node), node);
+    } else if(i < half) {
+        __tbMove(&right->n, 0, &leaf->n, half - 1, BTREE_ORDER - half + 1);
+        right->n.count = BTREE_ORDER - half + 1;
+        leaf->n.count = half - 1;
+        __tbInsertKey(&leaf->n, i, __tbNodeInline(map, node), node);
+    } else {
+        __tbMove(&right->n, 0, &leaf->n, half, BTREE_ORDER - half);
+        right->n.count = BTREE_ORDER - half;
+        leaf->n.count = half;
+        __tbInsertKey(&right->n, i - half, __tbNodeInline(map, node), node);
+    }
+    __tbInsertUp(map, bt, path, idx, depth, right->n.nodes[0], &right->n);
+    return node;
+}
+
+
+int __tbtreeRemove(tmap* map, void* key) {
+    tbtree* bt = (tbtree*)map->__engineData;
+    tbinner* path[BTREE_MAX_HEIGHT];
+    int idx[BTREE_MAX_HEIGHT];
+    tbleaf* leaf;
+    tnode* node;
+    uint64_t kin;
+    tkey k;
+    int depth;
+    int found;
+    int i, d;
+
+    if(bt->root == NULL) {
+        return 0;
+    }
+    __tkeyInit(map, &k, key);
+    kin = __tbInline(map, &k);
+    leaf = __tbDescend(map, bt, &k, kin, path, idx, &depth);
+    i = __tbSearch(map, &leaf->n, &k, kin, &found);
+    if(!found) {
+        return 0;
+    }
+
+    node = leaf->n.nodes[i];
+    __tbRemoveKey(&leaf->n, i);
+
+    if(depth == 0 && leaf->n.count == 0) {
+        __tbLeafFree(map, bt, leaf);
+        bt->root = NULL;
+        bt->height = 0;
+    } else {
+        // The lowest key of a subtree may be a separator above it,
+        // the next key takes its place
+        if(i == 0) {
+            for(d = depth - 1; d >= 0; --d) {
+                if(idx[d] > 0 && path[d]->n.nodes[idx[d] - 1] == node) {
+                    path[d]->n.ikeys[idx[d] - 1] = leaf->n.ikeys[0];
+                    path[d]->n.nodes[idx[d] - 1] = leaf->n.nodes[0];
+                    break;
+                }
+            }
+        }
+        __tbRebalance(map, bt, path, idx, depth, &leaf->n);
+    }
+    return __nodeRelease(map, node);
+}
+
+
+// Node at 'mode' position relative to 'key'
+tnode* __tbtreeSeek(tmap* map, void* key, const int mode) {
+    tbtree* bt = (tbtree*)map->__engineData;
+    tbleaf* leaf;
+    uint64_t kin;
+    tkey k;
+    int depth;
+    int found;
+    int i;
+
+    if(bt->root == NULL) {
+        return NULL;
+    }
+    if(mode == TSEEK_FIRST) {
+        return bt->first->n.nodes[0];
+    }
+    if(mode == TSEEK_LAST) {
+        return bt->last->n.nodes[bt->last->n.count - 1];
+    }
+
+    __tkeyInit(map, &k, key);
+    kin = __tbInline(map, &k);
+    leaf = __tbDescend(map, bt, &k, kin, NULL, NULL, &depth);
+    i = __tbSearch(map, &leaf->n, &k, kin, &found);
+    if(mode == TSEEK_LT) {
+        if(i > 0) {
+            return leaf->n.nodes[i - 1];
+        }
+        leaf = leaf->previous;
+        return leaf != NULL ? leaf->n.nodes[leaf->n.count - 1] : NULL;
+    }
+    if(mode == TSEEK_GT) {
+        i += found;
+    }
+    if(i < leaf->n.count) {
+        return leaf->n.nodes[i];
+    }
+    leaf = leaf->next;
+    return leaf != NULL ? leaf->n.nodes[0] : NULL;
+}
+
+
+// Keys in ['lo', 'hi'[ along the linked leaves
+size_t __tbtreeRange(tmap* map, void* lo, void* hi,
+                     int (*fn)(const void* key, void* value, void* ctx),
+                     void* ctx) {
+    tbtree* bt = (tbtree*)map->__engineData;
+    tbleaf* leaf = bt->first;
+    size_t count = 0;
+    uint64_t kin = 0;
+    tkey k;
+    int depth;
+    int found;
+    int i = 0;
+
+    if(bt->root == NULL) {
+        return 0;
+    }
+    if(lo != NULL) {
+        __tkeyInit(map, &k, lo);
+        leaf = __tbDescend(map, bt, &k, __tbInline(map, &k), NULL, NULL, &depth);
+        i = __tbSearch(map, &leaf->n, &k, __tbInline(map, &k), &found);
+    }
+    if(hi != NULL) {
+        __tkeyInit(map, &k, hi);
+        kin = __tbInline(map, &k);
+    }
+
+    for(; leaf != NULL; leaf = leaf->next, i = 0) {
+        for(; i < leaf->n.count; ++i) {
+            if(hi != NULL && __tbCmp(map, &k, kin, &leaf->n, i) <= 0) {
+                return count;
+            }
+            ++count;
+            if(fn(leaf->n.nodes[i]->key, leaf->n.nodes[i]->value, ctx) != 0) {
+                return count;
+            }
+        }
+    }
+    return count;
+}
+
+
+void __tbtreeClear(tmap* map) {
+    tbtree* bt = (tbtree*)map->__engineData;
+
+    if(bt->root != NULL) {
+        __tbFreeSubtree(map, bt->root, bt->height);
+    }
+    bt->root = NULL;
+    bt->height = 0;
+    bt->first = NULL;
+    bt->last = NULL;
+}
+
+
+void __tbtreeReserve(tmap* map, const size_t n) {
+}
+
+
+void __tbtreeDestroy(tmap* map) {
+    __tbtreeClear(map);
+    MAPFREE(map, map->__engineData, sizeof(tbtree));
+    map->__engineData = NULL;
+}
+
+
+int __tbtreeHeight(tmap* map) {
+    return ((tbtree*)map->__engineData)->height;
+}
+
+
+size_t __tbtreeBytes(tmap* map) {
+    return sizeof(tbtree) + ((tbtree*)map->__engineData)->bytes;
+}
+
+
+// Splits up to the root, and a new root
+size_t __tbtreeGrowth(tmap* map) {
+    return (((tbtree*)map->__engineData)->height + 1) * (sizeof(tbinner) + CACHE_LINE_SIZE);
+}
+
+
+const tmapops __tbtreeOps = {
+    .get = __tbtreeGet,
+    .insert = __tbtreeInsert,
+    .remove = __tbtreeRemove,
+    .clear = __tbtreeClear,
+    .reserve = __tbtreeReserve,
+    .destroy = __tbtreeDestroy,
+    .seek = __tbtreeSeek,
+    .range = __tbtreeRange,
+    .bytes = __tbtreeBytes,
+    .growth = __tbtreeGrowth
+};
+
+
+void __tbtreeInit(tmap* map) {
+    tbtree* bt = (tbtree*)MAPALLOC(map, sizeof(tbtree));
+
+    bt->root = NULL;
+    bt->height = 0;
+    bt->first = NULL;
+    bt->last = NULL;
+    bt->bytes = 0;
+    map->__engineData = bt;
+}
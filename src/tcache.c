@@ -0,0 +1,184 @@
+/*********************************************************************************
+MIT License
+
+Copyright (c) 2019 Mathieu Comeau
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************/
+
+/*
+Per thread cache of the last lookups of TMAP_LOOKUP_CACHE maps.
+
+Each thread has a small direct mapped cache of lines holding a map, a key,
+the value 'tget' found for it (NULL too) and the map's write version then.
+Writers bump the version as they take the lock and again as they release
+it: a line is only used while the version is the one it was filled with,
+no write has started since. A hit reads the version and the thread's own
+line, neither the lock nor the map's nodes.
+
+The version is read before the lookup filling a line: a write running
+meanwhile leaves a version the line never matches again.
+
+Only keys that fit in a line are cached: integer keys, strings shorter
+than CACHE_KEY_BYTES and TMAP_KEY_PTR keys of a 'keySize' up to it.
+Hits and misses are counted in a few counters, threads spread on them.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tmap.h"
+#include "tmapint.h"
+
+
+// Lines per thread, a power of 2
+#define CACHE_LINES 64
+#define CACHE_KEY_BYTES 24
+// Hit and miss counters per map, a power of 2
+#define CACHE_COUNTERS 16
+
+
+// Line of a thread's cache, one cache line
+typedef struct tcacheline {
+    const tmap* map;
+    uint64_t id;
+    unsigned long version;
+    void* value;
+    union {
+        uint64_t u64;
+        char bytes[CACHE_KEY_BYTES];
+    } key;
+} tcacheline;
+
+
+// Counters on their own cache line
+typedef struct tcachecounter {
+    unsigned long hits;
+    unsigned long misses;
+    char pad[64 - 2*sizeof(unsigned long)];
+} tcachecounter;
+
+
+struct tcache {
+    // Maps a thread's lines were filled for: a map freed and another
+    // created at its address get different ids
+    uint64_t id;
+    tcachecounter counters[CACHE_COUNTERS];
+};
+
+
+static uint64_t __tcacheNextId = 0;
+static unsigned int __tcacheNextThread = 0;
+
+static __thread tcacheline __tcacheLines[CACHE_LINES] __attribute__((aligned(64)));
+// Counter of the thread, +1, 0 until its first lookup
+static __thread unsigned int __tcacheThread = 0;
+
+
+void __tcacheInit(tmap* map) {
+    tcache* cache = (tcache*)MAPALLOC(map, sizeof(tcache));
+
+    memset(cache, 0, sizeof(tcache));
+    cache->id = __atomic_add_fetch(&__tcacheNextId, 1, __ATOMIC_RELAXED);
+    map->__cache = cache;
+}
+
+
+void __tcacheDestroy(tmap* map) {
+    MAPFREE(map, map->__cache, sizeof(tcache));
+    map->__cache = NULL;
+}
+
+
+// Bytes of 'key' compared, 0 if it doesn't fit in a line
+static inline size_t __tcacheKeyBytes(tmap* map, const void* key) {
+    size_t len;
+
+    switch(map->__keyKind) {
+        case TMAP_KEY_U64:
+            return sizeof(uint64_t);
+        case TMAP_KEY_STRING:
+            len = strnlen((const char*)key, CACHE_KEY_BYTES);
+            return len < CACHE_KEY_BYTES ? len + 1 : 0;
+        default:
+            return map->__keySize <= CACHE_KEY_BYTES ? map->__keySize : 0;
+    }
+}
+
+
+static inline tcachecounter* __tcacheCounter(tcache* cache) {
+    if(__tcacheThread == 0) {
+        __tcacheThread = __atomic_add_fetch(&__tcacheNextThread, 1, __ATOMIC_RELAXED);
+    }
+    return &cache->counters[__tcacheThread & (CACHE_COUNTERS - 1)];
+}
+
+
+void* __tcacheGet(tmap* map, void* key) {
+    tcache* cache = map->__cache;
+    tcachecounter* counter = __tcacheCounter(cache);
+    size_t len = __tcacheKeyBytes(map, key);
+    unsigned long version;
+    tcacheline* line;
+    uint64_t u64;
+    void* v;
+
+    if(len == 0) {
+        __atomic_add_fetch(&counter->misses, 1, __ATOMIC_RELAXED);
+        return __tgetUncached(map, key);
+    }
+
+    u64 = (uint64_t)(uintptr_t)key;
+    line = &__tcacheLines[(__tkeyHash(map, key) ^ cache->id * 0x9e3779b97f4a7c15ULL) >> 32 & (CACHE_LINES - 1)];
+    version = __atomic_load_n(&map->__version, __ATOMIC_ACQUIRE);
+    if(line->map == map && line->id == cache->id && line->version == version
+       && (map->__keyKind == TMAP_KEY_U64 ? line->key.u64 == u64 : !memcmp(line->key.bytes, key, len))) {
+        __atomic_add_fetch(&counter->hits, 1, __ATOMIC_RELAXED);
+        return line->value;
+    }
+
+    __atomic_add_fetch(&counter->misses, 1, __ATOMIC_RELAXED);
+    v = __tgetUncached(map, key);
+    line->map = map;
+    line->id = cache->id;
+    line->version = version;
+    line->value = v;
+    if(map->__keyKind == TMAP_KEY_U64) {
+        line->key.u64 = u64;
+    } else {
+        memcpy(line->key.bytes, key, len);
+    }
+    return v;
+}
+
+
+void tcache_stats(tmap* map, unsigned long* hits, unsigned long* misses) {
+    int i;
+
+    *hits = 0;
+    *misses = 0;
+    if(map->__cache == NULL) {
+        return;
+    }
+    for(i=0; i<CACHE_COUNTERS; ++i) {
+        *hits += __atomic_load_n(&map->__cache->counters[i].hits, __ATOMIC_RELAXED);
+        *misses += __atomic_load_n(&map->__cache->counters[i].misses, __ATOMIC_RELAXED);
+    }
+}
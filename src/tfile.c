@@ -0,0 +1,549 @@
+/*********************************************************************************
+MIT License
+
+Copyright (c) 2019 Mathieu Comeau
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************/
+
+/*
+Map files, written by 'tsave' and mapped by 'topen'.
+
+A file holds a header, then one entry per key in key order, then the bytes of
+keys and values. Entries refer to those bytes by their offset in the file, so
+the file can be mapped anywhere and used as is: 'topen' only checks the header.
+
+Each entry also holds the inline part of its key, the integer of TMAP_KEY_U64
+maps or the prefix of TMAP_KEY_STRING maps, so that a binary search over the
+entries mostly reads the entry array. Pages are read in by the system as they
+are first touched, and processes mapping the same file share them.
+
+Mapped maps are read only. Lookups hand out a node of the calling thread
+filled from the entry found.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tmap.h"
+#include "tmapint.h"
+
+
+#define TFILE_MAGIC "TMAPFILE"
+#define TFILE_VERSION 1
+// Read back the other way round by a host of the other endianness
+#define TFILE_BYTE_ORDER 0x01020304
+
+#define TFILE_ALIGN(n,a) (((n) + (a) - 1) & ~(uint64_t)((a) - 1))
+
+
+typedef struct tfileheader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t keyKind;
+    uint32_t reserved;
+    uint64_t keySize;
+    uint64_t valueSize;
+    uint64_t count;
+    // Offset of the entries, and file size
+    uint64_t entries;
+    uint64_t size;
+} tfileheader;
+
+
+typedef struct tfileentry {
+    // Inline part of the key
+    uint64_t ikey;
+    // Offset of the key bytes, 0 for integer keys
+    uint64_t key;
+    // Offset of the value bytes, 0 for NULL. The value itself when
+    // the file was saved with a value size of 0.
+    uint64_t value;
+} tfileentry;
+
+
+typedef struct tfile {
+    const char* base;
+    size_t size;
+    const tfileentry* entries;
+    uint64_t count;
+    uint64_t valueSize;
+} tfile;
+
+
+// Node handed out by lookups
+static __thread tnode __tfileNode;
+
+
+/**********************************************************************/
+// Lookups
+
+
+uint64_t __tfileInline(tmap* map, const tkey* k) __attribute__((always_inline));
+inline uint64_t __tfileInline(tmap* map, const tkey* k) {
+    switch(map->__keyKind) {
+        case TMAP_KEY_U64:
+            return (uint64_t)(uintptr_t)k->key;
+        case TMAP_KEY_STRING:
+            return k->prefix;
+        default:
+            return 0;
+    }
+}
+
+
+void* __tfileKey(tmap* map, const tfile* f, const tfileentry* e) {
+    if(map->__keyKind == TMAP_KEY_U64) {
+        return (void*)(uintptr_t)e->ikey;
+    }
+    return (void*)(f->base + e->key);
+}
+
+
+// Compare 'k' with the key of entry 'e'. String keys are read only when
+// prefixes are equal and 'k' is at least as long as a prefix.
+int __tfileCmp(tmap* map, const tfile* f, const tkey* k, uint64_t kin, const tfileentry* e) {
+    switch(map->__keyKind) {
+        case TMAP_KEY_U64:
+            return (kin > e->ikey) - (kin < e->ikey);
+        case TMAP_KEY_STRING:
+            if(kin != e->ikey) {
+                return kin < e->ikey ? -1 : 1;
+            }
+            if(k->len < 8) {
+                return 0;
+            }
+            return strcmp((const char*)k->key + 8, f->base + e->key + 8);
+        default:
+            return __tcmpKeys(map, k->key, (void*)(f->base + e->key));
+    }
+}
+
+
+// Index of the first entry not lower than 'key', or greater if 'strict'
+uint64_t __tfileSearch(tmap* map, const tfile* f, void* key, const int strict) {
+    uint64_t lo = 0;
+    uint64_t hi = f->count;
+    uint64_t mid;
+    uint64_t kin;
+    tkey k;
+    int c;
+
+    __tkeyInit(map, &k, key);
+    kin = __tfileInline(map, &k);
+    while(lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        c = __tfileCmp(map, f, &k, kin, &f->entries[mid]);
+        if(c < 0 || (c == 0 && !strict)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+
+tnode* __tfileNodeAt(tmap* map, const tfile* f, uint64_t i) {
+    const tfileentry* e = &f->entries[i];
+
+    __tfileNode.key = __tfileKey(map, f, e);
+    if(f->valueSize == 0) {
+        __tfileNode.value = (void*)(uintptr_t)e->value;
+    } else {
+        __tfileNode.value = e->value != 0 ? (void*)(f->base + e->value) : NULL;
+    }
+    return &__tfileNode;
+}
+
+
+/**********************************************************************/
+// Engine operations
+
+
+tnode* __tfileGet(tmap* map, void* key) {
+    const tfile* f = (const tfile*)map->__engineData;
+    uint64_t i = __tfileSearch(map, f, key, 0);
+    tkey k;
+
+    if(i == f->count) {
+        return NULL;
+    }
+    __tkeyInit(map, &k, key);
+    if(__tfileCmp(map, f, &k, __tfileInline(map, &k), &f->entries[i]) != 0) {
+        return NULL;
+    }
+    return __tfileNodeAt(map, f, i);
+}
+
+
+void __tfileReadOnly(void) {
+    fprintf(stderr, "Maps opened with topen are read only\n");
+    exit(-1);
+}
+
+
+tnode* __tfileInsert(tmap* map, void* key, int* created) {
+    __tfileReadOnly();
+    return NULL;
+}
+
+
+int __tfileRemove(tmap* map, void* key) {
+    __tfileReadOnly();
+    return 0;
+}
+
+
+void __tfileClear(tmap* map) {
+    __tfileReadOnly();
+}
+
+
+void __tfileReserve(tmap* map, const size_t n) {
+}
+
+
+void __tfileDestroy(tmap* map) {
+    tfile* f = (tfile*)map->__engineData;
+
+    munmap((void*)f->base, f->size);
+    MAPFREE(map, f, sizeof(tfile));
+    map->__engineData = NULL;
+}
+
+
+tnode* __tfileSeek(tmap* map, void* key, const int mode) {
+    const tfile* f = (const tfile*)map->__engineData;
+    uint64_t i;
+
+    if(f->count == 0) {
+        return NULL;
+    }
+    switch(mode) {
+        case TSEEK_FIRST:
+            i = 0;
+            break;
+        case TSEEK_LAST:
+            i = f->count - 1;
+            break;
+        case TSEEK_LT:
+            i = __tfileSearch(map, f, key, 0);
+            if(i == 0) {
+                return NULL;
+            }
+            --i;
+            break;
+        default:
+            i = __tfileSearch(map, f, key, mode == TSEEK_GT);
+            break;
+    }
+    return i < f->count ? __tfileNodeAt(map, f, i) : NULL;
+}
+
+
+size_t __tfileRange(tmap* map, void* lo, void* hi,
+                    int (*fn)(const void* key, void* value, void* ctx),
+                    void* ctx) {
+    const tfile* f = (const tfile*)map->__engineData;
+    uint64_t i = lo != NULL ? __tfileSearch(map, f, lo, 0) : 0;
+    uint64_t end = hi != NULL ? __tfileSearch(map, f, hi, 0) : f->count;
+    size_t count = 0;
+    tnode* node;
+
+    for(; i < end; ++i) {
+        node = __tfileNodeAt(map, f, i);
+        ++count;
+        if(fn(node->key, node->value, ctx) != 0) {
+            break;
+        }
+    }
+    return count;
+}
+
+
+const tmapops __tfileOps = {
+    .get = __tfileGet,
+    .insert = __tfileInsert,
+    .remove = __tfileRemove,
+    .clear = __tfileClear,
+    .reserve = __tfileReserve,
+    .destroy = __tfileDestroy,
+    .seek = __tfileSeek,
+    .range = __tfileRange
+};
+
+
+/**********************************************************************/
+// Saving and opening
+
+
+// Keys and values of a map, in key order
+typedef struct tfilepairs {
+    tmap* map;
+    void** pairs;
+    size_t count;
+    size_t capacity;
+} tfilepairs;
+
+
+int __tfileCollect(const void* key, void* value, void* ctx) {
+    tfilepairs* p = (tfilepairs*)ctx;
+    void** pairs;
+
+    if(p->count == p->capacity) {
+        pairs = MAPALLOC(p->map, 2 * 2*p->capacity * sizeof(void*));
+        memcpy(pairs, p->pairs, 2*p->count * sizeof(void*));
+        MAPFREE(p->map, p->pairs, 2*p->capacity * sizeof(void*));
+        p->pairs = pairs;
+        p->capacity *= 2;
+    }
+    p->pairs[2*p->count] = (void*)key;
+    p->pairs[2*p->count + 1] = value;
+    ++p->count;
+    return 0;
+}
+
+
+size_t __tfileKeyBytes(tmap* map, const void* key) {
+    switch(map->__keyKind) {
+        case TMAP_KEY_U64:
+            return 0;
+        case TMAP_KEY_STRING:
+            return strlen((const char*)key) + 1;
+        default:
+            return map->__keySize;
+    }
+}
+
+
+// Zeros up to the next multiple of 'align' after 'len' bytes
+int __tfilePad(FILE* out, const size_t len, const size_t align) {
+    static const char zeros[64] = { 0 };
+    size_t n = TFILE_ALIGN(len, align) - len;
+
+    return (n == 0 || fwrite(zeros, n, 1, out) == 1) ? 0 : -1;
+}
+
+
+// Write entries, then key and value bytes, offsets being laid out the
+// same way in both passes
+int __tfileWrite(tmap* map, FILE* out, tfileheader* header, tfilepairs* p) {
+    uint64_t offset = header->entries + header->count * sizeof(tfileentry);
+    tfileentry e;
+    size_t len;
+    size_t i;
+    tkey k;
+
+    if(fwrite(header, sizeof(*header), 1, out) != 1
+       || __tfilePad(out, sizeof(*header), 64) != 0) {
+        return -1;
+    }
+
+    for(i=0; i<p->count; ++i) {
+        __tkeyInit(map, &k, p->pairs[2*i]);
+        e.ikey = __tfileInline(map, &k);
+        e.key = 0;
+        e.value = (uint64_t)(uintptr_t)p->pairs[2*i + 1];
+        if(map->__keyKind != TMAP_KEY_U64) {
+            e.key = offset;
+            offset = TFILE_ALIGN(offset + __tfileKeyBytes(map, p->pairs[2*i]), 8);
+        }
+        if(header->valueSize != 0 && p->pairs[2*i + 1] != NULL) {
+            e.value = offset;
+            offset = TFILE_ALIGN(offset + header->valueSize, 8);
+        }
+        if(fwrite(&e, sizeof(e), 1, out) != 1) {
+            return -1;
+        }
+    }
+
+    for(i=0; i<p->count; ++i) {
+        len = __tfileKeyBytes(map, p->pairs[2*i]);
+        if(len > 0 && (fwrite(p->pairs[2*i], len, 1, out) != 1 || __tfilePad(out, len, 8) != 0)) {
+            return -1;
+        }
+        len = header->valueSize;
+        if(len > 0 && p->pairs[2*i + 1] != NULL
+           && (fwrite(p->pairs[2*i + 1], len, 1, out) != 1 || __tfilePad(out, len, 8) != 0)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+int tsave(tmap* map, const char* path, const size_t valueSize) {
+    tfileheader header;
+    tfilepairs p;
+    char* tmpPath;
+    size_t tmpLen = strlen(path) + 5;
+    size_t i;
+    FILE* out;
+    int rc;
+    int err;
+
+    if(map->__ops->range == NULL || (map->__keyKind == TMAP_KEY_PTR && map->__keySize == 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    p.map = map;
+    p.count = 0;
+    p.capacity = 1024;
+    p.pairs = MAPALLOC(map, 2*p.capacity * sizeof(void*));
+    trange(map, NULL, NULL, __tfileCollect, &p);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TFILE_MAGIC, sizeof(header.magic));
+    header.version = TFILE_VERSION;
+    header.byteOrder = TFILE_BYTE_ORDER;
+    header.keyKind = map->__keyKind;
+    header.keySize = map->__keySize;
+    header.count = p.count;
+    // Values all NULL have no bytes, and read back the same as NULL
+    // pointers: the value size is kept within the file's bytes
+    header.valueSize = 0;
+    for(i=0; i<p.count; ++i) {
+        if(p.pairs[2*i + 1] != NULL) {
+            header.valueSize = valueSize;
+            break;
+        }
+    }
+    header.entries = TFILE_ALIGN(sizeof(header), 64);
+
+    // Written aside then renamed: processes which mapped the previous
+    // file keep it
+    tmpPath = MAPALLOC(map, tmpLen);
+    snprintf(tmpPath, tmpLen, "%s.tmp", path);
+    out = fopen(tmpPath, "wb");
+    rc = -1;
+    if(out != NULL) {
+        rc = __tfileWrite(map, out, &header, &p);
+        if(rc == 0) {
+            header.size = ftell(out);
+            rc = (fseek(out, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, out) != 1) ? -1 : 0;
+        }
+        err = errno;
+        if(fclose(out) != 0 && rc == 0) {
+            err = errno;
+            rc = -1;
+        }
+        if(rc == 0 && rename(tmpPath, path) != 0) {
+            err = errno;
+            rc = -1;
+        }
+        if(rc != 0) {
+            unlink(tmpPath);
+        }
+        errno = err;
+    }
+
+    MAPFREE(map, tmpPath, tmpLen);
+    MAPFREE(map, p.pairs, 2*p.capacity * sizeof(void*));
+    return rc;
+}
+
+
+// Whether the header of a file of 'size' bytes describes entries and
+// key and value bytes within it. Offsets in entries are trusted.
+int __tfileHeaderValid(const tfileheader* header, const uint64_t size) {
+    uint64_t data;
+
+    if(memcmp(header->magic, TFILE_MAGIC, sizeof(header->magic)) != 0
+       || header->version != TFILE_VERSION
+       || header->byteOrder != TFILE_BYTE_ORDER
+       || header->size != size
+       || (header->keyKind != TMAP_KEY_PTR && header->keyKind != TMAP_KEY_U64 && header->keyKind != TMAP_KEY_STRING)
+       || (header->keyKind == TMAP_KEY_PTR && header->keySize == 0)
+       || header->entries < sizeof(tfileheader) || header->entries % 8 != 0
+       || header->entries > size
+       || header->count > (size - header->entries) / sizeof(tfileentry)) {
+        return 0;
+    }
+
+    // Bytes after the entries: each key has its own, values may be NULL
+    data = size - header->entries - header->count * sizeof(tfileentry);
+    if(header->keyKind != TMAP_KEY_U64 && header->count > data / (header->keyKind == TMAP_KEY_PTR ? header->keySize : 1)) {
+        return 0;
+    }
+    return header->valueSize <= data;
+}
+
+
+tmap* topen(const char* path, int (*cmp)(const void*, const void*)) {
+    const tfileheader* header;
+    tmap_config config;
+    struct stat st;
+    tmap* map;
+    tfile* f;
+    void* base;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return NULL;
+    }
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(tfileheader)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) {
+        return NULL;
+    }
+
+    header = (const tfileheader*)base;
+    if(!__tfileHeaderValid(header, st.st_size)
+       || (header->keyKind == TMAP_KEY_PTR && cmp == NULL)) {
+        munmap(base, st.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // Nothing changes in the map, readers need no lock, and it never
+    // allocates nodes
+    memset(&config, 0, sizeof(config));
+    config.cmp = cmp;
+    config.keyKind = header->keyKind;
+    config.keySize = header->keySize;
+    config.multitask = SINGLE_THREADED;
+    config.blockSize = 1;
+    map = tinit_ex(&config);
+
+    f = (tfile*)MAPALLOC(map, sizeof(tfile));
+    f->base = (const char*)base;
+    f->size = st.st_size;
+    f->entries = (const tfileentry*)(f->base + header->entries);
+    f->count = header->count;
+    f->valueSize = header->valueSize;
+    map->__ops = &__tfileOps;
+    map->__engineData = f;
+    map->__count = f->count;
+    return map;
+}
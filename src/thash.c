@@ -0,0 +1,453 @@
+/*********************************************************************************
+MIT License
+
+Copyright (c) 2019 Mathieu Comeau
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************/
+
+/*
+Hash table engine for tmap.
+
+Open addressing table in the style of Abseil's Swiss tables: one control byte
+per slot holds 7 bits of the key hash (or the EMPTY/DELETED markers), and
+control bytes are probed a group of 16 at a time (SSE2 when available).
+Slots point at nodes taken from the map's node blocks.
+
+When the table needs to grow, a new table is allocated and entries are moved
+over a few groups at a time on each following insertion or removal, so that no
+single operation pays for a full rehash. Until then lookups probe both tables.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "tmap.h"
+#include "tmapint.h"
+
+
+#define GROUP_SIZE 16
+
+#define CTRL_EMPTY   ((int8_t)-128)
+#define CTRL_DELETED ((int8_t)-2)
+
+// Old table groups moved to the new table per mutation while resizing
+#define MIGRATE_GROUPS 4
+
+// Groups in a new table
+#define MIN_GROUPS 1
+
+
+typedef struct thashtable {
+    // 'nbGroups * GROUP_SIZE' control bytes followed by as many slots
+    int8_t* ctrl;
+    tnode** slots;
+    size_t groupMask;
+    // Number of EMPTY slots that can still be used before resizing
+    size_t growthLeft;
+} thashtable;
+
+
+typedef struct thash {
+    thashtable cur;
+    // Table being emptied into 'cur', 'ctrl' is NULL when not resizing
+    thashtable old;
+    // Next group of 'old' to migrate
+    size_t migrateGroup;
+    // Live entries
+    size_t count;
+} thash;
+
+
+/**********************************************************************/
+// Group matching, bit i of the result is set for control byte i
+
+#ifdef __SSE2__
+
+unsigned int __groupMatch(const int8_t* group, int8_t h2) __attribute__((always_inline));
+inline unsigned int __groupMatch(const int8_t* group, int8_t h2) {
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl));
+}
+
+
+// EMPTY or DELETED, both have the high bit set
+unsigned int __groupMatchFree(const int8_t* group) __attribute__((always_inline));
+inline unsigned int __groupMatchFree(const int8_t* group) {
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+}
+
+#else
+
+unsigned int __groupMatch(const int8_t* group, int8_t h2) {
+    unsigned int mask = 0;
+    int i;
+
+    for(i=0; i<GROUP_SIZE; ++i) {
+        mask |= (unsigned int)(group[i] == h2) << i;
+    }
+    return mask;
+}
+
+
+unsigned int __groupMatchFree(const int8_t* group) {
+    unsigned int mask = 0;
+    int i;
+
+    for(i=0; i<GROUP_SIZE; ++i) {
+        mask |= (unsigned int)(group[i] < 0) << i;
+    }
+    return mask;
+}
+
+#endif
+
+
+/**********************************************************************/
+// Tables
+
+
+// Mix client hash so that both the group index and the 7 control bits
+// are usable even with a weak hash function
+uint64_t __thashKey(tmap* map, void* key) __attribute__((always_inline));
+inline uint64_t __thashKey(tmap* map, void* key) {
+    uint64_t h = map->__hash(key);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+#define H1(h) ((h) >> 7)
+#define H2(h) ((int8_t)((h) & 0x7f))
+
+
+size_t __ttableBytes(size_t nbGroups) {
+    return nbGroups * GROUP_SIZE * (1 + sizeof(tnode*));
+}
+
+
+void __ttableAlloc(tmap* map, thashtable* table, size_t nbGroups) {
+    size_t capacity = nbGroups * GROUP_SIZE;
+
+    // Control bytes come first. Allocators only align on pointers:
+    // groups are loaded unaligned, slots follow a multiple of 16 bytes.
+    table->ctrl = (int8_t*)MAPALLOC(map, __ttableBytes(nbGroups));
+    table->slots = (tnode**)PTR_OFFSET(table->ctrl, capacity);
+    table->groupMask = nbGroups - 1;
+    table->growthLeft = capacity - capacity / 8;
+    memset(table->ctrl, CTRL_EMPTY, capacity);
+}
+
+
+void __ttableFree(tmap* map, thashtable* table) {
+    MAPFREE(map, table->ctrl, __ttableBytes(table->groupMask + 1));
+    table->ctrl = NULL;
+}
+
+
+// Slot index of 'key' in 'table' or -1
+long __ttableFind(tmap* map, thashtable* table, void* key, uint64_t h) {
+    size_t group = H1(h) & table->groupMask;
+    size_t step = 0;
+    unsigned int match;
+    size_t slot;
+    tkey k;
+    int i;
+
+    __tkeyInit(map, &k, key);
+    while(1) {
+        const int8_t* ctrl = table->ctrl + group * GROUP_SIZE;
+
+        match = __groupMatch(ctrl, H2(h));
+        while(match != 0) {
+            i = __builtin_ctz(match);
+            slot = group * GROUP_SIZE + i;
+            if(__tcmp(map, &k, table->slots[slot]) == 0) {
+                return (long)slot;
+            }
+            match &= match - 1;
+        }
+        if(__groupMatch(ctrl, CTRL_EMPTY) != 0) {
+            return -1;
+        }
+        // Triangular probing visits every group of a power of 2 table
+        group = (group + ++step) & table->groupMask;
+        if(step > table->groupMask) {
+            return -1;
+        }
+    }
+}
+
+
+// Put a node known not to be in 'table' in the first free slot
+void __ttableInsert(thashtable* table, tnode* node, uint64_t h) {
+    size_t group = H1(h) & table->groupMask;
+    size_t step = 0;
+    unsigned int match;
+    size_t slot;
+
+    while(1) {
+        match = __groupMatchFree(table->ctrl + group * GROUP_SIZE);
+        if(match != 0) {
+            slot = group * GROUP_SIZE + __builtin_ctz(match);
+            if(table->ctrl[slot] == CTRL_EMPTY) {
+                --table->growthLeft;
+            }
+            table->ctrl[slot] = H2(h);
+            table->slots[slot] = node;
+            return;
+        }
+        group = (group + ++step) & table->groupMask;
+    }
+}
+
+
+void __ttableErase(thashtable* table, size_t slot) {
+    const int8_t* ctrl = table->ctrl + (slot & ~(size_t)(GROUP_SIZE - 1));
+
+    // A group that still has an EMPTY slot never made a probe go further,
+    // so the slot can become EMPTY again instead of a tombstone
+    if(__groupMatch(ctrl, CTRL_EMPTY) != 0) {
+        table->ctrl[slot] = CTRL_EMPTY;
+        ++table->growthLeft;
+    } else {
+        table->ctrl[slot] = CTRL_DELETED;
+    }
+}
+
+
+/**********************************************************************/
+// Incremental resize
+
+
+void __thashMigrate(tmap* map, thash* hash, size_t nbGroups) {
+    size_t end = hash->migrateGroup + nbGroups;
+    size_t slot;
+
+    if(end > hash->old.groupMask + 1) {
+        end = hash->old.groupMask + 1;
+    }
+
+    for(slot = hash->migrateGroup * GROUP_SIZE; slot < end * GROUP_SIZE; ++slot) {
+        if(hash->old.ctrl[slot] >= 0) {
+            __ttableInsert(&hash->cur, hash->old.slots[slot], __thashKey(map, hash->old.slots[slot]->key));
+            // Probes for keys still in the old table must go past this slot
+            hash->old.ctrl[slot] = CTRL_DELETED;
+        }
+    }
+    hash->migrateGroup = end;
+
+    if(hash->migrateGroup > hash->old.groupMask) {
+        __ttableFree(map, &hash->old);
+    }
+}
+
+
+void __thashGrow(tmap* map, thash* hash) {
+    size_t nbGroups = hash->cur.groupMask + 1;
+
+    if(hash->old.ctrl != NULL) {
+        // New table filled up before the previous resize was done
+        __thashMigrate(map, hash, hash->old.groupMask + 1);
+    }
+
+    // Rehash at the same size when the table is mostly tombstones
+    if(hash->count * 2 >= nbGroups * GROUP_SIZE) {
+        nbGroups *= 2;
+    }
+
+    hash->old = hash->cur;
+    hash->migrateGroup = 0;
+    __ttableAlloc(map, &hash->cur, nbGroups);
+}
+
+
+/**********************************************************************/
+// Engine operations
+
+
+tnode* __thashGet(tmap* map, void* key) {
+    thash* hash = (thash*)map->__engineData;
+    uint64_t h = __thashKey(map, key);
+    long slot;
+
+    slot = __ttableFind(map, &hash->cur, key, h);
+    if(slot >= 0) {
+        return hash->cur.slots[slot];
+    }
+    if(hash->old.ctrl != NULL) {
+        slot = __ttableFind(map, &hash->old, key, h);
+        if(slot >= 0) {
+            return hash->old.slots[slot];
+        }
+    }
+    return NULL;
+}
+
+
+tnode* __thashInsert(tmap* map, void* key, int* created) {
+    thash* hash = (thash*)map->__engineData;
+    uint64_t h = __thashKey(map, key);
+    tnode* node;
+
+    if(hash->old.ctrl != NULL) {
+        __thashMigrate(map, hash, MIGRATE_GROUPS);
+    }
+
+    node = __thashGet(map, key);
+    if(node != NULL) {
+        *created = 0;
+        return node;
+    }
+
+    if(hash->cur.growthLeft == 0) {
+        __thashGrow(map, hash);
+    }
+
+    node = __nodeAlloc(map);
+    __tsetKey(map, node, key);
+    __ttableInsert(&hash->cur, node, h);
+    ++hash->count;
+    *created = 1;
+    return node;
+}
+
+
+int __thashRemove(tmap* map, void* key) {
+    thash* hash = (thash*)map->__engineData;
+    uint64_t h = __thashKey(map, key);
+    thashtable* table = &hash->cur;
+    tnode* node;
+    long slot;
+
+    if(hash->old.ctrl != NULL) {
+        __thashMigrate(map, hash, MIGRATE_GROUPS);
+    }
+
+    slot = __ttableFind(map, table, key, h);
+    if(slot < 0 && hash->old.ctrl != NULL) {
+        table = &hash->old;
+        slot = __ttableFind(map, table, key, h);
+    }
+    if(slot < 0) {
+        return 0;
+    }
+
+    node = table->slots[slot];
+    __ttableErase(table, (size_t)slot);
+    --hash->count;
+    return __nodeRelease(map, node);
+}
+
+
+void __thashClear(tmap* map) {
+    thash* hash = (thash*)map->__engineData;
+    size_t capacity = (hash->cur.groupMask + 1) * GROUP_SIZE;
+
+    if(hash->old.ctrl != NULL) {
+        __ttableFree(map, &hash->old);
+    }
+    hash->migrateGroup = 0;
+    hash->count = 0;
+    hash->cur.growthLeft = capacity - capacity / 8;
+    memset(hash->cur.ctrl, CTRL_EMPTY, capacity);
+}
+
+
+void __thashReserve(tmap* map, const size_t n) {
+    thash* hash = (thash*)map->__engineData;
+    size_t nbGroups = hash->cur.groupMask + 1;
+
+    while(hash->count + n > nbGroups * GROUP_SIZE - nbGroups * GROUP_SIZE / 8) {
+        nbGroups *= 2;
+    }
+    if(nbGroups == hash->cur.groupMask + 1) {
+        return;
+    }
+
+    // Rehash everything at once, the table won't grow while filling
+    if(hash->old.ctrl != NULL) {
+        __thashMigrate(map, hash, hash->old.groupMask + 1);
+    }
+    hash->old = hash->cur;
+    hash->migrateGroup = 0;
+    __ttableAlloc(map, &hash->cur, nbGroups);
+    __thashMigrate(map, hash, hash->old.groupMask + 1);
+}
+
+
+void __thashDestroy(tmap* map) {
+    thash* hash = (thash*)map->__engineData;
+
+    if(hash->old.ctrl != NULL) {
+        __ttableFree(map, &hash->old);
+    }
+    __ttableFree(map, &hash->cur);
+    MAPFREE(map, hash, sizeof(thash));
+    map->__engineData = NULL;
+}
+
+
+// Tables, both while resizing
+size_t __thashBytes(tmap* map) {
+    thash* hash = (thash*)map->__engineData;
+    size_t bytes = sizeof(thash) + __ttableBytes(hash->cur.groupMask + 1);
+
+    if(hash->old.ctrl != NULL) {
+        bytes += __ttableBytes(hash->old.groupMask + 1);
+    }
+    return bytes;
+}
+
+
+// Inserts may start a resize to twice as many groups
+size_t __thashGrowth(tmap* map) {
+    thash* hash = (thash*)map->__engineData;
+
+    return __ttableBytes(2 * (hash->cur.groupMask + 1));
+}
+
+
+const tmapops __thashOps = {
+    .get = __thashGet,
+    .insert = __thashInsert,
+    .remove = __thashRemove,
+    .clear = __thashClear,
+    .reserve = __thashReserve,
+    .destroy = __thashDestroy,
+    .bytes = __thashBytes,
+    .growth = __thashGrowth
+};
+
+
+void __thashInit(tmap* map) {
+    thash* hash = (thash*)MAPALLOC(map, sizeof(thash));
+
+    __ttableAlloc(map, &hash->cur, MIN_GROUPS);
+    hash->old.ctrl = NULL;
+    hash->migrateGroup = 0;
+    hash->count = 0;
+    map->__engineData = hash;
+}
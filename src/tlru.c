@@ -0,0 +1,150 @@
+/*********************************************************************************
+MIT License
+
+Copyright (c) 2019 Mathieu Comeau
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************/
+
+/*
+Bounded maps evicting their least recently used keys.
+
+Nodes are kept in a doubly linked list from the most recently used to the
+least. Nodes fill their cache line, their links are in the node block
+instead: an array after the nodes, at the node's index, see '__tnodeSide'.
+Nodes join the list as they are allocated and leave it as they are
+released, whatever the engine, keys used move to its head.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tmap.h"
+#include "tmapint.h"
+
+
+struct tlru {
+    tnode* head;
+    tnode* tail;
+    size_t count;
+    size_t capacity;
+    void (*evict)(void* key, void* value, void* ctx);
+    void* evictCtx;
+};
+
+
+static inline tlrulink* __tlruLink(tmap* map, tnode* node) {
+    return (tlrulink*)__tnodeSide(map, node, 0, sizeof(tlrulink));
+}
+
+
+void __tlruInit(tmap* map, const tmap_config* config) {
+    tlru* lru = (tlru*)MAPALLOC(map, sizeof(tlru));
+
+    lru->head = NULL;
+    lru->tail = NULL;
+    lru->count = 0;
+    lru->capacity = config->capacity;
+    lru->evict = config->evict;
+    lru->evictCtx = config->evictCtx;
+    map->__lru = lru;
+}
+
+
+void __tlruDestroy(tmap* map) {
+    MAPFREE(map, map->__lru, sizeof(tlru));
+    map->__lru = NULL;
+}
+
+
+// Node blocks were reset
+void __tlruReset(tmap* map) {
+    map->__lru->head = NULL;
+    map->__lru->tail = NULL;
+    map->__lru->count = 0;
+}
+
+
+// New node, most recently used
+void __tlruAdd(tmap* map, tnode* node) {
+    tlru* lru = map->__lru;
+    tlrulink* link = __tlruLink(map, node);
+
+    link->previous = NULL;
+    link->next = lru->head;
+    if(lru->head != NULL) {
+        __tlruLink(map, lru->head)->previous = node;
+    } else {
+        lru->tail = node;
+    }
+    lru->head = node;
+    ++lru->count;
+}
+
+
+void __tlruRemove(tmap* map, tnode* node) {
+    tlru* lru = map->__lru;
+    tlrulink* link = __tlruLink(map, node);
+
+    if(link->previous != NULL) {
+        __tlruLink(map, link->previous)->next = link->next;
+    } else {
+        lru->head = link->next;
+    }
+    if(link->next != NULL) {
+        __tlruLink(map, link->next)->previous = link->previous;
+    } else {
+        lru->tail = link->previous;
+    }
+    --lru->count;
+}
+
+
+// Key of 'node' used, it goes to the head of the list
+void __tlruUse(tmap* map, tnode* node) {
+    if(map->__lru->head != node) {
+        __tlruRemove(map, node);
+        __tlruAdd(map, node);
+    }
+}
+
+
+// Remove least recently used keys until the map is back to its capacity.
+// Copied keys go with their node, the callback gets them before.
+void __tlruEvict(tmap* map) {
+    tlru* lru = map->__lru;
+    void* key;
+    void* value;
+
+    while(lru->count > lru->capacity) {
+        key = lru->tail->key;
+        value = lru->tail->value;
+        if(map->__flags & TMAP_COPY_KEYS) {
+            if(lru->evict != NULL) {
+                lru->evict(key, value, lru->evictCtx);
+            }
+            map->__ops->remove(map, key);
+        } else {
+            map->__ops->remove(map, key);
+            if(lru->evict != NULL) {
+                lru->evict(key, value, lru->evictCtx);
+            }
+        }
+    }
+}
@@ -23,87 +23,345 @@ SOFTWARE.
 *********************************************************************************/
 
 #include <assert.h>
+#include <errno.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include "tmap.h"
-
-
-#ifndef NODE_BLOCK_NB_ELEMENTS
-#define NODE_BLOCK_NB_ELEMENTS 2*1024
-#endif
-
-
-#ifdef QADEBUG
-#define PRINTD(...) do { fprintf(stderr, "DEBUG: "); fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); } while(0);
-#else
-#define PRINTD(...)
-#endif
+#include "tmapint.h"
 
 // In case client allocator uses mmap:
 #ifndef MAP_FAILED
 #define MAP_FAILED ((void*)-1)
 #endif
 
+#define HUGE_PAGE_SIZE (2*1024*1024)
+
+// Expired keys removed by each change of a TMAP_TTL map
+#define TTL_SWEEP_BUDGET 4
+
 /*************************** INTERNAL *********************************/
 // Internal functions, thou shall not use syncing primitives
 // within internal functions
 /**********************************************************************/
 
 
-static void* (*__tmyalloc)(size_t) = NULL;
-static void  (*__tmyfree)(void*, size_t) = NULL;
+void* (*__tmyalloc)(size_t) = NULL;
+void  (*__tmyfree)(void*, size_t) = NULL;
 
 
-#define MYALLOC(s) __tmyalloc(s)
-#define MYFREE(p,s) __tmyfree(p,s)
-
-#define PTR_OFFSET(p,offset) (((char*)p)+offset)
-
 #define EXTRA_BLOCK_ALLOCATION 1
 #define FIRST_BLOCK_ALLOCATION 0
 
-#define NODE_BLOCK_DELETED -1
+// AVL height is below 1.45*log2(n+2), plenty for any addressable map
+#define TREE_MAX_HEIGHT 96
+
+// Lookups walked down the tree in lockstep by tget_batch
+#define BATCH_WIDTH 8
+
+
+/**********************************************************************/
+// Copy on write: in MULTI_THREAD_RCU mode, nodes are only modified by the
+// write operation that created them (node generation is the map's).
+// Others are copied, and the copy linked in place of the original.
+// Maps with live snapshots copy nodes older than the newest snapshot.
+
+
+// Start a write generation, every existing node becomes read only
+void __tnewGeneration(tmap* map) {
+    tnodeblock* nodeBlock;
+    unsigned int node;
+
+    if(++map->__gen == 0) {
+        // Wrapped around: reset node generations so that none is
+        // mistaken for a new one.
+        for(nodeBlock = map->__firstNodeBlock; nodeBlock != NULL; nodeBlock = nodeBlock->__next) {
+            for(node=0; node < nodeBlock->__index; ++node) {
+                nodeBlock->__nodes[node].__gen = 0;
+            }
+        }
+        map->__gen = 1;
+    }
+}
+
+
+// Node replaced or unlinked while readers of an older tree may still be
+// at it, released when none is anymore
+static inline void __tretire(tmap* map, tnode* node) {
+    if(map->__rcu != NULL) {
+        __trcuRetire(map, node);
+    } else {
+        __tsnapRetire(map, node);
+    }
+}
+
+
+static inline void __tretireKey(tmap* map, void* key) {
+    if(map->__rcu != NULL) {
+        __trcuRetireKey(map, key);
+    } else {
+        __tsnapRetireKey(map, key);
+    }
+}
+
+
+// TMAP_TTL maps: expired key found where one is added, it's taken as
+// a new one that doesn't expire
+static inline int __tttlFresh(tmap* map, tnode* node, int created) {
+    if(map->__ttl != NULL && !created && __tttlExpired(map, node)) {
+        __tttlSet(map, node, 0);
+        return 1;
+    }
+    return created;
+}
+
+
+// End of a change of the map, 'node' being the one added or set if any.
+// Bounded maps evict keys beyond their capacity, TMAP_TTL maps remove a
+// few expired keys, TMAP_BLOOM filters are rebuilt if too full or stale.
+static inline void __twritten(tmap* map, tnode* node) {
+    if(map->__lru != NULL) {
+        if(node != NULL) {
+            __tlruUse(map, node);
+        }
+        __tlruEvict(map);
+    }
+    if(map->__ttl != NULL) {
+        __tttlSweep(map, TTL_SWEEP_BUDGET);
+    }
+    if(map->__bloom != NULL) {
+        __tbloomCheck(map);
+    }
+}
+
+
+// Node at 'link', made writable
+tnode* __tmut(tmap* map, tnode** link) __attribute__((always_inline));
+inline tnode* __tmut(tmap* map, tnode** link) {
+    tnode* node = *link;
+    tnode* copy;
+
+    if(!map->__cow || node->__gen == map->__gen) {
+        return node;
+    }
+
+    copy = __nodeAlloc(map);
+    copy->key = node->key;
+    copy->__prefix = node->__prefix;
+    copy->__keyLen = node->__keyLen;
+    copy->value = node->value;
+    copy->__left = node->__left;
+    copy->__right = node->__right;
+    copy->__height = node->__height;
+    *link = copy;
+    __tretire(map, node);
+    return copy;
+}
 
 
 /**********************************************************************/
 // Syncing symbols for protecting map in multitasking context
+// Exclusive access, for functions modifying the map
 void __tSyncWait(tmap* map) __attribute__((always_inline));
 inline void __tSyncWait(tmap* map) {
-    if(map->__multitask == MULTI_THREAD_SAFE) {
-        pthread_mutex_lock(map->__mutex);
+    switch(map->__multitask) {
+        case MULTI_THREAD_SAFE:
+            __tmutexLock(map->__mutex);
+            break;
+        case MULTI_THREAD_RWLOCK:
+            pthread_rwlock_wrlock(map->__rwlock);
+            break;
+        case MULTI_THREAD_SEQLOCK:
+            pthread_mutex_lock(map->__mutex);
+            // Odd sequence: optimistic readers will retry
+            __atomic_store_n(&map->__seq, map->__seq + 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            break;
+        case MULTI_THREAD_RCU:
+            pthread_mutex_lock(map->__mutex);
+            // Nodes published so far become read only
+            __tnewGeneration(map);
+            break;
+    }
+    if(map->__cache != NULL) {
+        // Lines of lookup caches filled before are stale
+        __atomic_store_n(&map->__version, map->__version + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
     }
 }
 
 
 void __tSyncPost(tmap* map) __attribute__((always_inline));
 inline void __tSyncPost(tmap* map) {
-    if(map->__multitask == MULTI_THREAD_SAFE) {
-        pthread_mutex_unlock(map->__mutex);
+    if(map->__cache != NULL) {
+        // Lines filled while the writer was at work are stale too
+        __atomic_store_n(&map->__version, map->__version + 1, __ATOMIC_RELEASE);
+    }
+    switch(map->__multitask) {
+        case MULTI_THREAD_SAFE:
+            pthread_mutex_unlock(map->__mutex);
+            break;
+        case MULTI_THREAD_RWLOCK:
+            pthread_rwlock_unlock(map->__rwlock);
+            break;
+        case MULTI_THREAD_SEQLOCK:
+            __atomic_store_n(&map->__seq, map->__seq + 1, __ATOMIC_RELEASE);
+            pthread_mutex_unlock(map->__mutex);
+            break;
+        case MULTI_THREAD_RCU:
+            __trcuPublish(map);
+            pthread_mutex_unlock(map->__mutex);
+            break;
+    }
+}
+
+
+// Shared access, for functions only reading the map. Optimistic
+// readers of MULTI_THREAD_SEQLOCK and MULTI_THREAD_RCU maps don't use it.
+void __tSyncReadWait(tmap* map) __attribute__((always_inline));
+inline void __tSyncReadWait(tmap* map) {
+    switch(map->__multitask) {
+        case MULTI_THREAD_SAFE:
+        case MULTI_THREAD_SEQLOCK:
+        case MULTI_THREAD_RCU:
+            __tmutexLock(map->__mutex);
+            break;
+        case MULTI_THREAD_RWLOCK:
+            pthread_rwlock_rdlock(map->__rwlock);
+            break;
+    }
+}
+
+
+void __tSyncReadPost(tmap* map) __attribute__((always_inline));
+inline void __tSyncReadPost(tmap* map) {
+    switch(map->__multitask) {
+        case MULTI_THREAD_SAFE:
+        case MULTI_THREAD_SEQLOCK:
+        case MULTI_THREAD_RCU:
+            pthread_mutex_unlock(map->__mutex);
+            break;
+        case MULTI_THREAD_RWLOCK:
+            pthread_rwlock_unlock(map->__rwlock);
+            break;
+    }
+}
+
+
+// Block header, then nodes from the next aligned address
+size_t __nodeBlockBytes(tmap* map) {
+    return sizeof(tnodeblock) + NODE_ALIGNMENT + map->__blockSize*(sizeof(tnode) + __tnodeSideBytes(map));
+}
+
+
+// Anonymous mapping aligned on a huge page, so that transparent huge
+// pages can back it when explicit ones are not available
+void* __hugePagesMap(size_t bytes) {
+    char* mem;
+    size_t head;
+
+#ifdef MAP_HUGETLB
+    mem = mmap(NULL, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    if(mem != MAP_FAILED) {
+        return mem;
+    }
+#endif
+
+    mem = mmap(NULL, bytes + HUGE_PAGE_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED) {
+        return NULL;
+    }
+    head = HUGE_PAGE_SIZE - ((uintptr_t)mem & (HUGE_PAGE_SIZE - 1));
+    if(head == HUGE_PAGE_SIZE) {
+        head = 0;
+    }
+    if(head > 0) {
+        munmap(mem, head);
+    }
+    munmap(mem + head + bytes, HUGE_PAGE_SIZE - head);
+    mem += head;
+#ifdef MADV_HUGEPAGE
+    madvise(mem, bytes, MADV_HUGEPAGE);
+#endif
+    return mem;
+}
+
+
+// New empty block linked after 'previous'
+tnodeblock* __nodeBlockNew(tmap* map, tnodeblock* previous) {
+    tnodeblock* nodeBlock;
+
+    if(map->__flags & TMAP_HUGE_PAGES) {
+        nodeBlock = (tnodeblock*)__hugePagesMap(__nodeBlockBytes(map));
+        if(nodeBlock == NULL) {
+            fprintf(stderr, "Huge page node block mapping failed: %s\n", strerror(errno));
+            exit(-1);
+        }
+    } else {
+        nodeBlock = (tnodeblock*)MAPALLOC(map, __nodeBlockBytes(map));
+    }
+    nodeBlock->__nodes = (tnode*)(((uintptr_t)PTR_OFFSET(nodeBlock, sizeof(tnodeblock)) + NODE_ALIGNMENT - 1)
+                                  & ~(uintptr_t)(NODE_ALIGNMENT - 1));
+    nodeBlock->__index = 0;
+    nodeBlock->__activeNodes = 0;
+    nodeBlock->__previous = previous;
+    nodeBlock->__next = NULL;
+
+    if(previous != NULL) {
+        nodeBlock->__next = previous->__next;
+        previous->__next = nodeBlock;
+    }
+    if(nodeBlock->__next != NULL) {
+        nodeBlock->__next->__previous = nodeBlock;
+    }
+    return nodeBlock;
+}
+
+
+void __nodeBlockFree(tmap* map, tnodeblock* nodeBlock) {
+    if(map->__flags & TMAP_HUGE_PAGES) {
+        munmap(nodeBlock, __nodeBlockBytes(map));
+    } else {
+        MAPFREE(map, nodeBlock, __nodeBlockBytes(map));
     }
 }
 
 
 void __nodeBlockAlloc(tmap* map) {
-    tnodeblock* oldNodeBlock = map->__currentNodeBlock;
+    // Blocks kept by tclear or treserve are used first
+    if(map->__currentNodeBlock != NULL && map->__currentNodeBlock->__next != NULL) {
+        map->__currentNodeBlock = map->__currentNodeBlock->__next;
+        return;
+    }
+    map->__currentNodeBlock = __nodeBlockNew(map, map->__currentNodeBlock);
+}
 
-    map->__currentNodeBlock = (tnodeblock*)MYALLOC( sizeof(tnodeblock) + NODE_BLOCK_NB_ELEMENTS*sizeof(tnode) );
-    map->__currentNodeBlock->__nodes = (tnode*)PTR_OFFSET(map->__currentNodeBlock, sizeof(tnodeblock));
-    map->__currentNodeBlock->__index = 0;
-    map->__currentNodeBlock->__next = NULL;
-    map->__currentNodeBlock->__previous = oldNodeBlock;
-    map->__currentNodeBlock->__activeNodes = 0;
 
-    // Make old node block point to new block
-    if(oldNodeBlock != NULL) {
-        oldNodeBlock->__next = map->__currentNodeBlock;
+// Free node list, linked through '__left' (previous) and '__right' (next)
+void __freeNodeUnlink(tmap* map, tnode* node) {
+    if(node->__left != NULL) {
+        node->__left->__right = node->__right;
+    } else {
+        map->__freeNodes = node->__right;
     }
+    if(node->__right != NULL) {
+        node->__right->__left = node->__left;
+    }
+    --map->__nbFreeNodes;
 }
 
 
 void __nodeBlockRelease(tmap* map, tnodeblock* nodeBlock) {
+    unsigned int node;
+
+    // All of the block's nodes are in the free list
+    for(node=0; node < nodeBlock->__index; ++node) {
+        __freeNodeUnlink(map, &nodeBlock->__nodes[node]);
+    }
+
     if(map->__firstNodeBlock == nodeBlock) {
         map->__firstNodeBlock = nodeBlock->__next;
     }
@@ -120,7 +378,7 @@ void __nodeBlockRelease(tmap* map, tnodeblock* nodeBlock) {
         nodeBlock->__next->__previous = nodeBlock->__previous;
     }
     // Free memory
-    MYFREE(nodeBlock, sizeof(tnodeblock)+NODE_BLOCK_NB_ELEMENTS*sizeof(tnode));
+    __nodeBlockFree(map, nodeBlock);
 
     if(map->__firstNodeBlock == NULL) {
         __nodeBlockAlloc(map);
@@ -129,226 +387,1781 @@ void __nodeBlockRelease(tmap* map, tnodeblock* nodeBlock) {
 }
 
 
-tnode* __tget(tmap* map, void* key) __attribute__((always_inline));
-inline tnode* __tget(tmap* map, void* key) {
-    tnode** pNode;
-    pNode = tfind(&key, &map->__root, map->__cmp);
-    if(pNode != NULL) {
-        return *pNode;
-    }
-    return NULL;
+/**********************************************************************/
+// AVL tree, nodes are linked through their own '__left'/'__right' members
+
+#define HEIGHT(n) ((n) == NULL ? 0 : (n)->__height)
+
+
+void __tupdateHeight(tnode* node) __attribute__((always_inline));
+inline void __tupdateHeight(tnode* node) {
+    int hl = HEIGHT(node->__left);
+    int hr = HEIGHT(node->__right);
+    node->__height = (hl > hr ? hl : hr) + 1;
 }
 
 
-int __tdel(tmap* map, void* key) __attribute__((always_inline));
-inline int __tdel(tmap* map, void* key) {
-#ifdef FAST_MAP
-    // When compiled with FAST_MAP, memory is released only
-    // when tfree is called, giving a =~ 25% init time performance
-    // increase.
-    tdelete(&key, &map->__root, map->__cmp);
-#else
-    tnode* pnode;
+tnode* __trotateRight(tnode* node) {
+    tnode* left = node->__left;
+    node->__left = left->__right;
+    left->__right = node;
+    __tupdateHeight(node);
+    __tupdateHeight(left);
+    return left;
+}
 
-    pnode = __tget(map, key);
 
-    if(pnode != NULL) {
-        tdelete(&key, &map->__root, map->__cmp);
+tnode* __trotateLeft(tnode* node) {
+    tnode* right = node->__right;
+    node->__right = right->__left;
+    right->__left = node;
+    __tupdateHeight(node);
+    __tupdateHeight(right);
+    return right;
+}
+
 
-        pnode->__mynodeblock->__activeNodes--;
+// Restore AVL property for the writable subtree linked at 'link'.
+// Returns 1 if the subtree height changed.
+int __tbalance(tmap* map, tnode** link) {
+    tnode* node = *link;
+    tnode* child;
+    int oldHeight = node->__height;
+    int balance = HEIGHT(node->__left) - HEIGHT(node->__right);
 
-        // Mark node as deleted by setting its key to 0
-        pnode->key = 0;
-        if(pnode->__mynodeblock->__activeNodes == 0 && pnode->__mynodeblock->__index >= NODE_BLOCK_NB_ELEMENTS) {
-            __nodeBlockRelease(map, pnode->__mynodeblock);
-            return NODE_BLOCK_DELETED;
+    if(balance > 1) {
+        child = __tmut(map, &node->__left);
+        if(HEIGHT(child->__left) < HEIGHT(child->__right)) {
+            __tmut(map, &child->__right);
+            node->__left = __trotateLeft(child);
         }
+        *link = __trotateRight(node);
+    } else if(balance < -1) {
+        child = __tmut(map, &node->__right);
+        if(HEIGHT(child->__right) < HEIGHT(child->__left)) {
+            __tmut(map, &child->__left);
+            node->__right = __trotateRight(child);
+        }
+        *link = __trotateLeft(node);
+    } else {
+        __tupdateHeight(node);
     }
-#endif
-    return 0;
+
+    return (*link)->__height != oldHeight;
 }
 
 
-void __free(void* ptr, size_t s) {
-    free(ptr);
+tnode* __tget(tmap* map, void* key) __attribute__((always_inline));
+inline tnode* __tget(tmap* map, void* key) {
+    tnode* node = map->__root;
+    tkey k;
+    int c;
+
+    __tkeyInit(map, &k, key);
+    while(node != NULL) {
+        c = __tcmp(map, &k, node);
+        if(c == 0) {
+            return node;
+        }
+        node = c < 0 ? node->__left : node->__right;
+    }
+    return NULL;
 }
 
 
-void* __malloc(size_t s) {
-    return malloc(s);
-}
+// Lookup without lock for MULTI_THREAD_SEQLOCK maps: walk the tree
+// and retry if a writer ran meanwhile. Nodes read may be modified
+// under us, so only their local copies are used and the walk length
+// is bounded in case rotations make us go around in circles.
+void* __tgetOptimistic(tmap* map, void* key) {
+    unsigned int seq;
+    tnode* node;
+    // Local copy of what is compared in a node
+    tnode nodeKeys;
+    void* value;
+    tkey k;
+    int steps;
+    int c;
+
+    __tkeyInit(map, &k, key);
+    while(1) {
+        seq = __atomic_load_n(&map->__seq, __ATOMIC_ACQUIRE);
+        if(seq & 1) {
+            CPU_RELAX();
+            continue;
+        }
 
+        value = NULL;
+        node = __atomic_load_n(&map->__root, __ATOMIC_RELAXED);
+        for(steps=0; node != NULL && steps < TREE_MAX_HEIGHT; ++steps) {
+            nodeKeys.key = __atomic_load_n(&node->key, __ATOMIC_RELAXED);
+            if(nodeKeys.key == NULL && map->__keyKind != TMAP_KEY_U64) {
+                // Node deleted meanwhile
+                break;
+            }
+            if(map->__keyKind == TMAP_KEY_STRING) {
+                nodeKeys.__prefix = __atomic_load_n(&node->__prefix, __ATOMIC_RELAXED);
+                nodeKeys.__keyLen = __atomic_load_n(&node->__keyLen, __ATOMIC_RELAXED);
+            }
+            c = __tcmp(map, &k, &nodeKeys);
+            if(c == 0) {
+                value = __atomic_load_n(&node->value, __ATOMIC_RELAXED);
+                break;
+            }
+            node = c < 0 ? __atomic_load_n(&node->__left, __ATOMIC_RELAXED)
+                         : __atomic_load_n(&node->__right, __ATOMIC_RELAXED);
+        }
 
-void __tallocator_init(tallocator* allocator, const int multitaskMode) {
-    if(allocator == NULL) {
-        __tmyalloc = __malloc;
-        __tmyfree = __free;
-    } else {
-        __tmyalloc = allocator->tmyalloc;
-        __tmyfree = allocator->tmyfree;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&map->__seq, __ATOMIC_RELAXED) == seq) {
+            return value;
+        }
     }
 }
 
 
-/*************************** PUBLIC **********************************/
-// Public functions
-/**********************************************************************/
-
-
-void tconf(tallocator* allocator) {
-    if(allocator == NULL) {
-        return;
+// Lookup without lock for MULTI_THREAD_RCU maps, published nodes
+// never change and aren't released while we are registered as reader.
+void* __tgetRcu(tmap* map, void* key) {
+    unsigned long* readers = __trcuReadLock(map);
+    tnode* node = __trcuRoot(map);
+    void* value = NULL;
+    tkey k;
+    int c;
+
+    __tkeyInit(map, &k, key);
+    while(node != NULL) {
+        c = __tcmp(map, &k, node);
+        if(c == 0) {
+            value = node->value;
+            break;
+        }
+        node = c < 0 ? node->__left : node->__right;
     }
-    __tallocator_init(allocator, -1);
+
+    __trcuReadUnlock(readers);
+    return value;
 }
 
 
-tmap* tinit(int (*cmp)(const void*, const void*),
-            const int noOverwrite,
-            const int multitask) {
-    tmap* map;
+// Look 'n' keys up, BATCH_WIDTH at a time: each step moves every lookup
+// of the batch one level down and prefetches the nodes to compare next,
+// so that their cache misses overlap.
+void __tgetBatch(tmap* map, tnode* root, void** keys, void** values, const size_t n) {
+    tnode* nodes[BATCH_WIDTH];
+    tkey k[BATCH_WIDTH];
+    tnode* node;
+    size_t base, width, i;
+    int active;
+    int c;
+
+    for(base=0; base<n; base+=BATCH_WIDTH) {
+        width = n - base < BATCH_WIDTH ? n - base : BATCH_WIDTH;
+        for(i=0; i<width; ++i) {
+            nodes[i] = root;
+            values[base+i] = NULL;
+            __tkeyInit(map, &k[i], keys[base+i]);
+        }
 
-    if(__tmyalloc == NULL) {
-        __tallocator_init(NULL, multitask);
+        active = (root != NULL);
+        while(active) {
+            active = 0;
+            for(i=0; i<width; ++i) {
+                node = nodes[i];
+                if(node == NULL) {
+                    continue;
+                }
+                c = __tcmp(map, &k[i], node);
+                if(c == 0) {
+                    values[base+i] = node->value;
+                    nodes[i] = NULL;
+                    continue;
+                }
+                node = c < 0 ? node->__left : node->__right;
+                if(node != NULL) {
+                    __builtin_prefetch(node);
+                    active = 1;
+                }
+                nodes[i] = node;
+            }
+        }
     }
+}
 
-    map = MYALLOC(sizeof(tmap));
-    map->__multitask = multitask;
-    map->__cmp = cmp;
-    map->__root = NULL;
-    map->__firstNodeBlock = NULL;
-    map->__currentNodeBlock = NULL;
-    map->__noOverwrite = noOverwrite;
 
-    // Allocate an initial node block
-    __nodeBlockAlloc(map);
-    // Remember first block for later memory release
-    map->__firstNodeBlock = map->__currentNodeBlock;
+// Take a node from the free list, or else next available node
+// from the current node block
+tnode* __nodeAlloc(tmap* map) {
+    tnode* node = map->__freeNodes;
 
-    map->__mutex = NULL;
+    if(node != NULL) {
+        __freeNodeUnlink(map, node);
+    } else {
+        node = &(map->__currentNodeBlock->__nodes[map->__currentNodeBlock->__index]);
+        node->__mynodeblock = map->__currentNodeBlock;
 
-    if(multitask == MULTI_THREAD_SAFE) {
-        map->__mutex = MYALLOC(sizeof(pthread_mutex_t));
-        pthread_mutex_init(map->__mutex, NULL);
-    } else if (multitask != SINGLE_THREADED) {
-        fprintf(stderr, "Unsupported multitask parameter: %d\n", multitask);
-        exit(-1);
+        // increment current node block node index
+        ++map->__currentNodeBlock->__index;
+
+        if(map->__currentNodeBlock->__index >= map->__blockSize) {
+            // allocate a new node block
+            __nodeBlockAlloc(map);
+        }
     }
 
-    return map;
+    node->__left = NULL;
+    node->__right = NULL;
+    node->__height = 1;
+    node->__gen = map->__gen;
+    ++node->__mynodeblock->__activeNodes;
+    if(map->__lru != NULL) {
+        __tlruAdd(map, node);
+    }
+    if(map->__ttl != NULL) {
+        __tttlAdd(map, node);
+    }
+    return node;
 }
 
 
-// Override compare function
-void tsetcmp(tmap* map,
-             int (*cmp)(const void*, const void*)) {
-    map->__cmp = cmp;
+// Give back a node unlinked from the tree, with its key copy if any.
+// Readers of copy on write maps may still be at the key through an older
+// copy of the node, the key is then retired like nodes are.
+int __nodeRelease(tmap* map, tnode* pnode) {
+    if(map->__lru != NULL) {
+        __tlruRemove(map, pnode);
+    }
+    if(map->__ttl != NULL) {
+        __tttlRemove(map, pnode);
+    }
+    if(map->__bloom != NULL) {
+        __tbloomRemoved(map);
+    }
+    --map->__count;
+    if(map->__flags & TMAP_COPY_KEYS) {
+        if(map->__cow) {
+            __tretireKey(map, pnode->key);
+        } else {
+            __tarenaFree(map, pnode->key);
+        }
+    }
+    return __nodeFree(map, pnode);
 }
 
 
-// To be used by client for twalk
-void* troot(tmap* map) {
-    return map->__root;
-}
+// Give back a node slot, it goes to the head of the free list so
+// that the next node allocated is likely still in cache.
+int __nodeFree(tmap* map, tnode* pnode) {
+    pnode->__mynodeblock->__activeNodes--;
 
+    // Mark node as deleted, live nodes are at least 1 high
+    pnode->__height = 0;
+    pnode->key = 0;
 
-// Remove a node from the binary tree
-void tdel(tmap* map, void* key) {
-    __tSyncWait(map);
-    __tdel(map, key);
-    __tSyncPost(map);
+    pnode->__left = NULL;
+    pnode->__right = map->__freeNodes;
+    if(map->__freeNodes != NULL) {
+        map->__freeNodes->__left = pnode;
+    }
+    map->__freeNodes = pnode;
+    ++map->__nbFreeNodes;
+
+#ifndef FAST_MAP
+    // Blocks get empty when the map shrinks for good. When compiled
+    // with FAST_MAP, memory is released only when tfree is called.
+    // Optimistic readers of MULTI_THREAD_SEQLOCK
+    // maps may still be reading nodes, so neither is it released then.
+    if(pnode->__mynodeblock->__activeNodes == 0 && pnode->__mynodeblock->__index >= map->__blockSize
+       && map->__multitask != MULTI_THREAD_SEQLOCK) {
+        __nodeBlockRelease(map, pnode->__mynodeblock);
+        return NODE_BLOCK_DELETED;
+    }
+#endif
+    return 0;
 }
 
 
-// Release all internal memory associated with the map
-// It is up to the client to release memory associated
-// with the keys and corresponding values.
-void tfree(tmap* map) {
-    tnodeblock* nodeBlock = map->__firstNodeBlock;
-    tnodeblock* nextNodeBlock;
-    int blockStatus;
-    register int node;
-
-    while(nodeBlock != NULL) {
-        nextNodeBlock = nodeBlock->__next;
+// Walk down to the link holding 'key', or to the empty link where it
+// would be inserted. Links to the visited ancestors are stored in 'path'.
+tnode** __tdescend(tmap* map, void* key, tnode*** path, int* depth) {
+    tnode** link = &map->__root;
+    tkey k;
+    int c;
 
-        // Remove nodes from bineary tree
-        for(node=0; node < nodeBlock->__index; ++node) {
-            if(nodeBlock->__nodes[node].key == 0) {
-                continue;
-            }
-            blockStatus = __tdel(map, nodeBlock->__nodes[node].key);
-            if(blockStatus == NODE_BLOCK_DELETED) {
-                break;
-            }
+    __tkeyInit(map, &k, key);
+    *depth = 0;
+    while(*link != NULL) {
+        c = __tcmp(map, &k, *link);
+        if(c == 0) {
+            break;
         }
+        path[(*depth)++] = link;
+        link = c < 0 ? &(*link)->__left : &(*link)->__right;
+    }
+    return link;
+}
 
-        if(blockStatus != NODE_BLOCK_DELETED) {
-            MYFREE(nodeBlock, sizeof(tnodeblock)+NODE_BLOCK_NB_ELEMENTS*sizeof(tnode));
-        }
-        nodeBlock = nextNodeBlock;
+
+// Make nodes along a path found by __tdescend writable, and the node
+// at 'link' if any. Links in 'path' move to the copies, the returned
+// link replaces 'link'.
+tnode** __tpathMut(tmap* map, tnode*** path, int depth, tnode** link) {
+    tnode** next;
+    tnode* node;
+    tnode* old;
+    int i;
+
+    if(!map->__cow) {
+        return link;
     }
 
-    // release synchronization object
-    if(map->__multitask == MULTI_THREAD_SAFE) {
-        pthread_mutex_destroy(map->__mutex);
-        MYFREE(map->__mutex, sizeof(pthread_mutex_t));
+    for(i=0; i<depth; ++i) {
+        old = *path[i];
+        node = __tmut(map, path[i]);
+        // Same link in the writable node
+        next = i+1 < depth ? path[i+1] : link;
+        next = (tnode**)PTR_OFFSET(node, (char*)next - (char*)old);
+        if(i+1 < depth) {
+            path[i+1] = next;
+        } else {
+            link = next;
+        }
+    }
+    if(*link != NULL) {
+        __tmut(map, link);
     }
+    return link;
+}
 
-    // At last, release the map
-    MYFREE(map, sizeof(tmap));
+
+// Link 'node' at the empty 'link' found by __tdescend and rebalance.
+// Path must have been made writable.
+void __tlinkAt(tmap* map, tnode*** path, int depth, tnode** link, tnode* node) {
+    node->__left = NULL;
+    node->__right = NULL;
+    node->__height = 1;
+    *link = node;
+
+    while(depth-- > 0) {
+        if(!__tbalance(map, path[depth])) {
+            break;
+        }
+    }
 }
 
 
-void tadd(tmap* map, void* key, void* value) {
-    __tSyncWait(map);
+// Unlink node at 'link' found by __tdescend, rebalance and return it.
+// Path must have been made writable.
+tnode* __tunlinkAt(tmap* map, tnode*** path, int depth, tnode** link) {
+    tnode** succLink;
+    tnode* node = *link;
+    tnode* succ;
+    int nodeDepth;
 
-    map->__pBufNode = __tget(map, key);
+    if(node->__left == NULL) {
+        *link = node->__right;
+    } else if(node->__right == NULL) {
+        *link = node->__left;
+    } else {
+        // Replace node by its in-order successor
+        nodeDepth = depth;
+        path[depth++] = link;
+        succLink = &node->__right;
+        while((*succLink)->__left != NULL) {
+            __tmut(map, succLink);
+            path[depth++] = succLink;
+            succLink = &(*succLink)->__left;
+        }
+        succ = __tmut(map, succLink);
+        *succLink = succ->__right;
+        succ->__left = node->__left;
+        succ->__right = node->__right;
+        succ->__height = node->__height;
+        *link = succ;
+        // Link to node's right child now belongs to successor
+        if(depth > nodeDepth + 1) {
+            path[nodeDepth + 1] = &succ->__right;
+        }
+    }
 
-    if(map->__noOverwrite && map->__pBufNode != NULL) {
-        fprintf(stderr, "SIGABRT: Key overwrite error: key addr: %p\n", key);
-        __tSyncPost(map);
-        raise(SIGABRT);
+    while(depth-- > 0) {
+        __tbalance(map, path[depth]);
     }
+    return node;
+}
 
-    if(map->__pBufNode != NULL) {
-        __tdel(map, key);
+
+// Find the node holding 'key', creating it if missing, in a single
+// descent. '*created' tells if the returned node is a new one, in
+// which case its value is left to the caller.
+tnode* __tinsert(tmap* map, void* key, int* created) {
+    tnode** path[TREE_MAX_HEIGHT];
+    tnode** link;
+    tnode* node;
+    int depth;
+
+    link = __tdescend(map, key, path, &depth);
+    link = __tpathMut(map, path, depth, link);
+    if(*link != NULL) {
+        *created = 0;
+        return *link;
     }
 
-    // To simplify, ease reading, use map internal buf variable;
-    // next available node:
-    map->__pBufNode = &(map->__currentNodeBlock->__nodes[map->__currentNodeBlock->__index]);
-    map->__pBufNode->__mynodeblock = map->__currentNodeBlock;
-    map->__pBufNode->key = key;
-    map->__pBufNode->value = value;
-    ++map->__pBufNode->__mynodeblock->__activeNodes;
+    node = __nodeAlloc(map);
+    __tsetKey(map, node, key);
+    __tlinkAt(map, path, depth, link, node);
+    *created = 1;
+    return node;
+}
 
-    tsearch(map->__pBufNode, &map->__root, map->__cmp);
 
-    // increment current node block node index
-    ++map->__currentNodeBlock->__index;
+// Unlink node matching 'key' from the tree and return it
+tnode* __tunlink(tmap* map, void* key) {
+    tnode** path[TREE_MAX_HEIGHT];
+    tnode** link;
+    int depth;
 
-    if(map->__currentNodeBlock->__index >= NODE_BLOCK_NB_ELEMENTS) {
-        // allocate a new node block
-        __nodeBlockAlloc(map);
+    link = __tdescend(map, key, path, &depth);
+    if(*link == NULL) {
+        return NULL;
     }
-
-    __tSyncPost(map);
+    link = __tpathMut(map, path, depth, link);
+    return __tunlinkAt(map, path, depth, link);
 }
 
 
-void* tget(tmap* map, void* key) {
-    void* v;
+int __tdel(tmap* map, void* key) __attribute__((always_inline));
+inline int __tdel(tmap* map, void* key) {
+    tnode* pnode = __tunlink(map, key);
 
-    __tSyncWait(map);
+    if(pnode != NULL) {
+        return __nodeRelease(map, pnode);
+    }
+    return 0;
+}
 
-    v = map->__pBufNode = __tget(map, key);
 
-    if(v != NULL) {
-        v = map->__pBufNode->value;
+void __twalk(const tnode* node,
+             void (*action)(const void* nodep, VISIT which, int depth),
+             int depth) {
+    if(node->__left == NULL && node->__right == NULL) {
+        action(&node, leaf, depth);
+        return;
+    }
+    action(&node, preorder, depth);
+    if(node->__left != NULL) {
+        __twalk(node->__left, action, depth + 1);
     }
+    action(&node, postorder, depth);
+    if(node->__right != NULL) {
+        __twalk(node->__right, action, depth + 1);
+    }
+    action(&node, endorder, depth);
+}
 
-    __tSyncPost(map);
 
-    return v;
+// Node at 'mode' position relative to 'key' in the tree under 'node'
+tnode* __tseek(tmap* map, tnode* node, void* key, const int mode) {
+    tnode* found = NULL;
+    tkey k;
+    int c;
+
+    if(mode != TSEEK_FIRST && mode != TSEEK_LAST) {
+        __tkeyInit(map, &k, key);
+    }
+    while(node != NULL) {
+        if(mode == TSEEK_FIRST) {
+            c = -1;
+        } else if(mode == TSEEK_LAST) {
+            c = 1;
+        } else {
+            c = __tcmp(map, &k, node);
+        }
+
+        if(mode == TSEEK_LAST || mode == TSEEK_LT) {
+            // Greatest key lower than 'key'
+            if(c > 0) {
+                found = node;
+                node = node->__right;
+            } else {
+                node = node->__left;
+            }
+        } else {
+            // Lowest key not lower than 'key', or greater with TSEEK_GT
+            if(c < 0 || (c == 0 && mode == TSEEK_GE)) {
+                found = node;
+                node = node->__left;
+            } else {
+                node = node->__right;
+            }
+        }
+    }
+    return found;
+}
+
+
+// In order walk of keys in ['lo', 'hi'[ with a stack of the nodes
+// left to visit, their right subtree included
+size_t __trange(tmap* map, tnode* node, void* lo, void* hi,
+                int (*fn)(const void* key, void* value, void* ctx),
+                void* ctx) {
+    tnode* stack[TREE_MAX_HEIGHT];
+    int depth = 0;
+    size_t count = 0;
+    tkey klo, khi;
+
+    if(lo != NULL) {
+        __tkeyInit(map, &klo, lo);
+    }
+    if(hi != NULL) {
+        __tkeyInit(map, &khi, hi);
+    }
+    while(node != NULL) {
+        if(lo == NULL || __tcmp(map, &klo, node) <= 0) {
+            stack[depth++] = node;
+            node = node->__left;
+        } else {
+            node = node->__right;
+        }
+    }
+
+    while(depth > 0) {
+        node = stack[--depth];
+        if(hi != NULL && __tcmp(map, &khi, node) <= 0) {
+            break;
+        }
+        ++count;
+        if(fn(node->key, node->value, ctx) != 0) {
+            break;
+        }
+        for(node = node->__right; node != NULL; node = node->__left) {
+            stack[depth++] = node;
+        }
+    }
+    return count;
+}
+
+
+tnode* __ttreeGet(tmap* map, void* key) {
+    return __tget(map, key);
+}
+
+
+// Sum of the levels of the nodes under 'root', its own being 1
+size_t __ttreeDepths(tnode* root) {
+    tnode* stack[TREE_MAX_HEIGHT + 1];
+    int levels[TREE_MAX_HEIGHT + 1];
+    size_t depths = 0;
+    tnode* node;
+    int level;
+    int top = 0;
+
+    if(root == NULL) {
+        return 0;
+    }
+    stack[0] = root;
+    levels[0] = 1;
+    while(top >= 0) {
+        node = stack[top];
+        level = levels[top--];
+        depths += level;
+        // A sibling at most is left on the stack per level
+        if(node->__right != NULL) {
+            stack[++top] = node->__right;
+            levels[top] = level + 1;
+        }
+        if(node->__left != NULL) {
+            stack[++top] = node->__left;
+            levels[top] = level + 1;
+        }
+    }
+    return depths;
+}
+
+
+int __ttreeRemove(tmap* map, void* key) {
+    return __tdel(map, key);
+}
+
+
+void __ttreeClear(tmap* map) {
+    map->__root = NULL;
+}
+
+
+void __ttreeReserve(tmap* map, const size_t n) {
+}
+
+
+void __ttreeDestroy(tmap* map) {
+}
+
+
+tnode* __ttreeSeek(tmap* map, void* key, const int mode) {
+    return __tseek(map, map->__root, key, mode);
+}
+
+
+size_t __ttreeRange(tmap* map, void* lo, void* hi,
+                    int (*fn)(const void* key, void* value, void* ctx),
+                    void* ctx) {
+    return __trange(map, map->__root, lo, hi, fn, ctx);
+}
+
+
+const tmapops __ttreeOps = {
+    .get = __ttreeGet,
+    .insert = __tinsert,
+    .remove = __ttreeRemove,
+    .clear = __ttreeClear,
+    .reserve = __ttreeReserve,
+    .destroy = __ttreeDestroy,
+    .seek = __ttreeSeek,
+    .range = __ttreeRange
+};
+
+
+// Cursor on 'node'. The key copies of TMAP_COPY_KEYS maps go with
+// their key, or with their chunk being reused: the cursor copies it.
+static inline void __tcursorSet(tmap* map, tnode* node, tcursor* cursor) {
+    size_t len = map->__keySize;
+
+    cursor->key = node->key;
+    cursor->value = node->value;
+    cursor->__copied = 0;
+    if(!(map->__flags & TMAP_COPY_KEYS) || map->__keyKind == TMAP_KEY_U64) {
+        return;
+    }
+    if(map->__keyKind == TMAP_KEY_STRING) {
+        len = strlen((const char*)node->key) + 1;
+    }
+    if(len <= TMAP_CURSOR_KEY_SIZE) {
+        memcpy(cursor->__key, node->key, len);
+        cursor->key = cursor->__key;
+        cursor->__copied = 1;
+    }
+}
+
+
+// Position 'cursor' on the node __tseek finds, left untouched if none
+int __tcursorSeek(tmap* map, void* key, const int mode, tcursor* cursor) {
+    unsigned long* readers = NULL;
+    tnode* node;
+
+    if(map->__ops->seek == NULL) {
+        return 0;
+    }
+
+    if(map->__multitask == MULTI_THREAD_RCU) {
+        readers = __trcuReadLock(map);
+        node = __tseek(map, __trcuRoot(map), key, mode);
+    } else {
+        __tSyncReadWait(map);
+        node = map->__ops->seek(map, key, mode);
+    }
+
+    if(node != NULL) {
+        __tcursorSet(map, node, cursor);
+    }
+
+    if(readers != NULL) {
+        __trcuReadUnlock(readers);
+    } else {
+        __tSyncReadPost(map);
+    }
+    return node != NULL;
+}
+
+
+void __free(void* ptr, size_t s) {
+    free(ptr);
+}
+
+
+void* __malloc(size_t s) {
+    return malloc(s);
+}
+
+
+// Maps created without an allocator of their own use tconf's
+void* __tconfAlloc(void* ctx, size_t s) {
+    return __tmyalloc(s);
+}
+
+
+void __tconfFree(void* ctx, void* ptr, size_t s) {
+    __tmyfree(ptr, s);
+}
+
+
+void __tallocator_init(tallocator* allocator, const int multitaskMode) {
+    if(allocator == NULL) {
+        __tmyalloc = __malloc;
+        __tmyfree = __free;
+    } else {
+        __tmyalloc = allocator->tmyalloc;
+        __tmyfree = allocator->tmyfree;
+    }
+}
+
+
+// Initialize a map in caller's memory. 'sync' is used for
+// multitask modes other than SINGLE_THREADED.
+void __tmapInit(tmap* map, const tmap_config* config, tsyncobj* sync) {
+    int multitask = config->multitask;
+    size_t bytes;
+
+    map->__multitask = multitask;
+    map->__cmp = config->cmp;
+    map->__keyKind = config->keyKind;
+    map->__root = NULL;
+    map->__firstNodeBlock = NULL;
+    map->__currentNodeBlock = NULL;
+    map->__freeNodes = NULL;
+    map->__nbFreeNodes = 0;
+    map->__noOverwrite = config->noOverwrite;
+    map->__hash = NULL;
+    map->__ops = &__ttreeOps;
+    map->__engineData = NULL;
+    map->__cow = 0;
+    map->__gen = 1;
+
+    if(config->alloc != NULL) {
+        map->__alloc = config->alloc;
+        map->__free = config->free;
+        map->__allocCtx = config->allocCtx;
+    } else {
+        map->__alloc = __tconfAlloc;
+        map->__free = __tconfFree;
+        map->__allocCtx = NULL;
+    }
+
+    map->__flags = config->flags;
+    map->__keySize = config->keySize;
+    map->__firstKeyChunk = NULL;
+    map->__currentKeyChunk = NULL;
+    if(map->__keyKind == TMAP_KEY_U64) {
+        // Nothing to copy
+        map->__flags &= ~TMAP_COPY_KEYS;
+    }
+    map->__lru = NULL;
+    if(config->capacity > 0) {
+        __tlruInit(map, config);
+    }
+    map->__ttl = NULL;
+    if(config->flags & TMAP_TTL) {
+        __tttlInit(map);
+    }
+    map->__bloom = NULL;
+    if(config->flags & TMAP_BLOOM) {
+        __tbloomInit(map);
+    }
+    map->__version = 0;
+    map->__cache = NULL;
+    if(config->flags & TMAP_LOOKUP_CACHE) {
+        __tcacheInit(map);
+    }
+    map->__count = 0;
+    map->__opStats = NULL;
+    if(config->flags & TMAP_STATS) {
+        __tstatsInit(map);
+    }
+    map->__blockSize = config->blockSize > 0 ? config->blockSize : NODE_BLOCK_NB_ELEMENTS;
+    if(map->__flags & TMAP_HUGE_PAGES) {
+        // As many nodes as whole huge pages hold
+        bytes = __nodeBlockBytes(map);
+        bytes = (bytes + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+        map->__blockSize = (bytes - sizeof(tnodeblock) - NODE_ALIGNMENT) / (sizeof(tnode) + __tnodeSideBytes(map));
+    }
+
+    // Allocate an initial node block
+    __nodeBlockAlloc(map);
+    // Remember first block for later memory release
+    map->__firstNodeBlock = map->__currentNodeBlock;
+
+    if(config->hash != NULL) {
+        map->__hash = config->hash;
+        map->__ops = &__thashOps;
+        __thashInit(map);
+    } else if(config->flags & TMAP_BTREE) {
+        map->__ops = &__tbtreeOps;
+        __tbtreeInit(map);
+    } else if(config->flags & TMAP_ART) {
+        map->__ops = &__tartOps;
+        __tartInit(map);
+    }
+
+    map->__mutex = NULL;
+    map->__rwlock = NULL;
+    map->__seq = 0;
+    map->__rcu = NULL;
+    map->__snap = NULL;
+
+    if(multitask == MULTI_THREAD_RCU) {
+        __trcuInit(map);
+        map->__cow = 1;
+    }
+
+    if(multitask == MULTI_THREAD_SAFE || multitask == MULTI_THREAD_SEQLOCK || multitask == MULTI_THREAD_RCU) {
+        map->__mutex = &sync->mutex;
+        pthread_mutex_init(map->__mutex, NULL);
+    } else if(multitask == MULTI_THREAD_RWLOCK) {
+        map->__rwlock = &sync->rwlock;
+        pthread_rwlockattr_t attr;
+        pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+        // Default glibc rwlock lets a steady flow of readers starve writers
+        pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+        pthread_rwlock_init(map->__rwlock, &attr);
+        pthread_rwlockattr_destroy(&attr);
+    }
+}
+
+
+// Hash tables, B+ trees and radix trees are modified in place, readers
+// can't do without a lock
+void __tengineMultitaskCheck(const int multitask) {
+    // Their readers would lock the mutex: only tree readers walk a
+    // seqlock map without it
+    if(multitask == MULTI_THREAD_SEQLOCK || multitask == MULTI_THREAD_RCU) {
+        fprintf(stderr, "Unsupported multitask parameter for hash indexed, B+ tree and radix tree maps: %d\n", multitask);
+        exit(-1);
+    }
+}
+
+
+// Check multitask mode requested by client
+void __tmultitaskCheck(const int multitask) {
+    if(multitask != MULTI_THREAD_SAFE && multitask != SINGLE_THREADED
+       && multitask != MULTI_THREAD_RWLOCK && multitask != MULTI_THREAD_SEQLOCK
+       && multitask != MULTI_THREAD_RCU) {
+        fprintf(stderr, "Unsupported multitask parameter: %d\n", multitask);
+        exit(-1);
+    }
+}
+
+
+// Release memory held by a map, except the map itself and
+// its mutex memory. Nodes are dropped with their blocks, without
+// being removed one by one.
+void __tmapRelease(tmap* map) {
+    tnodeblock* nodeBlock;
+    tnodeblock* nextNodeBlock;
+
+    if(map->__rcu != NULL) {
+        __trcuDestroy(map);
+    }
+    if(map->__snap != NULL) {
+        __tsnapDestroy(map);
+    }
+
+    nodeBlock = map->__firstNodeBlock;
+    while(nodeBlock != NULL) {
+        nextNodeBlock = nodeBlock->__next;
+        __nodeBlockFree(map, nodeBlock);
+        nodeBlock = nextNodeBlock;
+    }
+    map->__root = NULL;
+    map->__firstNodeBlock = NULL;
+    map->__currentNodeBlock = NULL;
+    map->__freeNodes = NULL;
+    map->__nbFreeNodes = 0;
+
+    map->__ops->destroy(map);
+    __tarenaDestroy(map);
+    if(map->__lru != NULL) {
+        __tlruDestroy(map);
+    }
+    if(map->__ttl != NULL) {
+        __tttlDestroy(map);
+    }
+    if(map->__bloom != NULL) {
+        __tbloomDestroy(map);
+    }
+    if(map->__cache != NULL) {
+        __tcacheDestroy(map);
+    }
+    if(map->__opStats != NULL) {
+        __tstatsDestroy(map);
+    }
+
+    // release synchronization object
+    if(map->__mutex != NULL) {
+        pthread_mutex_destroy(map->__mutex);
+    }
+    if(map->__rwlock != NULL) {
+        pthread_rwlock_destroy(map->__rwlock);
+    }
+}
+
+
+// Empty the map and make all of its node blocks available again.
+// Map is locked.
+void __tclear(tmap* map) {
+    tnodeblock* nodeBlock;
+
+    map->__count = 0;
+    if(map->__cow && map->__rcu == NULL) {
+        // Live snapshots still see the tree, its nodes can't be reused yet
+        __tsnapRetireTree(map, map->__root);
+        map->__ops->clear(map);
+        return;
+    }
+
+    map->__ops->clear(map);
+    if(map->__rcu != NULL) {
+        // No reader may still be in the nodes about to be reused
+        __trcuReset(map);
+    }
+
+    for(nodeBlock = map->__firstNodeBlock; nodeBlock != NULL; nodeBlock = nodeBlock->__next) {
+        nodeBlock->__index = 0;
+        nodeBlock->__activeNodes = 0;
+    }
+    map->__currentNodeBlock = map->__firstNodeBlock;
+    map->__freeNodes = NULL;
+    map->__nbFreeNodes = 0;
+    __tarenaReset(map);
+    if(map->__lru != NULL) {
+        __tlruReset(map);
+    }
+    if(map->__ttl != NULL) {
+        __tttlReset(map);
+    }
+    if(map->__bloom != NULL) {
+        __tbloomReset(map);
+    }
+}
+
+
+// Key/value pair, looks like a node to the compare function
+typedef struct tpair {
+    void* key;
+    void* value;
+} tpair;
+
+
+// Stable bottom up merge sort of 'n' pairs using 'tmp' as scratch space.
+// Returns the array holding the sorted pairs, 'pairs' or 'tmp'.
+tpair* __tsortPairs(tmap* map, tpair* pairs, tpair* tmp, const size_t n) {
+    tpair* src = pairs;
+    tpair* dst = tmp;
+    tpair* swap;
+    size_t width, lo, mid, hi, i, j, k;
+
+    for(width=1; width<n; width*=2) {
+        for(lo=0; lo<n; lo+=2*width) {
+            mid = lo + width < n ? lo + width : n;
+            hi = lo + 2*width < n ? lo + 2*width : n;
+            i = lo;
+            j = mid;
+            k = lo;
+            // Already in order, nothing to merge
+            if(j < hi && i < mid && __tcmpKeys(map, src[mid-1].key, src[mid].key) <= 0) {
+                memcpy(&dst[lo], &src[lo], (hi - lo)*sizeof(tpair));
+                continue;
+            }
+            while(i < mid && j < hi) {
+                // Left first on ties to keep the sort stable
+                if(__tcmpKeys(map, src[j].key, src[i].key) < 0) {
+                    dst[k++] = src[j++];
+                } else {
+                    dst[k++] = src[i++];
+                }
+            }
+            while(i < mid) {
+                dst[k++] = src[i++];
+            }
+            while(j < hi) {
+                dst[k++] = src[j++];
+            }
+        }
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+    return src;
+}
+
+
+// Number of distinct keys in sorted 'keys'
+size_t __tcountUnique(tmap* map, void** keys, const size_t n) {
+    size_t unique = n > 0;
+    size_t i;
+
+    for(i=1; i<n; ++i) {
+        unique += __tcmpKeys(map, keys[i-1], keys[i]) != 0;
+    }
+    return unique;
+}
+
+
+// Build a balanced tree of the next 'count' distinct keys of sorted
+// 'keys', starting at '*pos'. Nodes are allocated in key order so
+// that an in order walk reads memory sequentially. The last value of
+// equal keys is kept, as successive 'tadd' would.
+tnode* __tbuildSubtree(tmap* map, void** keys, void** values, const size_t n, size_t* pos, const size_t count) {
+    tnode* left;
+    tnode* node;
+
+    if(count == 0) {
+        return NULL;
+    }
+
+    left = __tbuildSubtree(map, keys, values, n, pos, count / 2);
+
+    node = __nodeAlloc(map);
+    __tsetKey(map, node, keys[*pos]);
+    while(*pos + 1 < n && __tcmpKeys(map, keys[*pos], keys[*pos + 1]) == 0) {
+        ++*pos;
+    }
+    node->value = values[*pos];
+    ++*pos;
+
+    node->__left = left;
+    node->__right = __tbuildSubtree(map, keys, values, n, pos, count - count / 2 - 1);
+    __tupdateHeight(node);
+    return node;
+}
+
+
+/*************************** PUBLIC **********************************/
+// Public functions
+/**********************************************************************/
+
+
+void tconf(tallocator* allocator) {
+    if(allocator == NULL) {
+        return;
+    }
+    __tallocator_init(allocator, -1);
+}
+
+
+tmap* tinit_ex(const tmap_config* config) {
+    tmap* map;
+    tsyncobj* sync = NULL;
+    void* (*alloc)(void* ctx, size_t nbBytes) = config->alloc;
+
+    if(__tmyalloc == NULL) {
+        __tallocator_init(NULL, config->multitask);
+    }
+
+    __tmultitaskCheck(config->multitask);
+    if((config->flags & TMAP_COPY_KEYS) && config->keyKind == TMAP_KEY_PTR && config->keySize == 0) {
+        fprintf(stderr, "TMAP_COPY_KEYS needs the key size of TMAP_KEY_PTR maps\n");
+        exit(-1);
+    }
+    if((config->flags & TMAP_ART) && config->keyKind != TMAP_KEY_STRING) {
+        fprintf(stderr, "TMAP_ART maps are keyed by strings (TMAP_KEY_STRING)\n");
+        exit(-1);
+    }
+    if(config->hash != NULL || (config->flags & (TMAP_BTREE | TMAP_ART))) {
+        __tengineMultitaskCheck(config->multitask);
+    }
+    if((config->capacity > 0 || (config->flags & TMAP_TTL)) && config->multitask == MULTI_THREAD_RCU) {
+        fprintf(stderr, "Bounded maps (capacity) and TMAP_TTL maps can't be MULTI_THREAD_RCU maps\n");
+        exit(-1);
+    }
+    if((config->flags & TMAP_BLOOM)
+       && (config->multitask == MULTI_THREAD_SEQLOCK || config->multitask == MULTI_THREAD_RCU)) {
+        fprintf(stderr, "TMAP_BLOOM maps can't be MULTI_THREAD_SEQLOCK or MULTI_THREAD_RCU maps\n");
+        exit(-1);
+    }
+    // Raw key bytes may differ for keys 'cmp' finds equal: only the
+    // client's hash agrees with it
+    if((config->flags & TMAP_BLOOM) && config->keyKind == TMAP_KEY_PTR && config->hash == NULL) {
+        fprintf(stderr, "TMAP_BLOOM needs a hash function for TMAP_KEY_PTR maps\n");
+        exit(-1);
+    }
+    if((config->flags & TMAP_LOOKUP_CACHE) && (config->capacity > 0 || (config->flags & TMAP_TTL))) {
+        fprintf(stderr, "Bounded maps (capacity) and TMAP_TTL maps can't be TMAP_LOOKUP_CACHE maps\n");
+        exit(-1);
+    }
+    if(alloc == NULL) {
+        alloc = __tconfAlloc;
+    }
+
+    map = alloc(config->allocCtx, sizeof(tmap));
+    if(config->multitask != SINGLE_THREADED) {
+        sync = alloc(config->allocCtx, sizeof(tsyncobj));
+    }
+    __tmapInit(map, config, sync);
+
+    return map;
+}
+
+
+tmap* tinit(int (*cmp)(const void*, const void*),
+            const int noOverwrite,
+            const int multitask) {
+    tmap_config config;
+
+    memset(&config, 0, sizeof(config));
+    config.cmp = cmp;
+    config.noOverwrite = noOverwrite;
+    config.multitask = multitask;
+    return tinit_ex(&config);
+}
+
+
+tmap* tinit_u64(const int noOverwrite,
+               const int multitask) {
+    tmap_config config;
+
+    memset(&config, 0, sizeof(config));
+    config.keyKind = TMAP_KEY_U64;
+    config.noOverwrite = noOverwrite;
+    config.multitask = multitask;
+    return tinit_ex(&config);
+}
+
+
+tmap* tinit_str(const int noOverwrite,
+               const int multitask) {
+    tmap_config config;
+
+    memset(&config, 0, sizeof(config));
+    config.keyKind = TMAP_KEY_STRING;
+    config.noOverwrite = noOverwrite;
+    config.multitask = multitask;
+    return tinit_ex(&config);
+}
+
+
+tmap* tinit_btree(int (*cmp)(const void*, const void*),
+                  const int noOverwrite,
+                  const int multitask) {
+    tmap_config config;
+
+    memset(&config, 0, sizeof(config));
+    config.cmp = cmp;
+    config.noOverwrite = noOverwrite;
+    config.multitask = multitask;
+    config.flags = TMAP_BTREE;
+    return tinit_ex(&config);
+}
+
+
+tmap* tinit_art(const int noOverwrite,
+                const int multitask) {
+    tmap_config config;
+
+    memset(&config, 0, sizeof(config));
+    config.keyKind = TMAP_KEY_STRING;
+    config.noOverwrite = noOverwrite;
+    config.multitask = multitask;
+    config.flags = TMAP_ART;
+    return tinit_ex(&config);
+}
+
+
+tmap* tinit_hash(uint64_t (*hash)(const void* key),
+                 int (*cmp)(const void*, const void*),
+                 const int noOverwrite,
+                 const int multitask) {
+    tmap_config config;
+
+    memset(&config, 0, sizeof(config));
+    config.cmp = cmp;
+    config.hash = hash;
+    config.noOverwrite = noOverwrite;
+    config.multitask = multitask;
+    return tinit_ex(&config);
+}
+
+
+// Override compare function
+void tsetcmp(tmap* map,
+             int (*cmp)(const void*, const void*)) {
+    map->__cmp = cmp;
+}
+
+
+// To be used by client for ttwalk
+const tnode* ttreeroot(tmap* map) {
+    return map->__root;
+}
+
+
+void ttwalk(const tnode* root,
+            void (*action)(const void* nodep, VISIT which, int depth)) {
+    if(root != NULL && action != NULL) {
+        __twalk(root, action, 0);
+    }
+}
+
+
+// Remove a node from the binary tree
+void tdel(tmap* map, void* key) {
+    unsigned long compares = __tcompares;
+
+    __tSyncWait(map);
+    map->__ops->remove(map, key);
+    __twritten(map, NULL);
+    __tSyncPost(map);
+    __tstatsEnd(map, TMAP_OP_DEL, 1, compares);
+}
+
+
+// Release all internal memory associated with the map
+// It is up to the client to release memory associated
+// with the keys and corresponding values.
+void tfree(tmap* map) {
+    if(map->__alloc == __tshmAlloc && __tshmRelease(map)) {
+        return;
+    }
+
+    __tmapRelease(map);
+
+    if(map->__multitask != SINGLE_THREADED) {
+        // Mutex or rwlock, both at the start of the sync object
+        MAPFREE(map, map->__mutex != NULL ? (void*)map->__mutex : (void*)map->__rwlock, sizeof(tsyncobj));
+    }
+
+    // At last, release the map
+    MAPFREE(map, map, sizeof(tmap));
+}
+
+
+void tclear(tmap* map) {
+    __tSyncWait(map);
+    __tclear(map);
+    __tSyncPost(map);
+}
+
+
+int tbuild(tmap* map, void** keys, void** values, const size_t n, const int flags) {
+    void** buf = NULL;
+    tpair* pairs;
+    size_t i;
+    int rc;
+    int c;
+
+    if(flags & TMAP_BUILD_SORT) {
+        // Sort pairs, then lay keys and values out as the caller would.
+        // The buffer is short lived: it isn't taken from the map's
+        // allocator, which for shared maps is the segment.
+        if(n > SIZE_MAX / (4*sizeof(void*))) {
+            errno = EINVAL;
+            return -1;
+        }
+        buf = malloc(4*n*sizeof(void*));
+        if(buf == NULL && n > 0) {
+            return -1;
+        }
+        pairs = (tpair*)buf;
+        for(i=0; i<n; ++i) {
+            pairs[i].key = keys[i];
+            pairs[i].value = values[i];
+        }
+        pairs = __tsortPairs(map, pairs, (tpair*)(buf + 2*n), n);
+        keys = (pairs == (tpair*)buf) ? buf + 2*n : buf;
+        values = keys + n;
+        for(i=0; i<n; ++i) {
+            keys[i] = pairs[i].key;
+            values[i] = pairs[i].value;
+        }
+    }
+
+    for(i=1; i<n; ++i) {
+        c = __tcmpKeys(map, keys[i-1], keys[i]);
+        if(c > 0 && map->__ops->seek != NULL) {
+            free(buf);
+            return -1;
+        }
+        if(c == 0 && map->__noOverwrite) {
+            fprintf(stderr, "SIGABRT: Key overwrite error: key addr: %p\n", keys[i]);
+            free(buf);
+            raise(SIGABRT);
+            return -1;
+        }
+    }
+
+    __tSyncWait(map);
+    rc = __troom(map, keys, n) ? 0 : -1;
+    if(rc == 0) {
+        __tclear(map);
+    }
+    if(rc == 0 && map->__ops == &__ttreeOps) {
+        i = 0;
+        map->__root = __tbuildSubtree(map, keys, values, n, &i, __tcountUnique(map, keys, n));
+    } else if(rc == 0) {
+        // Shared maps stop when their segment is full, indexes grow
+        // as keys are added
+        for(i=0; i<n; ++i) {
+            if(!__troom(map, &keys[i], 1)) {
+                rc = -1;
+                break;
+            }
+            map->__ops->insert(map, keys[i], &c)->value = values[i];
+        }
+    }
+    __twritten(map, NULL);
+    __tSyncPost(map);
+
+    free(buf);
+    return rc;
+}
+
+
+void treserve(tmap* map, const size_t n) {
+    tnodeblock* nodeBlock;
+    size_t available;
+
+    __tSyncWait(map);
+
+    // Shared maps reserve nodes, as long as their segment keeps room
+    // for changes
+    if(map->__alloc != __tshmAlloc) {
+        map->__ops->reserve(map, n);
+    }
+    nodeBlock = map->__currentNodeBlock;
+
+    // Free nodes, the rest of the current block and blocks after it,
+    // which have not been used yet
+    available = map->__nbFreeNodes + map->__blockSize - nodeBlock->__index;
+    while(nodeBlock->__next != NULL) {
+        nodeBlock = nodeBlock->__next;
+        available += map->__blockSize;
+    }
+    while(available < n && __troom(map, NULL, map->__blockSize)) {
+        nodeBlock = __nodeBlockNew(map, nodeBlock);
+        available += map->__blockSize;
+    }
+
+    __tSyncPost(map);
+}
+
+
+// 'tadd', and 'tadd_ttl' if 'ttl' is set
+static inline void __tadd(tmap* map, void* key, void* value, const uint64_t* ttl) {
+    unsigned long compares = __tcompares;
+    tnode* node;
+    int created;
+
+    __tSyncWait(map);
+
+    if(!__troom(map, &key, 1)) {
+        __tSyncPost(map);
+        return;
+    }
+    node = map->__ops->insert(map, key, &created);
+    created = __tttlFresh(map, node, created);
+
+    if(map->__noOverwrite && !created) {
+        fprintf(stderr, "SIGABRT: Key overwrite error: key addr: %p\n", key);
+        __tSyncPost(map);
+        raise(SIGABRT);
+        return;
+    }
+
+    if(!(map->__flags & TMAP_COPY_KEYS)) {
+        node->key = key;
+    }
+    node->value = value;
+    if(ttl != NULL) {
+        __tttlSet(map, node, *ttl);
+    }
+    __twritten(map, node);
+
+    __tSyncPost(map);
+    __tstatsEnd(map, TMAP_OP_PUT, 1, compares);
+}
+
+
+void tadd(tmap* map, void* key, void* value) {
+    __tadd(map, key, value, NULL);
+}
+
+
+void tadd_ttl(tmap* map, void* key, void* value, const uint64_t ttl) {
+    if(map->__ttl == NULL) {
+        fprintf(stderr, "tadd_ttl needs a TMAP_TTL map\n");
+        exit(-1);
+    }
+    __tadd(map, key, value, &ttl);
+}
+
+
+size_t texpire(tmap* map, const size_t budget) {
+    size_t count;
+
+    if(map->__ttl == NULL) {
+        return 0;
+    }
+    __tSyncWait(map);
+    count = __tttlSweep(map, budget);
+    __tSyncPost(map);
+    return count;
+}
+
+
+void* tput(tmap* map, void* key, void* value) {
+    unsigned long compares = __tcompares;
+    tnode* node;
+    void* previous = NULL;
+    int created;
+
+    __tSyncWait(map);
+
+    if(!__troom(map, &key, 1)) {
+        __tSyncPost(map);
+        return NULL;
+    }
+    node = map->__ops->insert(map, key, &created);
+    created = __tttlFresh(map, node, created);
+    if(created) {
+        node->value = value;
+    } else {
+        previous = node->value;
+        if(!map->__noOverwrite) {
+            if(!(map->__flags & TMAP_COPY_KEYS)) {
+                node->key = key;
+            }
+            node->value = value;
+        }
+    }
+    __twritten(map, node);
+
+    __tSyncPost(map);
+    __tstatsEnd(map, TMAP_OP_PUT, 1, compares);
+
+    return previous;
+}
+
+
+void* tinsert_if_absent(tmap* map, void* key, void* value) {
+    unsigned long compares = __tcompares;
+    tnode* node;
+    void* existing = NULL;
+    int created;
+
+    __tSyncWait(map);
+
+    if(!__troom(map, &key, 1)) {
+        __tSyncPost(map);
+        return NULL;
+    }
+
+    // Don't copy the path to a node that won't change
+    if(map->__cow && (node = map->__ops->get(map, key)) != NULL) {
+        existing = node->value;
+        __tSyncPost(map);
+        __tstatsEnd(map, TMAP_OP_PUT, 1, compares);
+        return existing;
+    }
+
+    node = map->__ops->insert(map, key, &created);
+    created = __tttlFresh(map, node, created);
+    if(created) {
+        node->value = value;
+    } else {
+        existing = node->value;
+    }
+    __twritten(map, node);
+
+    __tSyncPost(map);
+    __tstatsEnd(map, TMAP_OP_PUT, 1, compares);
+
+    return existing;
+}
+
+
+void* tcompute(tmap* map, void* key,
+               void* (*fn)(const void* key, void* value, void* ctx),
+               void* ctx) {
+    unsigned long compares = __tcompares;
+    tnode** path[TREE_MAX_HEIGHT];
+    tnode** link;
+    tnode* node;
+    void* value;
+    int depth;
+    int created;
+    int expired;
+
+    __tSyncWait(map);
+
+    if(!__troom(map, &key, 1)) {
+        __tSyncPost(map);
+        return NULL;
+    }
+    if(map->__ops != &__ttreeOps) {
+        // Engines without a descent path look the key up twice
+        // when it has to be added or removed
+        node = map->__ops->get(map, key);
+        expired = node != NULL && __tttlFresh(map, node, 0);
+        value = fn(key, node == NULL || expired ? NULL : node->value, ctx);
+        if(node != NULL && value != NULL) {
+            node->value = value;
+        } else if(node != NULL) {
+            map->__ops->remove(map, key);
+        } else if(value != NULL) {
+            node = map->__ops->insert(map, key, &created);
+            node->value = value;
+        }
+        __twritten(map, value != NULL ? node : NULL);
+        __tSyncPost(map);
+        __tstatsEnd(map, TMAP_OP_PUT, 1, compares);
+        return value;
+    }
+
+    link = __tdescend(map, key, path, &depth);
+    node = *link;
+    expired = node != NULL && __tttlFresh(map, node, 0);
+    value = fn(key, node == NULL || expired ? NULL : node->value, ctx);
+
+    if(node != NULL || value != NULL) {
+        link = __tpathMut(map, path, depth, link);
+    }
+    if(node != NULL) {
+        if(value != NULL) {
+            (*link)->value = value;
+        } else {
+            __nodeRelease(map, __tunlinkAt(map, path, depth, link));
+        }
+    } else if(value != NULL) {
+        node = __nodeAlloc(map);
+        __tsetKey(map, node, key);
+        node->value = value;
+        __tlinkAt(map, path, depth, link, node);
+    }
+    __twritten(map, value != NULL ? node : NULL);
+
+    __tSyncPost(map);
+    __tstatsEnd(map, TMAP_OP_PUT, 1, compares);
+
+    return value;
+}
+
+
+// Lock for lookups in a bounded, TMAP_TTL or TMAP_BLOOM map: exclusive
+// when they change the map, that is bounded maps
+static inline void __tgetLock(tmap* map) {
+    if(map->__lru != NULL) {
+        __tSyncWait(map);
+    } else {
+        __tSyncReadWait(map);
+    }
+}
+
+
+static inline void __tgetUnlock(tmap* map) {
+    if(map->__lru != NULL) {
+        __tSyncPost(map);
+    } else {
+        __tSyncReadPost(map);
+    }
+}
+
+
+// Lookup in a bounded, TMAP_TTL or TMAP_BLOOM map, locked by
+// '__tgetLock'. Expired keys aren't found, the key found in a bounded
+// map becomes the most recently used.
+static inline void* __tgetChecked(tmap* map, void* key) {
+    tnode* node;
+
+    node = map->__bloom == NULL || __tbloomMayHave(map, key) ? map->__ops->get(map, key) : NULL;
+    if(node == NULL || (map->__ttl != NULL && __tttlExpired(map, node))) {
+        return NULL;
+    }
+    if(map->__lru != NULL) {
+        __tlruUse(map, node);
+    }
+    return node->value;
+}
+
+
+// Same, taking the lock
+void* __tgetLocked(tmap* map, void* key) {
+    void* v;
+
+    __tgetLock(map);
+    v = __tgetChecked(map, key);
+    __tgetUnlock(map);
+    return v;
+}
+
+
+// 'tget' walking the map
+void* __tgetUncached(tmap* map, void* key) {
+    tnode* node;
+    void* v = NULL;
+
+    if(map->__lru != NULL || map->__ttl != NULL) {
+        return __tgetLocked(map, key);
+    }
+    if(map->__multitask == MULTI_THREAD_SEQLOCK) {
+        return __tgetOptimistic(map, key);
+    }
+    if(map->__multitask == MULTI_THREAD_RCU) {
+        return __tgetRcu(map, key);
+    }
+
+    __tSyncReadWait(map);
+
+    if(map->__bloom == NULL || __tbloomMayHave(map, key)) {
+        node = map->__ops->get(map, key);
+        if(node != NULL) {
+            v = node->value;
+        }
+    }
+
+    __tSyncReadPost(map);
+
+    return v;
+}
+
+
+void* tget(tmap* map, void* key) {
+    unsigned long compares = __tcompares;
+    void* v;
+
+    v = map->__cache != NULL ? __tcacheGet(map, key) : __tgetUncached(map, key);
+    __tstatsEnd(map, TMAP_OP_GET, 1, compares);
+    return v;
+}
+
+
+static inline void __tgetBatchMap(tmap* map, void** keys, void** values, const size_t n) {
+    unsigned long* readers;
+    tnode* node;
+    size_t i;
+
+    if(map->__lru != NULL || map->__ttl != NULL || map->__bloom != NULL) {
+        __tgetLock(map);
+        for(i=0; i<n; ++i) {
+            values[i] = __tgetChecked(map, keys[i]);
+        }
+        __tgetUnlock(map);
+        return;
+    }
+    if(map->__multitask == MULTI_THREAD_SEQLOCK) {
+        // Optimistic readers retry on their own, one key at a time
+        for(i=0; i<n; ++i) {
+            values[i] = __tgetOptimistic(map, keys[i]);
+        }
+        return;
+    }
+    if(map->__multitask == MULTI_THREAD_RCU) {
+        readers = __trcuReadLock(map);
+        __tgetBatch(map, __trcuRoot(map), keys, values, n);
+        __trcuReadUnlock(readers);
+        return;
+    }
+
+    __tSyncReadWait(map);
+
+    if(map->__ops == &__ttreeOps) {
+        __tgetBatch(map, map->__root, keys, values, n);
+    } else {
+        for(i=0; i<n; ++i) {
+            node = map->__ops->get(map, keys[i]);
+            values[i] = node != NULL ? node->value : NULL;
+        }
+    }
+
+    __tSyncReadPost(map);
+}
+
+
+void tget_batch(tmap* map, void** keys, void** values, const size_t n) {
+    unsigned long compares = __tcompares;
+
+    __tgetBatchMap(map, keys, values, n);
+    __tstatsEnd(map, TMAP_OP_GET, n, compares);
+}
+
+
+int tfirst(tmap* map, tcursor* cursor) {
+    return __tcursorSeek(map, NULL, TSEEK_FIRST, cursor);
+}
+
+
+int tlast(tmap* map, tcursor* cursor) {
+    return __tcursorSeek(map, NULL, TSEEK_LAST, cursor);
+}
+
+
+int tlower_bound(tmap* map, void* key, tcursor* cursor) {
+    return __tcursorSeek(map, key, TSEEK_GE, cursor);
+}
+
+
+int tupper_bound(tmap* map, void* key, tcursor* cursor) {
+    return __tcursorSeek(map, key, TSEEK_GT, cursor);
+}
+
+
+// Key the cursor moves from, its own copy if it has one: 'key' may
+// point to the copy of another cursor it was copied from
+static inline void* __tcursorKey(tcursor* cursor) {
+    return cursor->__copied ? cursor->__key : cursor->key;
+}
+
+
+int tnext(tmap* map, tcursor* cursor) {
+    return __tcursorSeek(map, __tcursorKey(cursor), TSEEK_GT, cursor);
+}
+
+
+int tprev(tmap* map, tcursor* cursor) {
+    return __tcursorSeek(map, __tcursorKey(cursor), TSEEK_LT, cursor);
+}
+
+
+size_t trange(tmap* map, void* lo, void* hi,
+              int (*fn)(const void* key, void* value, void* ctx),
+              void* ctx) {
+    unsigned long* readers;
+    size_t count;
+
+    if(map->__ops->range == NULL) {
+        return 0;
+    }
+
+    if(map->__multitask == MULTI_THREAD_RCU) {
+        readers = __trcuReadLock(map);
+        count = __trange(map, __trcuRoot(map), lo, hi, fn, ctx);
+        __trcuReadUnlock(readers);
+    } else {
+        __tSyncReadWait(map);
+        count = map->__ops->range(map, lo, hi, fn, ctx);
+        __tSyncReadPost(map);
+    }
+    return count;
+}
+
+
+size_t tprefix(tmap* map, const char* prefix,
+               int (*fn)(const void* key, void* value, void* ctx),
+               void* ctx) {
+    size_t len = strlen(prefix);
+    size_t count;
+    char* hi;
+
+    if(map->__ops->prefix != NULL) {
+        __tSyncReadWait(map);
+        count = map->__ops->prefix(map, prefix, fn, ctx);
+        __tSyncReadPost(map);
+        return count;
+    }
+    if(map->__keyKind != TMAP_KEY_STRING || map->__ops->range == NULL) {
+        return 0;
+    }
+
+    // Keys with the prefix are lower than the prefix with its last byte
+    // incremented, 0xFF bytes carried over. None above "\xFF\xFF...".
+    hi = MAPALLOC(map, len + 1);
+    memcpy(hi, prefix, len + 1);
+    while(len > 0 && (unsigned char)hi[len-1] == 0xFF) {
+        hi[--len] = 0;
+    }
+    if(len > 0) {
+        ++hi[len-1];
+    }
+    count = trange(map, (void*)prefix, len > 0 ? hi : NULL, fn, ctx);
+    MAPFREE(map, hi, strlen(prefix) + 1);
+    return count;
 }
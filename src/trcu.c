@@ -0,0 +1,245 @@
+/*********************************************************************************
+MIT License
+
+Copyright (c) 2019 Mathieu Comeau
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************/
+
+/*
+Epoch based reclamation for MULTI_THREAD_RCU maps.
+
+Writers never modify a node readers can reach: they copy it (see '__tmut') and
+publish the new tree root when done. Replaced nodes are retired to one of two
+lists, depending on the parity of the map epoch at the time.
+
+Readers take no lock. They announce themselves by incrementing the counter of
+the current epoch parity in one of RCU_SLOTS cache line sized slots, picked per
+thread. The epoch moves forward only once no reader of the previous epoch is
+left, nodes retired two epochs ago are then released.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include "tmap.h"
+#include "tmapint.h"
+
+
+#define CACHE_LINE_SIZE 64
+
+// Reader slots per map, threads share them when there are more
+#define RCU_SLOTS 64
+
+
+typedef struct trcuslot {
+    unsigned long readers[2];
+} __attribute__((aligned(CACHE_LINE_SIZE))) trcuslot;
+
+
+struct trcu {
+    // Read by every reader, written once per write operation
+    tnode* root __attribute__((aligned(CACHE_LINE_SIZE)));
+    unsigned long epoch;
+
+    // Writer only
+    tnode** retired[2] __attribute__((aligned(CACHE_LINE_SIZE)));
+    size_t nbRetired[2];
+    size_t capRetired[2];
+
+    trcuslot slots[RCU_SLOTS];
+
+    // Memory as allocated, before alignment
+    void* mem;
+};
+
+
+static unsigned int __trcuNextThread = 0;
+static __thread int __trcuThreadSlot = -1;
+
+
+/*************************** INTERNAL *********************************/
+
+
+void __trcuInit(tmap* map) {
+    void* mem = MAPALLOC(map, sizeof(trcu) + CACHE_LINE_SIZE);
+    trcu* rcu = (trcu*)(((uintptr_t)mem + CACHE_LINE_SIZE - 1) & ~(uintptr_t)(CACHE_LINE_SIZE - 1));
+    int i;
+
+    rcu->mem = mem;
+    rcu->root = NULL;
+    rcu->epoch = 0;
+    for(i=0; i<2; ++i) {
+        rcu->retired[i] = NULL;
+        rcu->nbRetired[i] = 0;
+        rcu->capRetired[i] = 0;
+    }
+    for(i=0; i<RCU_SLOTS; ++i) {
+        rcu->slots[i].readers[0] = 0;
+        rcu->slots[i].readers[1] = 0;
+    }
+    map->__rcu = rcu;
+}
+
+
+void __trcuReleaseRetired(tmap* map, int list) {
+    trcu* rcu = map->__rcu;
+    tnode* node;
+    size_t i;
+
+    for(i=0; i<rcu->nbRetired[list]; ++i) {
+        node = rcu->retired[list][i];
+        if((uintptr_t)node & 1) {
+            __tarenaFree(map, (void*)((uintptr_t)node & ~(uintptr_t)1));
+        } else {
+            __nodeFree(map, node);
+        }
+    }
+    rcu->nbRetired[list] = 0;
+}
+
+
+// Release everything, no reader may be left. Retired nodes
+// go away with the map's node blocks.
+void __trcuDestroy(tmap* map) {
+    trcu* rcu = map->__rcu;
+    int i;
+
+    for(i=0; i<2; ++i) {
+        if(rcu->retired[i] != NULL) {
+            MAPFREE(map, rcu->retired[i], rcu->capRetired[i]*sizeof(tnode*));
+        }
+    }
+    MAPFREE(map, rcu->mem, sizeof(trcu) + CACHE_LINE_SIZE);
+    map->__rcu = NULL;
+}
+
+
+// Enter a read side section, returns the counter to give
+// back to __trcuReadUnlock
+unsigned long* __trcuReadLock(tmap* map) {
+    trcu* rcu = map->__rcu;
+    unsigned long* readers;
+    unsigned long epoch;
+
+    if(__trcuThreadSlot < 0) {
+        __trcuThreadSlot = __atomic_fetch_add(&__trcuNextThread, 1, __ATOMIC_RELAXED) % RCU_SLOTS;
+    }
+
+    while(1) {
+        epoch = __atomic_load_n(&rcu->epoch, __ATOMIC_SEQ_CST);
+        readers = &rcu->slots[__trcuThreadSlot].readers[epoch & 1];
+        __atomic_fetch_add(readers, 1, __ATOMIC_SEQ_CST);
+        // If the epoch moved, the writer may not have seen us
+        if(__atomic_load_n(&rcu->epoch, __ATOMIC_SEQ_CST) == epoch) {
+            return readers;
+        }
+        __atomic_fetch_sub(readers, 1, __ATOMIC_RELEASE);
+    }
+}
+
+
+void __trcuReadUnlock(unsigned long* readers) {
+    __atomic_fetch_sub(readers, 1, __ATOMIC_RELEASE);
+}
+
+
+// Tree root as last published by a writer
+tnode* __trcuRoot(tmap* map) {
+    return __atomic_load_n(&map->__rcu->root, __ATOMIC_SEQ_CST);
+}
+
+
+// Node removed from the tree, released when no reader can see it anymore
+void __trcuRetire(tmap* map, tnode* node) {
+    trcu* rcu = map->__rcu;
+    int list = rcu->epoch & 1;
+    tnode** retired;
+
+    if(rcu->nbRetired[list] == rcu->capRetired[list]) {
+        retired = MAPALLOC(map, 2*(rcu->capRetired[list] + 32)*sizeof(tnode*));
+        if(rcu->retired[list] != NULL) {
+            memcpy(retired, rcu->retired[list], rcu->nbRetired[list]*sizeof(tnode*));
+            MAPFREE(map, rcu->retired[list], rcu->capRetired[list]*sizeof(tnode*));
+        }
+        rcu->retired[list] = retired;
+        rcu->capRetired[list] = 2*(rcu->capRetired[list] + 32);
+    }
+    rcu->retired[list][rcu->nbRetired[list]++] = node;
+}
+
+
+// Key copy of a deleted node, TMAP_COPY_KEYS. Keys are pointer aligned,
+// they are told from nodes in the retired lists by their low bit.
+void __trcuRetireKey(tmap* map, void* key) {
+    __trcuRetire(map, (tnode*)((uintptr_t)key | 1));
+}
+
+
+// Make the writer's tree visible to readers and release what the readers
+// of two epochs ago may have been looking at, if they are all gone.
+void __trcuPublish(tmap* map) {
+    trcu* rcu = map->__rcu;
+    unsigned long epoch = rcu->epoch;
+    int previous = (epoch + 1) & 1;
+    int i;
+
+    __atomic_store_n(&rcu->root, map->__root, __ATOMIC_SEQ_CST);
+
+    if(rcu->nbRetired[0] + rcu->nbRetired[1] == 0) {
+        return;
+    }
+    for(i=0; i<RCU_SLOTS; ++i) {
+        if(__atomic_load_n(&rcu->slots[i].readers[previous], __ATOMIC_SEQ_CST) != 0) {
+            return;
+        }
+    }
+
+    __atomic_store_n(&rcu->epoch, epoch + 1, __ATOMIC_SEQ_CST);
+    // Nodes retired during epoch - 1
+    __trcuReleaseRetired(map, previous);
+}
+
+
+// Publish an empty tree and wait for every reader to be done with the
+// previous one: all nodes, retired or not, may then be reused.
+void __trcuReset(tmap* map) {
+    trcu* rcu = map->__rcu;
+    int previous;
+    int round;
+    int i;
+
+    __atomic_store_n(&rcu->root, NULL, __ATOMIC_SEQ_CST);
+
+    // Readers of both parities must leave, once each
+    for(round=0; round<2; ++round) {
+        previous = (rcu->epoch + 1) & 1;
+        for(i=0; i<RCU_SLOTS; ++i) {
+            while(__atomic_load_n(&rcu->slots[i].readers[previous], __ATOMIC_SEQ_CST) != 0) {
+                sched_yield();
+            }
+        }
+        __atomic_store_n(&rcu->epoch, rcu->epoch + 1, __ATOMIC_SEQ_CST);
+    }
+
+    rcu->nbRetired[0] = 0;
+    rcu->nbRetired[1] = 0;
+}
@@ -0,0 +1,186 @@
+/*********************************************************************************
+MIT License
+
+Copyright (c) 2019 Mathieu Comeau
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************/
+
+/*
+Sharded maps: the key space is split over independent tmap instances, each
+with its own lock and node blocks. Shards are laid out on separate cache lines
+so that threads working on different shards don't share any written memory.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tmap.h"
+#include "tmapint.h"
+
+
+#define CACHE_LINE_SIZE 64
+
+
+// A shard and its lock, padded to whole cache lines
+typedef struct tshardslot {
+    tmap map;
+    tsyncobj sync;
+} __attribute__((aligned(CACHE_LINE_SIZE))) tshardslot;
+
+
+/*************************** INTERNAL *********************************/
+
+
+tmap_sharded* __tinitSharded(const int nbShards,
+                             uint64_t (*hash)(const void* key),
+                             int (*cmp)(const void*, const void*),
+                             const int noOverwrite,
+                             const int multitask) {
+    tmap_sharded* smap;
+    tshardslot* slots;
+    tmap_config config;
+    int shard;
+
+    if(__tmyalloc == NULL) {
+        __tallocator_init(NULL, multitask);
+    }
+
+    if(nbShards < 1) {
+        fprintf(stderr, "Unsupported number of shards: %d\n", nbShards);
+        exit(-1);
+    }
+    __tmultitaskCheck(multitask);
+
+    smap = MYALLOC(sizeof(tmap_sharded));
+    smap->__nbShards = nbShards;
+    smap->__cmp = cmp;
+    smap->__hash = hash;
+    smap->__bounds = NULL;
+    smap->__shards = MYALLOC(nbShards*sizeof(tmap*));
+
+    // Client allocator gives no alignment guarantee
+    smap->__mem = MYALLOC(nbShards*sizeof(tshardslot) + CACHE_LINE_SIZE);
+    slots = (tshardslot*)(((uintptr_t)smap->__mem + CACHE_LINE_SIZE - 1) & ~(uintptr_t)(CACHE_LINE_SIZE - 1));
+
+    memset(&config, 0, sizeof(config));
+    config.cmp = cmp;
+    config.hash = hash;
+    config.noOverwrite = noOverwrite;
+    config.multitask = multitask;
+
+    for(shard=0; shard < nbShards; ++shard) {
+        __tmapInit(&slots[shard].map, &config, &slots[shard].sync);
+        smap->__shards[shard] = &slots[shard].map;
+    }
+
+    return smap;
+}
+
+
+/*************************** PUBLIC **********************************/
+
+
+tmap_sharded* tinit_sharded(const int nbShards,
+                            uint64_t (*hash)(const void* key),
+                            int (*cmp)(const void*, const void*),
+                            const int noOverwrite,
+                            const int multitask) {
+    __tengineMultitaskCheck(multitask);
+    return __tinitSharded(nbShards, hash, cmp, noOverwrite, multitask);
+}
+
+
+tmap_sharded* tinit_sharded_range(const int nbShards,
+                                  void** bounds,
+                                  int (*cmp)(const void*, const void*),
+                                  const int noOverwrite,
+                                  const int multitask) {
+    tmap_sharded* smap = __tinitSharded(nbShards, NULL, cmp, noOverwrite, multitask);
+    int i;
+
+    smap->__bounds = MYALLOC(nbShards*sizeof(void*));
+    for(i=0; i < nbShards - 1; ++i) {
+        smap->__bounds[i] = bounds[i];
+    }
+
+    return smap;
+}
+
+
+void tsfree(tmap_sharded* smap) {
+    int shard;
+
+    for(shard=0; shard < smap->__nbShards; ++shard) {
+        __tmapRelease(smap->__shards[shard]);
+    }
+
+    MYFREE(smap->__mem, smap->__nbShards*sizeof(tshardslot) + CACHE_LINE_SIZE);
+    MYFREE(smap->__shards, smap->__nbShards*sizeof(tmap*));
+    if(smap->__bounds != NULL) {
+        MYFREE(smap->__bounds, smap->__nbShards*sizeof(void*));
+    }
+    MYFREE(smap, sizeof(tmap_sharded));
+}
+
+
+tmap* tshard(tmap_sharded* smap, void* key) {
+    uint64_t h;
+    int lo, hi, mid;
+
+    if(smap->__hash != NULL) {
+        // Use the high bits, the shard map hashes with the low ones
+        h = smap->__hash(key) * 0x9E3779B97F4A7C15ULL;
+        return smap->__shards[(h >> 32) % smap->__nbShards];
+    }
+
+    // First split key greater than 'key'
+    lo = 0;
+    hi = smap->__nbShards - 1;
+    while(lo < hi) {
+        mid = (lo + hi) / 2;
+        if(smap->__cmp(&key, &smap->__bounds[mid]) < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return smap->__shards[lo];
+}
+
+
+tmap* tshardat(tmap_sharded* smap, const int shard) {
+    return smap->__shards[shard];
+}
+
+
+void tsadd(tmap_sharded* smap, void* key, void* value) {
+    tadd(tshard(smap, key), key, value);
+}
+
+
+void tsdel(tmap_sharded* smap, void* key) {
+    tdel(tshard(smap, key), key);
+}
+
+
+void* tsget(tmap_sharded* smap, void* key) {
+    return tget(tshard(smap, key), key);
+}
@@ -0,0 +1,362 @@
+/*********************************************************************************
+MIT License
+
+Copyright (c) 2019 Mathieu Comeau
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************/
+
+/*
+Maps shared by processes.
+
+The map, its lock, node blocks and key copies are all taken from a POSIX
+shared memory segment, by the map's allocator. The segment is at the same
+address in all processes: links between nodes are used as they are.
+Processes forked once the map is created inherit it, others map it with
+'tattach_shared' at the address the header records, which fails if they
+use it for something else. Segments are created at an address picked from
+their name, far from where programs usually map memory, so that it is
+still free in processes forked before. The map also holds the addresses
+of its functions: attaching is for processes of the same program.
+
+Locks are process shared robust mutexes, a process dying while holding
+one doesn't leave the others waiting forever: the map or the segment it
+was changing is unusable from then on.
+
+Memory given back to the segment is kept on a free list and handed out
+again for the same size, which is what the map asks for most: node blocks
+and key chunks. A full segment fails allocations: changes check before
+they start that the never used part holds what they may take at most.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tmap.h"
+#include "tmapint.h"
+
+
+// Allocations are rounded up to this
+#define SHM_ALIGNMENT 16
+// Segment addresses, one of SHM_SLOTS slots SHM_SLOT_SIZE apart
+#define SHM_BASE ((uintptr_t)0x200000000000)
+#define SHM_SLOT_SIZE ((uintptr_t)1 << 32)
+#define SHM_SLOTS 4096
+// Room kept for what changes allocate besides keys, index and nodes:
+// rounding, snapshot lists
+#define SHM_SLACK (64*1024)
+
+
+// Free memory in the segment
+typedef struct tshmfree {
+    struct tshmfree* next;
+    size_t size;
+} tshmfree;
+
+
+// Segment header, memory handed out follows
+typedef struct tshm {
+    // Allocations from processes not holding the map lock, as
+    // tsnapshot's, are serialized on their own
+    pthread_mutex_t lock;
+    size_t size;
+    size_t used;
+    tshmfree* free;
+    // Process that created the segment and removes its name
+    pid_t creator;
+    // Address of the segment, and of the allocator, in all processes
+    void* base;
+    void* (*alloc)(void* ctx, size_t nbBytes);
+    // Set once the map is created
+    tmap* map;
+    char name[];
+} tshm;
+
+
+void __tshmInitMutex(pthread_mutex_t* mutex) {
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+
+void* __tshmAlloc(void* ctx, size_t nbBytes) {
+    tshm* shm = (tshm*)ctx;
+    tshmfree** link;
+    void* ptr = NULL;
+
+    nbBytes = (nbBytes + SHM_ALIGNMENT - 1) & ~(size_t)(SHM_ALIGNMENT - 1);
+    __tmutexLock(&shm->lock);
+    for(link = &shm->free; *link != NULL; link = &(*link)->next) {
+        if((*link)->size == nbBytes) {
+            ptr = *link;
+            *link = (*link)->next;
+            break;
+        }
+    }
+    if(ptr == NULL && shm->size - shm->used >= nbBytes) {
+        ptr = PTR_OFFSET(shm, shm->used);
+        __atomic_store_n(&shm->used, shm->used + nbBytes, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&shm->lock);
+
+    if(ptr == NULL) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+
+void __tshmFree(void* ctx, void* ptr, size_t nbBytes) {
+    tshm* shm = (tshm*)ctx;
+    tshmfree* block = (tshmfree*)ptr;
+
+    block->size = (nbBytes + SHM_ALIGNMENT - 1) & ~(size_t)(SHM_ALIGNMENT - 1);
+    __tmutexLock(&shm->lock);
+    block->next = shm->free;
+    shm->free = block;
+    pthread_mutex_unlock(&shm->lock);
+}
+
+
+// Bytes of the copy of 'key'
+size_t __tshmKeyBytes(tmap* map, const void* key) {
+    switch(map->__keyKind) {
+        case TMAP_KEY_U64:
+            return 0;
+        case TMAP_KEY_STRING:
+            return strlen((const char*)key) + 1;
+        default:
+            return map->__keySize;
+    }
+}
+
+
+// Whether the segment holds what adding the 'n' keys 'keys' may take at
+// most, errno set to ENOMEM if not. 'keys' NULL for keys of no bytes.
+// Map is locked.
+int __tshmRoom(tmap* map, void** keys, const size_t n) {
+    tshm* shm = (tshm*)map->__allocCtx;
+    size_t keyBytes = 0;
+    size_t need;
+    size_t i;
+
+    for(i=0; keys != NULL && i<n; ++i) {
+        keyBytes += __tshmKeyBytes(map, keys[i]);
+    }
+    need = (n / map->__blockSize + 1) * __nodeBlockBytes(map) + SHM_SLACK;
+    if(map->__flags & TMAP_COPY_KEYS) {
+        need += __tarenaGrowth(n, keyBytes);
+    }
+    if(map->__ops->growth != NULL) {
+        need += map->__ops->growth(map);
+    }
+    // Rebuilt larger, reallocated larger
+    if(map->__bloom != NULL) {
+        need += 2 * __tbloomBytes(map);
+    }
+    if(map->__ttl != NULL) {
+        need += 2 * __tttlBytes(map) + SHM_SLACK;
+    }
+
+    if(need > shm->size - __atomic_load_n(&shm->used, __ATOMIC_RELAXED)) {
+        errno = ENOMEM;
+        return 0;
+    }
+    return 1;
+}
+
+
+// 'tfree' of a shared map: nothing is given back to the segment, other
+// processes may still use the map. The segment is unmapped from this
+// process, and its name removed if we created it. Returns 0 if 'map'
+// isn't the segment's map, a snapshot of it.
+int __tshmRelease(tmap* map) {
+    tshm* shm = (tshm*)map->__allocCtx;
+
+    if(shm->map != map) {
+        return 0;
+    }
+    if(shm->creator == getpid()) {
+        shm_unlink(shm->name);
+    }
+    munmap(shm, shm->size);
+    return 1;
+}
+
+
+// Allocator of a map created aside, counting what it would take from a
+// segment
+void* __tshmCountAlloc(void* ctx, size_t nbBytes) {
+    *(size_t*)ctx += (nbBytes + SHM_ALIGNMENT - 1) & ~(size_t)(SHM_ALIGNMENT - 1);
+    return malloc(nbBytes);
+}
+
+
+void __tshmCountFree(void* ctx, void* ptr, size_t nbBytes) {
+    free(ptr);
+}
+
+
+// Address of segment 'name', the same in all processes
+void* __tshmAddress(const char* name) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for(; *name != '\0'; ++name) {
+        h = (h ^ (unsigned char)*name) * 0x100000001b3ULL;
+    }
+    return (void*)(SHM_BASE + (h % SHM_SLOTS) * SHM_SLOT_SIZE);
+}
+
+
+// Mapping of 'size' bytes of 'fd' at 'addr', NULL if that address is
+// taken
+void* __tshmMapAt(void* addr, const size_t size, const int fd) {
+    void* mem;
+
+#ifdef MAP_FIXED_NOREPLACE
+    mem = mmap(addr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+#else
+    mem = mmap(addr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+#endif
+    if(mem == MAP_FAILED) {
+        return NULL;
+    }
+    if(mem != addr) {
+        munmap(mem, size);
+        return NULL;
+    }
+    return mem;
+}
+
+
+tmap* tinit_shared(const char* name, const size_t size, const tmap_config* config) {
+    tmap_config shared;
+    tmap* map;
+    size_t header;
+    size_t bytes = 0;
+    tshm* shm;
+    int fd;
+
+    header = (sizeof(tshm) + strlen(name) + 1 + SHM_ALIGNMENT - 1) & ~(size_t)(SHM_ALIGNMENT - 1);
+    // Lookup caches are per process
+    if(size < header + sizeof(tmap) || (config->flags & TMAP_LOOKUP_CACHE)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // Keys are copied in the segment, the lock is shared, node blocks
+    // come from the segment
+    shared = *config;
+    shared.multitask = MULTI_THREAD_SAFE;
+    shared.flags = (config->flags | TMAP_COPY_KEYS) & ~TMAP_HUGE_PAGES;
+
+    // The segment must hold the map as created
+    shared.alloc = __tshmCountAlloc;
+    shared.free = __tshmCountFree;
+    shared.allocCtx = &bytes;
+    map = tinit_ex(&shared);
+    tfree(map);
+    if(header + bytes > size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd < 0) {
+        return NULL;
+    }
+    if(ftruncate(fd, size) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    // Anywhere if the address of the name is taken: processes forked
+    // from now on still share the map
+    shm = __tshmMapAt(__tshmAddress(name), size, fd);
+    if(shm == NULL) {
+        shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if(shm == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    __tshmInitMutex(&shm->lock);
+    shm->size = size;
+    shm->used = header;
+    shm->free = NULL;
+    shm->creator = getpid();
+    shm->base = shm;
+    shm->alloc = __tshmAlloc;
+    strcpy(shm->name, name);
+
+    shared.alloc = __tshmAlloc;
+    shared.free = __tshmFree;
+    shared.allocCtx = shm;
+    map = tinit_ex(&shared);
+
+    pthread_mutex_destroy(map->__mutex);
+    __tshmInitMutex(map->__mutex);
+    __atomic_store_n(&shm->map, map, __ATOMIC_RELEASE);
+    return map;
+}
+
+
+tmap* tattach_shared(const char* name) {
+    tshm header;
+    tshm* shm;
+    int fd;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if(fd < 0) {
+        return NULL;
+    }
+    if(pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) || header.map == NULL) {
+        close(fd);
+        errno = EAGAIN;
+        return NULL;
+    }
+    // Another program, or the library elsewhere: the map's functions
+    // aren't at the addresses it holds
+    if(header.alloc != __tshmAlloc) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    shm = __tshmMapAt(header.base, header.size, fd);
+    close(fd);
+    if(shm == NULL) {
+        errno = EADDRINUSE;
+        return NULL;
+    }
+    return shm->map;
+}
@@ -0,0 +1,295 @@
+/*********************************************************************************
+MIT License
+
+Copyright (c) 2019 Mathieu Comeau
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************/
+
+/*
+Snapshots of tree maps.
+
+A snapshot is a read only map sharing the tree of the map it was taken from.
+Taking one starts a new write generation with copy on write on: nodes of the
+tree become read only and writers copy them (see '__tmut'), as in
+MULTI_THREAD_RCU mode. A snapshot never sees a node change, its readers need no
+lock.
+
+Nodes replaced or deleted while snapshots are alive are retired along with the
+generation they were created in and the one they were retired in. A snapshot
+of generation g sees those created up to g and retired after it. They are
+released once no snapshot left sees them, copy on write stops with the last
+snapshot.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tmap.h"
+#include "tmapint.h"
+
+
+typedef struct tsnap {
+    // Map the snapshot was taken from, and its generation then
+    tmap* map;
+    unsigned int gen;
+    struct tsnap* next;
+    struct tsnap* previous;
+} tsnap;
+
+
+// Node, or key copy with its low bit set, kept for snapshots
+typedef struct tsnapretired {
+    void* ptr;
+    unsigned int created;
+    unsigned int retired;
+} tsnapretired;
+
+
+struct tsnapstate {
+    // Live snapshots, newest first
+    tsnap* first;
+    tsnapretired* retired;
+    size_t nbRetired;
+    size_t capRetired;
+};
+
+
+/**********************************************************************/
+// Retired nodes
+
+
+// Whether a live snapshot sees what was created in generation 'created'
+// and retired in 'retired'
+int __tsnapSeen(tsnapstate* state, unsigned int created, unsigned int retired) {
+    tsnap* snap;
+
+    for(snap = state->first; snap != NULL; snap = snap->next) {
+        if(snap->gen >= created && snap->gen < retired) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+void __tsnapFree(tmap* map, void* ptr) {
+    if((uintptr_t)ptr & 1) {
+        __tarenaFree(map, (void*)((uintptr_t)ptr & ~(uintptr_t)1));
+    } else {
+        __nodeFree(map, (tnode*)ptr);
+    }
+}
+
+
+void __tsnapKeep(tmap* map, void* ptr, unsigned int created) {
+    tsnapstate* state = map->__snap;
+    tsnapretired* retired;
+
+    if(!__tsnapSeen(state, created, map->__gen)) {
+        __tsnapFree(map, ptr);
+        return;
+    }
+    if(state->nbRetired == state->capRetired) {
+        retired = MAPALLOC(map, 2*(state->capRetired + 32)*sizeof(tsnapretired));
+        if(state->retired != NULL) {
+            memcpy(retired, state->retired, state->nbRetired*sizeof(tsnapretired));
+            MAPFREE(map, state->retired, state->capRetired*sizeof(tsnapretired));
+        }
+        state->retired = retired;
+        state->capRetired = 2*(state->capRetired + 32);
+    }
+    state->retired[state->nbRetired].ptr = ptr;
+    state->retired[state->nbRetired].created = created;
+    state->retired[state->nbRetired].retired = map->__gen;
+    ++state->nbRetired;
+}
+
+
+// Node replaced by a copy or unlinked from the tree, released right away
+// if no snapshot sees it
+void __tsnapRetire(tmap* map, tnode* node) {
+    __tsnapKeep(map, node, node->__gen);
+}
+
+
+// Key copy of a deleted node, TMAP_COPY_KEYS. Older copies of the node
+// may hold it, it's kept for all snapshots older than now.
+void __tsnapRetireKey(tmap* map, void* key) {
+    __tsnapKeep(map, (void*)((uintptr_t)key | 1), 0);
+}
+
+
+// 'tclear' with live snapshots: the whole tree is retired, node blocks
+// can't be reset under them
+void __tsnapRetireTree(tmap* map, tnode* node) {
+    if(node == NULL) {
+        return;
+    }
+    __tsnapRetireTree(map, node->__left);
+    __tsnapRetireTree(map, node->__right);
+    if(map->__flags & TMAP_COPY_KEYS) {
+        __tsnapRetireKey(map, node->key);
+    }
+    __tsnapRetire(map, node);
+}
+
+
+// Release what no live snapshot sees anymore. Map is locked.
+void __tsnapCollect(tmap* map) {
+    tsnapstate* state = map->__snap;
+    size_t kept = 0;
+    size_t i;
+
+    for(i=0; i<state->nbRetired; ++i) {
+        if(__tsnapSeen(state, state->retired[i].created, state->retired[i].retired)) {
+            state->retired[kept++] = state->retired[i];
+        } else {
+            __tsnapFree(map, state->retired[i].ptr);
+        }
+    }
+    state->nbRetired = kept;
+}
+
+
+// Map is being freed, snapshots must have been released
+void __tsnapDestroy(tmap* map) {
+    tsnapstate* state = map->__snap;
+
+    if(state->retired != NULL) {
+        MAPFREE(map, state->retired, state->capRetired*sizeof(tsnapretired));
+    }
+    MAPFREE(map, state, sizeof(tsnapstate));
+    map->__snap = NULL;
+}
+
+
+/**********************************************************************/
+// Snapshot engine: the tree engine's lookups, on the snapshot's root
+
+
+void __tsnapReadOnly(void) {
+    fprintf(stderr, "Map snapshots are read only\n");
+    exit(-1);
+}
+
+
+tnode* __tsnapInsert(tmap* map, void* key, int* created) {
+    __tsnapReadOnly();
+    return NULL;
+}
+
+
+int __tsnapRemove(tmap* map, void* key) {
+    __tsnapReadOnly();
+    return 0;
+}
+
+
+void __tsnapClear(tmap* map) {
+    __tsnapReadOnly();
+}
+
+
+// Release the snapshot, from 'tfree'
+void __tsnapRelease(tmap* snapshot) {
+    tsnap* snap = (tsnap*)snapshot->__engineData;
+    tmap* map = snap->map;
+
+    __tSyncWait(map);
+    if(snap->previous != NULL) {
+        snap->previous->next = snap->next;
+    } else {
+        map->__snap->first = snap->next;
+    }
+    if(snap->next != NULL) {
+        snap->next->previous = snap->previous;
+    }
+    __tsnapCollect(map);
+    if(map->__snap->first == NULL) {
+        map->__cow = 0;
+    }
+    __tSyncPost(map);
+
+    MAPFREE(map, snap, sizeof(tsnap));
+    snapshot->__engineData = NULL;
+}
+
+
+const tmapops __tsnapOps = {
+    .get = __ttreeGet,
+    .insert = __tsnapInsert,
+    .remove = __tsnapRemove,
+    .clear = __tsnapClear,
+    .reserve = __ttreeReserve,
+    .destroy = __tsnapRelease,
+    .seek = __ttreeSeek,
+    .range = __ttreeRange
+};
+
+
+tmap* tsnapshot(tmap* map) {
+    tmap_config config;
+    tmap* snapshot;
+    tsnap* snap;
+
+    if(map->__ops != &__ttreeOps || map->__multitask == MULTI_THREAD_RCU || map->__lru != NULL || map->__ttl != NULL) {
+        return NULL;
+    }
+    if(!__troom(map, NULL, 1)) {
+        return NULL;
+    }
+
+    // Readers of a snapshot need no lock, and it never allocates nodes
+    memset(&config, 0, sizeof(config));
+    config.cmp = map->__cmp;
+    config.keyKind = map->__keyKind;
+    config.keySize = map->__keySize;
+    config.multitask = SINGLE_THREADED;
+    config.alloc = map->__alloc;
+    config.free = map->__free;
+    config.allocCtx = map->__allocCtx;
+    config.blockSize = 1;
+    snapshot = tinit_ex(&config);
+    snap = (tsnap*)MAPALLOC(map, sizeof(tsnap));
+    snap->map = map;
+    snap->previous = NULL;
+
+    __tSyncWait(map);
+    if(map->__snap == NULL) {
+        map->__snap = (tsnapstate*)MAPALLOC(map, sizeof(tsnapstate));
+        memset(map->__snap, 0, sizeof(tsnapstate));
+    }
+    snap->gen = map->__gen;
+    snap->next = map->__snap->first;
+    if(snap->next != NULL) {
+        snap->next->previous = snap;
+    }
+    map->__snap->first = snap;
+    snapshot->__root = map->__root;
+    // Nodes of the tree become read only
+    __tnewGeneration(map);
+    map->__cow = 1;
+    __tSyncPost(map);
+
+    snapshot->__ops = &__tsnapOps;
+    snapshot->__engineData = snap;
+    return snapshot;
+}
@@ -0,0 +1,123 @@
+/*********************************************************************************
+MIT License
+
+Copyright (c) 2019 Mathieu Comeau
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************/
+
+/*
+Map statistics, see 'tstats'.
+
+The shape of the map is read when asked for: keys are counted as nodes
+get and give them back, blocks and tree levels are walked. Engines tell
+the bytes of their index, the hash table or inner nodes.
+
+Operations of TMAP_STATS maps are counted as they end, with the key
+comparisons they made. Comparisons are counted by the thread, in
+'__tcompares', the operation adds what it made to the map's counters.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tmap.h"
+#include "tmapint.h"
+
+
+struct topstats {
+    unsigned long ops[TMAP_NB_OPS];
+    unsigned long compares[TMAP_NB_OPS];
+};
+
+
+__thread unsigned long __tcompares = 0;
+
+
+void __tstatsInit(tmap* map) {
+    topstats* stats = (topstats*)MAPALLOC(map, sizeof(topstats));
+
+    memset(stats, 0, sizeof(topstats));
+    map->__opStats = stats;
+}
+
+
+void __tstatsDestroy(tmap* map) {
+    MAPFREE(map, map->__opStats, sizeof(topstats));
+    map->__opStats = NULL;
+}
+
+
+// 'n' operations 'op' ended, the thread had made 'compares' comparisons
+// before them
+void __tstatsAdd(tmap* map, const int op, const size_t n, const unsigned long compares) {
+    __atomic_add_fetch(&map->__opStats->ops[op], n, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&map->__opStats->compares[op], __tcompares - compares, __ATOMIC_RELAXED);
+}
+
+
+void tstats(tmap* map, tmap_stats* stats) {
+    tnodeblock* nodeBlock;
+    size_t depths = 0;
+    int op;
+
+    memset(stats, 0, sizeof(tmap_stats));
+
+    // Read only: lookup caches and RCU readers are left alone
+    __tSyncReadWait(map);
+
+    stats->count = map->__count;
+    for(nodeBlock = map->__firstNodeBlock; nodeBlock != NULL; nodeBlock = nodeBlock->__next) {
+        ++stats->blocks;
+    }
+    stats->bytes = stats->blocks * __nodeBlockBytes(map) + __tarenaBytes(map);
+    if(map->__ops->bytes != NULL) {
+        stats->bytes += map->__ops->bytes(map);
+    }
+    if(map->__bloom != NULL) {
+        stats->bytes += __tbloomBytes(map);
+    }
+    if(map->__ttl != NULL) {
+        stats->bytes += __tttlBytes(map);
+    }
+    stats->freeSlots = map->__nbFreeNodes;
+    stats->wastedBytes = stats->freeSlots * (sizeof(tnode) + __tnodeSideBytes(map));
+
+    if(map->__ops == &__ttreeOps) {
+        stats->height = map->__root != NULL ? map->__root->__height : 0;
+        depths = __ttreeDepths(map->__root);
+    } else if(map->__ops == &__tbtreeOps) {
+        // Keys are all in leaves
+        stats->height = __tbtreeHeight(map);
+        depths = stats->count * stats->height;
+    }
+    if(stats->count > 0) {
+        stats->averageDepth = (double)depths / stats->count;
+    }
+
+    if(map->__opStats != NULL) {
+        for(op=0; op<TMAP_NB_OPS; ++op) {
+            stats->ops[op] = __atomic_load_n(&map->__opStats->ops[op], __ATOMIC_RELAXED);
+            stats->compares[op] = __atomic_load_n(&map->__opStats->compares[op], __ATOMIC_RELAXED);
+        }
+    }
+
+    __tSyncReadPost(map);
+}
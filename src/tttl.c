@@ -0,0 +1,222 @@
+/*********************************************************************************
+MIT License
+
+Copyright (c) 2019 Mathieu Comeau
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*********************************************************************************/
+
+/*
+Keys expiring after a time to live, TMAP_TTL.
+
+A node's deadline is kept in its block, after the nodes, along with its
+position in a binary heap of the nodes that have one. The heap top is the
+next key to expire: sweeping removes keys from the top while they are
+expired, a given number at most, so that no operation pays for more.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "tmap.h"
+#include "tmapint.h"
+
+
+// Heap entry, the deadline is copied here to compare without
+// going to the node
+typedef struct tttlheap {
+    uint64_t deadline;
+    tnode* node;
+} tttlheap;
+
+
+struct tttl {
+    tttlheap* heap;
+    size_t count;
+    size_t capacity;
+};
+
+
+// Milliseconds on a clock that doesn't go back
+uint64_t __tttlNow(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+static inline tttlentry* __tttlEntry(tmap* map, tnode* node) {
+    return (tttlentry*)__tnodeSide(map, node, map->__lru != NULL ? sizeof(tlrulink) : 0, sizeof(tttlentry));
+}
+
+
+void __tttlInit(tmap* map) {
+    tttl* ttl = (tttl*)MAPALLOC(map, sizeof(tttl));
+
+    ttl->heap = NULL;
+    ttl->count = 0;
+    ttl->capacity = 0;
+    map->__ttl = ttl;
+}
+
+
+size_t __tttlBytes(tmap* map) {
+    return sizeof(tttl) + map->__ttl->capacity*sizeof(tttlheap);
+}
+
+
+void __tttlDestroy(tmap* map) {
+    tttl* ttl = map->__ttl;
+
+    if(ttl->heap != NULL) {
+        MAPFREE(map, ttl->heap, ttl->capacity*sizeof(tttlheap));
+    }
+    MAPFREE(map, ttl, sizeof(tttl));
+    map->__ttl = NULL;
+}
+
+
+// Node blocks were reset
+void __tttlReset(tmap* map) {
+    map->__ttl->count = 0;
+}
+
+
+// Heap entry 'i' set, and its node told where it is
+static inline void __tttlPlace(tmap* map, size_t i, tttlheap entry) {
+    map->__ttl->heap[i] = entry;
+    __tttlEntry(map, entry.node)->index = i + 1;
+}
+
+
+void __tttlUp(tmap* map, size_t i) {
+    tttlheap* heap = map->__ttl->heap;
+    tttlheap entry = heap[i];
+
+    while(i > 0 && heap[(i-1)/2].deadline > entry.deadline) {
+        __tttlPlace(map, i, heap[(i-1)/2]);
+        i = (i-1)/2;
+    }
+    __tttlPlace(map, i, entry);
+}
+
+
+void __tttlDown(tmap* map, size_t i) {
+    tttl* ttl = map->__ttl;
+    tttlheap entry = ttl->heap[i];
+    size_t child;
+
+    while((child = 2*i + 1) < ttl->count) {
+        if(child + 1 < ttl->count && ttl->heap[child+1].deadline < ttl->heap[child].deadline) {
+            ++child;
+        }
+        if(ttl->heap[child].deadline >= entry.deadline) {
+            break;
+        }
+        __tttlPlace(map, i, ttl->heap[child]);
+        i = child;
+    }
+    __tttlPlace(map, i, entry);
+}
+
+
+// New node, doesn't expire
+void __tttlAdd(tmap* map, tnode* node) {
+    tttlentry* entry = __tttlEntry(map, node);
+
+    entry->deadline = 0;
+    entry->index = 0;
+}
+
+
+// Node released, out of the heap if it was in
+void __tttlRemove(tmap* map, tnode* node) {
+    tttl* ttl = map->__ttl;
+    tttlentry* entry = __tttlEntry(map, node);
+    size_t i = entry->index;
+
+    if(i == 0) {
+        return;
+    }
+    entry->index = 0;
+    entry->deadline = 0;
+    if(--i == --ttl->count) {
+        return;
+    }
+    // Last entry takes its place, and goes wherever it belongs
+    ttl->heap[i] = ttl->heap[ttl->count];
+    if(i > 0 && ttl->heap[(i-1)/2].deadline > ttl->heap[i].deadline) {
+        __tttlUp(map, i);
+    } else {
+        __tttlDown(map, i);
+    }
+}
+
+
+// Key of 'node' expires 'ms' milliseconds from now, never if 0
+void __tttlSet(tmap* map, tnode* node, const uint64_t ms) {
+    tttl* ttl = map->__ttl;
+    tttlentry* entry = __tttlEntry(map, node);
+    tttlheap* heap;
+
+    __tttlRemove(map, node);
+    if(ms == 0) {
+        return;
+    }
+    if(ttl->count == ttl->capacity) {
+        heap = MAPALLOC(map, 2*(ttl->capacity + 32)*sizeof(tttlheap));
+        if(ttl->heap != NULL) {
+            memcpy(heap, ttl->heap, ttl->count*sizeof(tttlheap));
+            MAPFREE(map, ttl->heap, ttl->capacity*sizeof(tttlheap));
+        }
+        ttl->heap = heap;
+        ttl->capacity = 2*(ttl->capacity + 32);
+    }
+    entry->deadline = __tttlNow() + ms;
+    ttl->heap[ttl->count].deadline = entry->deadline;
+    ttl->heap[ttl->count].node = node;
+    __tttlUp(map, ttl->count++);
+}
+
+
+int __tttlExpired(tmap* map, tnode* node) {
+    uint64_t deadline = __tttlEntry(map, node)->deadline;
+
+    return deadline != 0 && deadline <= __tttlNow();
+}
+
+
+// Remove up to 'budget' expired keys, soonest expired first. Map is locked.
+size_t __tttlSweep(tmap* map, size_t budget) {
+    tttl* ttl = map->__ttl;
+    size_t count = 0;
+    uint64_t now;
+
+    if(ttl->count == 0) {
+        return 0;
+    }
+    now = __tttlNow();
+    while(count < budget && ttl->count > 0 && ttl->heap[0].deadline <= now) {
+        map->__ops->remove(map, ttl->heap[0].node->key);
+        ++count;
+    }
+    return count;
+}
@@ -27,4 +27,10 @@ SOFTWARE.
 
 void multithreadTest(const int nbThreads, const int nbElemPerProc, const int singleThreadedMode);
 
+void multithreadShardedTest(const int nbThreads, const int nbElemPerProc, const int nbShards);
+
+void multiprocessTest(const int nbProcs, const int nbElemPerProc);
+
+void multithreadReadTest(const int nbThreads, const int nbElements, const int multitask, const int flags);
+
 #endif
@@ -23,11 +23,13 @@ SOFTWARE.
 *********************************************************************************/
 
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <stdint.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
@@ -53,6 +55,18 @@ compare(const void* pa, const void* pb)
     return strcmp( (char*)(((tnode*)pa)->key), (char*)(((tnode*)pb)->key) );
 }
 
+// For hash indexed maps of string keys (FNV-1a)
+static uint64_t
+hash(const void* key)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for(const char* c = key; *c != 0; ++c) {
+        h ^= (unsigned char)*c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
 // This is a sample action function to walk/print all key/value elements
 // for a map of string to string
 static void
@@ -77,10 +91,10 @@ action(const void *nodep, VISIT which, int depth)
 }
 
 
-// Function to print the whole map and an example usage of "twalk"
+// Function to print the whole map and an example usage of "ttwalk"
 void printMap(tmap* map) {
     printf("   map:\n");
-    twalk(troot(map), action);
+    ttwalk(ttreeroot(map), action);
 }
 
 
@@ -113,7 +127,8 @@ int check(tmap* map, char* key, char* expected) {
 
 void mapPerformanceTest(const int nbElements,
                         const int mapMultiTaskSupport,
-                        const int customAllocator) {
+                        const int customAllocator,
+                        const int hashIndexed) {
     tallocator* allocator = NULL;
     if(customAllocator) {
         allocator = malloc(sizeof(tallocator));
@@ -124,7 +139,12 @@ void mapPerformanceTest(const int nbElements,
         tconf(allocator);
     }
 
-    tmap* map = tinit(compare, TMAP_ALLOW_OVERWRITE, mapMultiTaskSupport);
+    tmap* map;
+    if(hashIndexed) {
+        map = tinit_hash(hash, compare, TMAP_ALLOW_OVERWRITE, mapMultiTaskSupport);
+    } else {
+        map = tinit(compare, TMAP_ALLOW_OVERWRITE, mapMultiTaskSupport);
+    }
 
     // Allocating a big chunk and managing sub pointers manually to avoid
     // hitting ENOMEM (too many mappings for process).
@@ -310,139 +330,2441 @@ void basicAccessorTest(const int mapMultiTaskSupport) {
 }
 
 
-void memleakTest(const int nbElements) {
+// Counter increment for tcompute, values are stored as integers
+static void*
+increment(const void* key, void* value, void* ctx)
+{
+    return (void*)((intptr_t)value + 1);
+}
+
+
+// Removes the key when the counter reaches the limit given in ctx
+static void*
+decrementOrRemove(const void* key, void* value, void* ctx)
+{
+    if((intptr_t)value <= *(int*)ctx) {
+        return NULL;
+    }
+    return (void*)((intptr_t)value - 1);
+}
+
+
+void upsertTest(const int mapMultiTaskSupport) {
     tmap* map;
-    map = tinit(compare, TMAP_ALLOW_OVERWRITE, SINGLE_THREADED);
+    int errors = 0;
+    int limit = 1;
+    void* v;
 
-    char** buf;
-    buf = (char**)malloc(nbElements*sizeof(char*)+MAX_KEY_SIZE*nbElements);
-    if(buf == NULL) {
-        fprintf(stderr, "memleakTest: Allocation failed: %s\n", strerror(errno));
+    printf("---------------------------------------------------------\n");
+    printf("Test tput, tinsert_if_absent and tcompute\n");
+    map = tinit(compare, TMAP_ALLOW_OVERWRITE, mapMultiTaskSupport);
+
+    v = tput(map, "keyA", "first");
+    errors += (v != NULL);
+    v = tput(map, "keyA", "second");
+    errors += (v == NULL || strcmp(v, "first"));
+    errors += check(map, "keyA", "second");
+
+    v = tinsert_if_absent(map, "keyA", "third");
+    errors += (v == NULL || strcmp(v, "second"));
+    errors += check(map, "keyA", "second");
+    v = tinsert_if_absent(map, "keyB", "first");
+    errors += (v != NULL);
+    errors += check(map, "keyB", "first");
+
+    for(int i=0; i<3; i++) {
+        tcompute(map, "counter", increment, NULL);
+    }
+    v = tget(map, "counter");
+    errors += ((intptr_t)v != 3);
+
+    while(tcompute(map, "counter", decrementOrRemove, &limit) != NULL);
+    errors += check(map, "counter", NULL);
+    v = tcompute(map, "never", decrementOrRemove, &limit);
+    errors += (v != NULL);
+    errors += check(map, "never", NULL);
+    printMap(map);
+    tfree(map);
+
+    printf("Test tput doesn't overwrite with TMAP_NO_OVERWRITE\n");
+    map = tinit(compare, TMAP_NO_OVERWRITE, mapMultiTaskSupport);
+    tput(map, "keyA", "untouched");
+    v = tput(map, "keyA", "Key overwritten");
+    errors += (v == NULL || strcmp(v, "untouched"));
+    errors += check(map, "keyA", "untouched");
+    tfree(map);
+
+    if(errors == 0) {
+        fprintf(stderr, "PASS!\n");
+    } else {
+        fprintf(stderr, "FAIL!\n");
+    }
+}
+
+
+static long liveBytes = 0;
+
+static void* countingAlloc(size_t nbBytes) {
+    liveBytes += nbBytes;
+    return malloc(nbBytes);
+}
+
+static void countingFree(void* ptr, size_t nbBytes) {
+    liveBytes -= nbBytes;
+    free(ptr);
+}
+
+
+// Delete and add random keys many times over: memory held by the map
+// must not grow since freed node slots are reused.
+void slotReuseTest(const int nbElements) {
+    tallocator allocator = {countingAlloc, countingFree};
+    tmap* map;
+    char (*keys)[MAX_KEY_SIZE];
+    char* present;
+    long filledBytes, maxBytes;
+    int errors = 0;
+    int i, k;
+
+    printf("---------------------------------------------------------\n");
+    printf("Test freed node slots reuse\n");
+
+    keys = malloc(2 * nbElements * MAX_KEY_SIZE);
+    present = calloc(2 * nbElements, 1);
+    if(keys == NULL || present == NULL) {
+        fprintf(stderr, "slotReuseTest: Allocation failed: %s\n", strerror(errno));
         exit(-1);
     }
+    for(i=0; i<2*nbElements; i++) {
+        snprintf(keys[i], MAX_KEY_SIZE, "%08d", i);
+    }
 
-    int baseOffset = nbElements*sizeof(char*);
-    for(int i=0; i<nbElements; i++) {
-        buf[i] = (char*)buf + baseOffset + i * MAX_KEY_SIZE;
-        snprintf(buf[i], MAX_KEY_SIZE, "%06d", i*2);
+    tconf(&allocator);
+    map = tinit(compare, TMAP_ALLOW_OVERWRITE, SINGLE_THREADED);
+    for(i=0; i<nbElements; i++) {
+        tadd(map, keys[i], keys[i]);
+        present[i] = 1;
+    }
+    filledBytes = maxBytes = liveBytes;
+
+    srand(1);
+    for(i=0; i<10*nbElements; i++) {
+        do {
+            k = rand() % (2*nbElements);
+        } while(!present[k]);
+        tdel(map, keys[k]);
+        present[k] = 0;
+
+        do {
+            k = rand() % (2*nbElements);
+        } while(present[k]);
+        tadd(map, keys[k], keys[k]);
+        present[k] = 1;
+
+        if(liveBytes > maxBytes) {
+            maxBytes = liveBytes;
+        }
     }
 
-    int cycle = 1;
-    while(1) {
-        printf("Cycle: %d Adding elements...\n", cycle);
-        for(int i=0; i<nbElements; i++) {
-            tadd(map, buf[i], buf[i]);
+    for(i=0; i<2*nbElements; i++) {
+        errors += (tget(map, keys[i]) != (present[i] ? keys[i] : NULL));
+    }
+    printf("   Bytes after first fill: %ld, max bytes: %ld\n", filledBytes, maxBytes);
+    errors += (maxBytes != filledBytes);
+
+    for(i=0; i<2*nbElements; i++) {
+        tdel(map, keys[i]);
+    }
+    tfree(map);
+    errors += (liveBytes != 0);
+
+    free(present);
+    free(keys);
+
+    if(errors == 0) {
+        fprintf(stderr, "PASS!\n");
+    } else {
+        fprintf(stderr, "FAIL!\n");
+    }
+}
+
+
+// Fill, clear and fill again tree and hash maps: tclear keeps the
+// memory for the next fill and tfree gives all of it back.
+void clearTest(const int nbElements) {
+    tallocator allocator = {countingAlloc, countingFree};
+    tmap* map;
+    char (*keys)[MAX_KEY_SIZE];
+    long filledBytes;
+    int errors = 0;
+    int engine, cycle, i;
+
+    printf("---------------------------------------------------------\n");
+    printf("Test tclear and tfree\n");
+
+    keys = malloc(nbElements * MAX_KEY_SIZE);
+    if(keys == NULL) {
+        fprintf(stderr, "clearTest: Allocation failed: %s\n", strerror(errno));
+        exit(-1);
+    }
+    for(i=0; i<nbElements; i++) {
+        snprintf(keys[i], MAX_KEY_SIZE, "%08d", i);
+    }
+
+    tconf(&allocator);
+    for(engine=0; engine<3; engine++) {
+        if(engine == 0) {
+            map = tinit(compare, TMAP_ALLOW_OVERWRITE, SINGLE_THREADED);
+        } else if(engine == 1) {
+            map = tinit(compare, TMAP_ALLOW_OVERWRITE, MULTI_THREAD_RCU);
+        } else {
+            map = tinit_hash(hash, compare, TMAP_ALLOW_OVERWRITE, SINGLE_THREADED);
         }
-        printf("Cycle: %d Deleting elements...\n", cycle);
-        for(int i=0; i<nbElements; i++) {
-            tdel(map, buf[i]);
+
+        filledBytes = 0;
+        for(cycle=0; cycle<3; cycle++) {
+            for(i=0; i<nbElements; i++) {
+                tadd(map, keys[i], keys[i]);
+            }
+            for(i=0; i<nbElements; i++) {
+                errors += (tget(map, keys[i]) != keys[i]);
+            }
+            if(cycle == 0) {
+                filledBytes = liveBytes;
+            }
+            errors += (liveBytes != filledBytes);
+
+            tclear(map);
+            errors += (tget(map, keys[0]) != NULL);
+            errors += (ttreeroot(map) != NULL);
         }
-        cycle++;
+        printf("   Engine %d: bytes when filled: %ld\n", engine, filledBytes);
+
+        // Keys are left in the map
+        for(i=0; i<nbElements/2; i++) {
+            tadd(map, keys[i], keys[i]);
+        }
+        tfree(map);
+        errors += (liveBytes != 0);
+    }
+
+    free(keys);
+
+    if(errors == 0) {
+        fprintf(stderr, "PASS!\n");
+    } else {
+        fprintf(stderr, "FAIL!\n");
     }
 }
 
 
-void printHelp(char* argv[]) {
-    printf("\
-Usage: %s [-h] [-t <b|o|p|pa|mt|a>] [-e <nbElements>] [-p <parallel>] [-s] [-i <iterations>\n\
-    -t:\n\
-        b:   basic map accessor test\n\
-        o:   key/value overwrite test\n\
-        p:   performance test\n\
-        pa:  performance test with client's memory allocator\n\
-        mt:  multi threaded test\n\
-        ml:  memory leak test\n\
-        a:   run all tests except the infinite loop memory leak one\n\
-    -e:\n\
-        Performance test: total number of elements to create\n\
-        Multi[thread|proc] test: number of elements to create == (int)nbElements/parallel\n\
-    -p:\n\
-        Number of tasks (threads or processes) to create\n\
-    -s:\n\
-        Force multithreaded/multiprocess tests to run map with single thread support to cause errors\n\
-    -i:\n\
-        Iterate 'iterations' number of times over the requested test(s)\n\
-\n\
-Note:\n\
-- You should run the perf test with %s -t p -e nbElements > /dev/null\n\
--s: The test is still run in multithreaded fashion, but the map\n\
-    object is configured to work as in single threaded mode, which should cause errors/crash.\n", argv[0], argv[0]);
+static int maxDepth;
+static int nbVisited;
+
+static void depthAction(const void* nodep, VISIT which, int depth) {
+    if(which == postorder || which == leaf) {
+        nbVisited++;
+        if(depth > maxDepth) {
+            maxDepth = depth;
+        }
+    }
 }
 
 
-int main(int argc, char* argv[]) {
-    int c;
-    char test[4];
-    unsigned int nbElements = 4000;
-    int nbParallelTasks = 10;
-    int singleThreadedMode = 0;
-    int mapMultiTaskMode = SINGLE_THREADED;
-    int iterations = 1;
+// Build maps from sorted and unsorted arrays, the tree must hold every
+// distinct key once and be as low as a complete binary tree.
+void buildTest(const int nbElements) {
+    tmap* map;
+    char (*keys)[MAX_KEY_SIZE];
+    void** sorted;
+    void** shuffled;
+    void* swap;
+    int errors = 0;
+    int minHeight = 0;
+    int i, j;
 
-    if(argc == 1) {
-        printHelp(argv);
-        exit(0);
+    printf("---------------------------------------------------------\n");
+    printf("Test tbuild\n");
+
+    keys = malloc(nbElements * MAX_KEY_SIZE);
+    sorted = malloc(nbElements * sizeof(void*));
+    shuffled = malloc(nbElements * sizeof(void*));
+    if(keys == NULL || sorted == NULL || shuffled == NULL) {
+        fprintf(stderr, "buildTest: Allocation failed: %s\n", strerror(errno));
+        exit(-1);
+    }
+    for(i=0; i<nbElements; i++) {
+        snprintf(keys[i], MAX_KEY_SIZE, "%08d", i);
+        sorted[i] = keys[i];
+        shuffled[i] = keys[i];
+    }
+    srand(1);
+    for(i=nbElements-1; i>0; i--) {
+        j = rand() % (i+1);
+        swap = shuffled[i];
+        shuffled[i] = shuffled[j];
+        shuffled[j] = swap;
+    }
+    while((1 << minHeight) <= nbElements) {
+        minHeight++;
     }
 
-    while ((c = getopt (argc, argv, "ht:e:p:si:m")) != -1) {
-        switch (c)
-        {
-            case 't':
-                strncpy(test, optarg, 4);
-                break;
-            case 'h':
-                printHelp(argv);
-                exit(0);
-                break;
-            case 'e':
-                nbElements = atoi(optarg);
-                break;
-            case 'i':
-                iterations = atoi(optarg);
-                break;
-            case 'p':
-                nbParallelTasks = atoi(optarg);
-                break;
-            case 's':
-                singleThreadedMode = 1;
-                break;
-            default:
-                fprintf(stderr, "Bad argument: %c\n", c);
-        }
+    map = tinit(compare, TMAP_ALLOW_OVERWRITE, SINGLE_THREADED);
+    tadd(map, "untouched", "untouched");
+    void* unsorted[] = {"b", "a"};
+    errors += (tbuild(map, unsorted, unsorted, 2, TMAP_BUILD_SORTED) != -1);
+    errors += check(map, "untouched", "untouched");
+
+    clock_t tClock = clock();
+    errors += (tbuild(map, sorted, sorted, nbElements, TMAP_BUILD_SORTED) != 0);
+    tClock = clock() - tClock;
+    fprintf(stderr, "[%-5d] Sorted build time: %-3.2f seconds\n", nbElements, (float)tClock/CLOCKS_PER_SEC);
+    errors += (tget(map, "untouched") != NULL);
+
+    for(i=0; i<nbElements; i++) {
+        errors += (tget(map, keys[i]) != keys[i]);
     }
+    maxDepth = nbVisited = 0;
+    ttwalk(ttreeroot(map), depthAction);
+    printf("   %d keys, tree height: %d, minimum: %d\n", nbVisited, maxDepth + 1, minHeight);
+    errors += (nbVisited != nbElements || maxDepth + 1 != minHeight);
 
-    printf("===============================\n");
-    printf("Run parameters:\n");
-    printf("   %-25s%d\n", "Number of elements:", nbElements);
-    printf("   %-25s%d\n", "Number of tasks:", nbParallelTasks);
-    printf("   %-25s%d\n", "Single threaded mode:", singleThreadedMode);
-    printf("===============================\n\n");
+    tClock = clock();
+    errors += (tbuild(map, shuffled, sorted, nbElements, TMAP_BUILD_SORT) != 0);
+    tClock = clock() - tClock;
+    fprintf(stderr, "[%-5d] Unsorted build time: %-3.2f seconds\n", nbElements, (float)tClock/CLOCKS_PER_SEC);
+    // Values follow their keys through the sort
+    for(i=0; i<nbElements; i++) {
+        errors += (tget(map, shuffled[i]) != sorted[i]);
+    }
+    maxDepth = nbVisited = 0;
+    ttwalk(ttreeroot(map), depthAction);
+    errors += (nbVisited != nbElements || maxDepth + 1 != minHeight);
+
+    // Equal keys: the last value is kept
+    void* dupKeys[] = {"a", "b", "b", "b", "c"};
+    void* dupValues[] = {"1", "2", "3", "4", "5"};
+    errors += (tbuild(map, dupKeys, dupValues, 5, TMAP_BUILD_SORTED) != 0);
+    errors += check(map, "b", "4");
+    errors += check(map, "c", "5");
+    printMap(map);
+    // Too many keys for the sort buffer: the map is left as it is
+    errno = 0;
+    errors += (tbuild(map, dupKeys, dupValues, SIZE_MAX / 2, TMAP_BUILD_SORT) != -1);
+    errors += (errno != EINVAL);
+    errors += check(map, "c", "5");
+    errors += (tbuild(map, NULL, NULL, 0, TMAP_BUILD_SORT) != 0);
+    errors += (ttreeroot(map) != NULL);
+    tfree(map);
 
-    for(int i=1;i<=iterations;i++) {
-        fprintf(stderr, "              ++++++++++++++++\n");
-        fprintf(stderr, "               ITERATION %d\n", i);
-        fprintf(stderr, "              ++++++++++++++++\n\n");
+    map = tinit_hash(hash, compare, TMAP_ALLOW_OVERWRITE, SINGLE_THREADED);
+    errors += (tbuild(map, shuffled, shuffled, nbElements, TMAP_BUILD_SORTED) != 0);
+    for(i=0; i<nbElements; i++) {
+        errors += (tget(map, keys[i]) != keys[i]);
+    }
+    tfree(map);
 
-        if(!strcmp(test, "b") || !strcmp(test, "a")) {
-            fprintf(stderr, "############## basicAccessorTest ##############\n");
-            basicAccessorTest(mapMultiTaskMode);
+    free(shuffled);
+    free(sorted);
+    free(keys);
+
+    if(errors == 0) {
+        fprintf(stderr, "PASS!\n");
+    } else {
+        fprintf(stderr, "FAIL!\n");
+    }
+}
+
+
+typedef struct RangeCtx {
+    char* previous;
+    int limit;
+    int errors;
+} RangeCtx;
+
+static int rangeAction(const void* key, void* value, void* ctx) {
+    RangeCtx* range = (RangeCtx*)ctx;
+
+    range->errors += (key != value);
+    if(range->previous != NULL && strcmp(range->previous, key) >= 0) {
+        range->errors++;
+    }
+    range->previous = (char*)key;
+    return --range->limit == 0;
+}
+
+
+// Walk a map of even keys with cursors and ranges
+void cursorTest(const int nbElements) {
+    tmap* map;
+    tcursor cursor;
+    RangeCtx range;
+    char (*keys)[MAX_KEY_SIZE];
+    char key[MAX_KEY_SIZE];
+    int errors = 0;
+    int nbKeys = nbElements < 100 ? 100 : nbElements;
+    int i;
+
+    printf("---------------------------------------------------------\n");
+    printf("Test cursors and ranges\n");
+
+    keys = malloc(nbKeys * MAX_KEY_SIZE);
+    if(keys == NULL) {
+        fprintf(stderr, "cursorTest: Allocation failed: %s\n", strerror(errno));
+        exit(-1);
+    }
+    map = tinit(compare, TMAP_ALLOW_OVERWRITE, SINGLE_THREADED);
+    errors += tfirst(map, &cursor);
+    for(i=0; i<nbKeys; i++) {
+        snprintf(keys[i], MAX_KEY_SIZE, "%08d", 2*i);
+        tadd(map, keys[i], keys[i]);
+    }
+
+    errors += (!tfirst(map, &cursor) || cursor.key != keys[0]);
+    for(i=1; tnext(map, &cursor); i++) {
+        errors += (i >= nbKeys || cursor.key != keys[i] || cursor.value != keys[i]);
+    }
+    errors += (i != nbKeys || cursor.key != keys[nbKeys-1]);
+
+    errors += (!tlast(map, &cursor) || cursor.key != keys[nbKeys-1]);
+    for(i=nbKeys-2; tprev(map, &cursor); i--) {
+        errors += (i < 0 || cursor.key != keys[i]);
+    }
+    errors += (i != -1);
+
+    // Odd keys are not in the map
+    snprintf(key, MAX_KEY_SIZE, "%08d", 21);
+    errors += (!tlower_bound(map, key, &cursor) || cursor.key != keys[11]);
+    errors += (!tupper_bound(map, key, &cursor) || cursor.key != keys[11]);
+    errors += (!tlower_bound(map, keys[10], &cursor) || cursor.key != keys[10]);
+    errors += (!tupper_bound(map, keys[10], &cursor) || cursor.key != keys[11]);
+    errors += tupper_bound(map, keys[nbKeys-1], &cursor);
+    errors += (cursor.key != keys[11]);
+
+    // Moving on from a deleted key
+    tlower_bound(map, keys[20], &cursor);
+    tdel(map, keys[20]);
+    errors += (!tnext(map, &cursor) || cursor.key != keys[21]);
+    errors += (!tprev(map, &cursor) || cursor.key != keys[19]);
+    tadd(map, keys[20], keys[20]);
+
+    memset(&range, 0, sizeof(range));
+    errors += (trange(map, NULL, NULL, rangeAction, &range) != nbKeys);
+    memset(&range, 0, sizeof(range));
+    errors += (trange(map, key, keys[30], rangeAction, &range) != 19);
+    errors += (range.previous != keys[29]);
+    memset(&range, 0, sizeof(range));
+    range.limit = 5;
+    errors += (trange(map, keys[40], NULL, rangeAction, &range) != 5);
+    errors += (range.previous != keys[44]);
+    errors += range.errors;
+    tfree(map);
+
+    map = tinit_hash(hash, compare, TMAP_ALLOW_OVERWRITE, SINGLE_THREADED);
+    tadd(map, keys[0], keys[0]);
+    errors += tfirst(map, &cursor);
+    errors += (trange(map, NULL, NULL, rangeAction, &range) != 0);
+    tfree(map);
+
+    free(keys);
+
+    if(errors == 0) {
+        fprintf(stderr, "PASS!\n");
+    } else {
+        fprintf(stderr, "FAIL!\n");
+    }
+}
+
+
+// Check tget_batch against tget on present and missing keys, looked up
+// in random order, for each engine and lock free reader mode, and for
+// maps checking keys as they are found: bounded, TMAP_TTL and TMAP_BLOOM
+void batchTest(const int nbElements) {
+    tmap_config config;
+    tmap* map;
+    char (*keys)[MAX_KEY_SIZE];
+    void** lookups;
+    void** values;
+    int batchSizes[] = {0, 1, 7, 9, 128};
+    int errors = 0;
+    int mode, i, j, batch;
+
+    printf("---------------------------------------------------------\n");
+    printf("Test tget_batch\n");
+
+    keys = malloc(2 * nbElements * MAX_KEY_SIZE);
+    lookups = malloc(2 * nbElements * sizeof(void*));
+    values = malloc(2 * nbElements * sizeof(void*));
+    if(keys == NULL || lookups == NULL || values == NULL) {
+        fprintf(stderr, "batchTest: Allocation failed: %s\n", strerror(errno));
+        exit(-1);
+    }
+    srand(1);
+    for(i=0; i<2*nbElements; i++) {
+        snprintf(keys[i], MAX_KEY_SIZE, "%08d", i);
+        lookups[i] = keys[rand() % (2*nbElements)];
+    }
+
+    for(mode=0; mode<6; mode++) {
+        if(mode == 0) {
+            map = tinit(compare, TMAP_ALLOW_OVERWRITE, MULTI_THREAD_SAFE);
+        } else if(mode == 1) {
+            map = tinit(compare, TMAP_ALLOW_OVERWRITE, MULTI_THREAD_SEQLOCK);
+        } else if(mode == 2) {
+            map = tinit(compare, TMAP_ALLOW_OVERWRITE, MULTI_THREAD_RCU);
+        } else if(mode == 3) {
+            map = tinit_hash(hash, compare, TMAP_ALLOW_OVERWRITE, MULTI_THREAD_SAFE);
+        } else {
+            memset(&config, 0, sizeof(config));
+            config.keyKind = TMAP_KEY_STRING;
+            config.multitask = mode == 4 ? MULTI_THREAD_SAFE : MULTI_THREAD_RWLOCK;
+            config.capacity = mode == 4 ? nbElements : 0;
+            config.flags = mode == 4 ? 0 : TMAP_TTL | TMAP_BLOOM;
+            map = tinit_ex(&config);
+        }
+        // Only even keys are in the map
+        for(i=0; i<nbElements; i++) {
+            tadd(map, keys[2*i], keys[2*i]);
         }
 
-        // Signal handler works only the first time
-        if((iterations == 1) && (!strcmp(test, "o") || !strcmp(test, "a"))) {
-            fprintf(stderr, "############## overwriteTest ##############\n");
-            overwriteTest(mapMultiTaskMode);
+        for(batch=0; batch<5; batch++) {
+            for(i=0; i+batchSizes[batch]<=2*nbElements; i+=batchSizes[batch]+1) {
+                tget_batch(map, &lookups[i], values, batchSizes[batch]);
+                for(j=0; j<batchSizes[batch]; j++) {
+                    errors += (values[j] != tget(map, lookups[i+j]));
+                }
+            }
         }
 
-        if(!strcmp(test, "p") || !strcmp(test, "a")) {
-            fprintf(stderr, "############## mapPerformanceTest ##############\n");
-            mapPerformanceTest(nbElements, mapMultiTaskMode, 0);
+        clock_t tClock = clock();
+        for(i=0; i<2*nbElements; i++) {
+            values[i] = tget(map, lookups[i]);
+        }
+        tClock = clock() - tClock;
+        fprintf(stderr, "[%-5d] Mode %d access time:       %-3.2f seconds\n", 2*nbElements, mode, (float)tClock/CLOCKS_PER_SEC);
+
+        tClock = clock();
+        for(i=0; i<2*nbElements; i+=128) {
+            tget_batch(map, &lookups[i], &values[i], 2*nbElements-i < 128 ? 2*nbElements-i : 128);
+        }
+        tClock = clock() - tClock;
+        fprintf(stderr, "[%-5d] Mode %d batch access time: %-3.2f seconds\n", 2*nbElements, mode, (float)tClock/CLOCKS_PER_SEC);
+        for(i=0; i<2*nbElements; i++) {
+            errors += (values[i] != tget(map, lookups[i]));
+        }
+
+        tfree(map);
+    }
+
+    free(values);
+    free(lookups);
+    free(keys);
+
+    if(errors == 0) {
+        fprintf(stderr, "PASS!\n");
+    } else {
+        fprintf(stderr, "FAIL!\n");
+    }
+}
+
+
+typedef struct AllocCounter {
+    long bytes;
+    long calls;
+} AllocCounter;
+
+static void* ctxAlloc(void* ctx, size_t nbBytes) {
+    ((AllocCounter*)ctx)->bytes += nbBytes;
+    ((AllocCounter*)ctx)->calls++;
+    return malloc(nbBytes);
+}
+
+static void ctxFree(void* ctx, void* ptr, size_t nbBytes) {
+    ((AllocCounter*)ctx)->bytes -= nbBytes;
+    free(ptr);
+}
+
+
+// Memory aligned on 8 bytes only, as allocators may hand out
+static void* misalignedAlloc(void* ctx, size_t nbBytes) {
+    return (char*)ctxAlloc(ctx, nbBytes + 8) + 8;
+}
+
+static void misalignedFree(void* ctx, void* ptr, size_t nbBytes) {
+    ctxFree(ctx, (char*)ptr - 8, nbBytes + 8);
+}
+
+
+// Maps with their own allocator and block size: memory is accounted to
+// the right allocator, and nothing is allocated after treserve
+void configTest(const int nbElements) {
+    AllocCounter counters[3];
+    tmap_config config;
+    tmap_stats stats;
+    tmap* maps[3];
+    char (*keys)[MAX_KEY_SIZE];
+    long calls;
+    int errors = 0;
+    int m, i;
+
+    printf("---------------------------------------------------------\n");
+    printf("Test tinit_ex and treserve\n");
+
+    keys = malloc(nbElements * MAX_KEY_SIZE);
+    if(keys == NULL) {
+        fprintf(stderr, "configTest: Allocation failed: %s\n", strerror(errno));
+        exit(-1);
+    }
+    for(i=0; i<nbElements; i++) {
+        snprintf(keys[i], MAX_KEY_SIZE, "%08d", i);
+    }
+
+    memset(counters, 0, sizeof(counters));
+    for(m=0; m<3; m++) {
+        memset(&config, 0, sizeof(config));
+        config.cmp = compare;
+        config.multitask = MULTI_THREAD_SAFE;
+        config.alloc = ctxAlloc;
+        config.free = ctxFree;
+        config.allocCtx = &counters[m];
+        // A tiny map, a big one and a hash indexed one
+        config.blockSize = m == 0 ? 4 : 64*1024;
+        config.hash = m == 2 ? hash : NULL;
+        maps[m] = tinit_ex(&config);
+    }
+
+    // Tiny map holds a few keys in a few small blocks, where a default
+    // block alone is about 100KB
+    for(i=0; i<10; i++) {
+        tadd(maps[0], keys[i], keys[i]);
+    }
+    printf("   Tiny map bytes: %ld\n", counters[0].bytes);
+    errors += (counters[0].bytes > 4096);
+
+    for(m=1; m<3; m++) {
+        treserve(maps[m], nbElements);
+        calls = counters[m].calls;
+        for(i=0; i<nbElements; i++) {
+            tadd(maps[m], keys[i], keys[i]);
+        }
+        printf("   Map %d allocations while adding: %ld\n", m, counters[m].calls - calls);
+        errors += (counters[m].calls != calls);
+    }
+
+    for(m=0; m<3; m++) {
+        for(i=0; i<(m == 0 ? 10 : nbElements); i++) {
+            errors += (tget(maps[m], keys[i]) != keys[i]);
+        }
+        tfree(maps[m]);
+        errors += (counters[m].bytes != 0);
+    }
+
+    // Huge pages, whether explicit or transparent ones
+    memset(&config, 0, sizeof(config));
+    config.cmp = compare;
+    config.flags = TMAP_HUGE_PAGES;
+    maps[0] = tinit_ex(&config);
+    for(i=0; i<nbElements; i++) {
+        tadd(maps[0], keys[i], keys[i]);
+    }
+    for(i=0; i<nbElements; i+=2) {
+        tdel(maps[0], keys[i]);
+    }
+    for(i=0; i<nbElements; i++) {
+        errors += (tget(maps[0], keys[i]) != (i % 2 ? keys[i] : NULL));
+    }
+    // Node blocks fit in the huge pages they are sized for
+    tstats(maps[0], &stats);
+    errors += (stats.bytes > stats.blocks * 2*1024*1024);
+    tfree(maps[0]);
+
+    free(keys);
+
+    if(errors == 0) {
+        fprintf(stderr, "PASS!\n");
+    } else {
+        fprintf(stderr, "FAIL!\n");
+    }
+}
+
+
+static int compareU64(const void* pa, const void* pb) {
+    uint64_t a = *(uint64_t*)((tnode*)pa)->key;
+    uint64_t b = *(uint64_t*)((tnode*)pb)->key;
+
+    return a < b ? -1 : a > b;
+}
+
+
+// Integer keyed maps against maps of pointers to integers
+void u64Test(const int nbElements) {
+    tmap* map;
+    tmap* ptrMap;
+    tcursor cursor;
+    uint64_t* ids;
+    uint64_t previous;
+    int errors = 0;
+    int i;
+
+    printf("---------------------------------------------------------\n");
+    printf("Test 64 bit integer keys\n");
+
+    ids = malloc(nbElements * sizeof(uint64_t));
+    if(ids == NULL) {
+        fprintf(stderr, "u64Test: Allocation failed: %s\n", strerror(errno));
+        exit(-1);
+    }
+    // Spread over the whole range, 0 and UINT64_MAX included
+    for(i=0; i<nbElements; i++) {
+        ids[i] = (uint64_t)i * 0x9E3779B97F4A7C15ULL;
+    }
+    ids[nbElements-1] = UINT64_MAX;
+
+    map = tinit_u64(TMAP_ALLOW_OVERWRITE, SINGLE_THREADED);
+    ptrMap = tinit(compareU64, TMAP_ALLOW_OVERWRITE, SINGLE_THREADED);
+
+    clock_t tClock = clock();
+    for(i=0; i<nbElements; i++) {
+        tadd(map, TMAP_U64(ids[i]), &ids[i]);
+    }
+    tClock = clock() - tClock;
+    fprintf(stderr, "[%-5d] Integer keys init time:   %-3.2f seconds\n", nbElements, (float)tClock/CLOCKS_PER_SEC);
+    tClock = clock();
+    for(i=0; i<nbElements; i++) {
+        tadd(ptrMap, &ids[i], &ids[i]);
+    }
+    tClock = clock() - tClock;
+    fprintf(stderr, "[%-5d] Pointer keys init time:   %-3.2f seconds\n", nbElements, (float)tClock/CLOCKS_PER_SEC);
+
+    tClock = clock();
+    for(i=0; i<nbElements; i++) {
+        errors += (tget(map, TMAP_U64(ids[i])) != &ids[i]);
+    }
+    tClock = clock() - tClock;
+    fprintf(stderr, "[%-5d] Integer keys access time: %-3.2f seconds\n", nbElements, (float)tClock/CLOCKS_PER_SEC);
+    tClock = clock();
+    for(i=0; i<nbElements; i++) {
+        errors += (tget(ptrMap, &ids[i]) != &ids[i]);
+    }
+    tClock = clock() - tClock;
+    fprintf(stderr, "[%-5d] Pointer keys access time: %-3.2f seconds\n", nbElements, (float)tClock/CLOCKS_PER_SEC);
+
+    // Unsigned order
+    errors += (!tfirst(map, &cursor) || cursor.key != TMAP_U64(0));
+    previous = 0;
+    for(i=1; tnext(map, &cursor); i++) {
+        errors += ((uint64_t)(uintptr_t)cursor.key <= previous);
+        previous = (uint64_t)(uintptr_t)cursor.key;
+    }
+    errors += (i != nbElements || previous != UINT64_MAX);
+
+    errors += (tget(map, TMAP_U64(1)) != NULL);
+    tdel(map, TMAP_U64(0));
+    errors += (tget(map, TMAP_U64(0)) != NULL);
+    errors += (tget(map, TMAP_U64(UINT64_MAX)) != &ids[nbElements-1]);
+
+    tfree(ptrMap);
+    tfree(map);
+    free(ids);
+
+    if(errors == 0) {
+        fprintf(stderr, "PASS!\n");
+    } else {
+        fprintf(stderr, "FAIL!\n");
+    }
+}
+
+
+// Number of keys given more than once
+static int countDuplicates(tmap* map, char (*keys)[2*MAX_KEY_SIZE], const int nbKeys) {
+    int duplicates = 0;
+    int i;
+
+    for(i=0; i<nbKeys; i++) {
+        duplicates += (tget(map, keys[i]) != keys[i]);
+    }
+    return duplicates;
+}
+
+
+static int orderAction(const void* key, void* value, void* ctx) {
+    char** previous = (char**)ctx;
+
+    if(*previous != NULL && strcmp(*previous, key) >= 0) {
+        // Out of order
+        *previous = "~";
+        return 1;
+    }
+    *previous = (char*)key;
+    return 0;
+}
+
+
+// String keyed maps against maps with a strcmp compare function, on
+// keys shorter than, as long as and longer than the cached prefix
+void stringKeyTest(const int nbElements) {
+    tmap* map;
+    tmap* ptrMap;
+    char (*keys)[2*MAX_KEY_SIZE];
+    void** sorted;
+    char* previous = NULL;
+    int errors = 0;
+    int i;
+
+    printf("---------------------------------------------------------\n");
+    printf("Test string keys\n");
+
+    keys = malloc(nbElements * 2*MAX_KEY_SIZE);
+    sorted = malloc(nbElements * sizeof(void*));
+    if(keys == NULL || sorted == NULL) {
+        fprintf(stderr, "stringKeyTest: Allocation failed: %s\n", strerror(errno));
+        exit(-1);
+    }
+    srand(1);
+    for(i=0; i<nbElements; i++) {
+        switch(i % 4) {
+            case 0:
+                snprintf(keys[i], 2*MAX_KEY_SIZE, "%d", rand());
+                break;
+            case 1:
+                snprintf(keys[i], 2*MAX_KEY_SIZE, "x%x", i);
+                break;
+            case 2:
+                // Same 8 byte prefix
+                snprintf(keys[i], 2*MAX_KEY_SIZE, "prefix00%d", i);
+                break;
+            default:
+                snprintf(keys[i], 2*MAX_KEY_SIZE, "%08d", i);
+                break;
+        }
+    }
+    strcpy(keys[0], "");
+
+    map = tinit_str(TMAP_ALLOW_OVERWRITE, SINGLE_THREADED);
+    ptrMap = tinit(compare, TMAP_ALLOW_OVERWRITE, SINGLE_THREADED);
+    for(i=0; i<nbElements; i++) {
+        tadd(map, keys[i], keys[i]);
+        tadd(ptrMap, keys[i], keys[i]);
+    }
+
+    clock_t tClock = clock();
+    for(i=0; i<nbElements; i++) {
+        errors += (tget(map, keys[i]) != tget(map, keys[i]));
+        errors += (strcmp(tget(map, keys[i]), keys[i]) != 0);
+    }
+    tClock = clock() - tClock;
+    fprintf(stderr, "[%-5d] String keys access time:   %-3.2f seconds\n", nbElements, (float)tClock/CLOCKS_PER_SEC);
+    tClock = clock();
+    for(i=0; i<nbElements; i++) {
+        errors += (tget(ptrMap, keys[i]) != tget(ptrMap, keys[i]));
+        errors += (strcmp(tget(ptrMap, keys[i]), keys[i]) != 0);
+    }
+    tClock = clock() - tClock;
+    fprintf(stderr, "[%-5d] Compare function access time: %-3.2f seconds\n", nbElements, (float)tClock/CLOCKS_PER_SEC);
+
+    // Same keys, in strcmp order
+    errors += (trange(map, NULL, NULL, orderAction, &previous) != nbElements - countDuplicates(ptrMap, keys, nbElements));
+    errors += !strcmp(previous, "~");
+    errors += (tget(map, "prefix00") != NULL);
+    errors += (tget(map, "prefix00x") != NULL);
+
+    for(i=0; i<nbElements; i++) {
+        sorted[i] = keys[i];
+    }
+    errors += (tbuild(map, sorted, sorted, nbElements, TMAP_BUILD_SORT) != 0);
+    for(i=0; i<nbElements; i+=2) {
+        tdel(map, keys[i]);
+    }
+    for(i=0; i<nbElements; i++) {
+        // Random keys may not be unique
+        if(i % 4 != 0) {
+            errors += (tget(map, keys[i]) != (i % 2 ? keys[i] : NULL));
+        }
+    }
+
+    tfree(ptrMap);
+    tfree(map);
+    free(sorted);
+    free(keys);
+
+    if(errors == 0) {
+        fprintf(stderr, "PASS!\n");
+    } else {
+        fprintf(stderr, "FAIL!\n");
+    }
+}
+
+
+// Maps copying their keys: the client's key buffer is reused for every
+// key added, and memory held goes back to what it was once keys are gone
+void copyKeysTest(const int nbElements) {
+    AllocCounter counter;
+    tmap_config config;
+    tmap* map;
+    tcursor cursor;
+    char key[MAX_KEY_SIZE];
+    long bytes = 0;
+    int errors = 0;
+    int round;
+    int m, i;
+
+    printf("---------------------------------------------------------\n");
+    printf("Test maps owning copies of their keys\n");
+
+    // String tree, fixed size keys tree, string hash table, string RCU tree
+    for(m=0; m<4; m++) {
+        memset(&counter, 0, sizeof(counter));
+        memset(&config, 0, sizeof(config));
+        config.keyKind = m == 1 ? TMAP_KEY_PTR : TMAP_KEY_STRING;
+        config.cmp = compare;
+        config.keySize = MAX_KEY_SIZE;
+        config.hash = m == 2 ? hash : NULL;
+        config.multitask = m == 3 ? MULTI_THREAD_RCU : SINGLE_THREADED;
+        config.alloc = ctxAlloc;
+        config.free = ctxFree;
+        config.allocCtx = &counter;
+        config.flags = TMAP_COPY_KEYS;
+        map = tinit_ex(&config);
+
+        for(round=0; round<2; round++) {
+            for(i=0; i<nbElements; i++) {
+                snprintf(key, MAX_KEY_SIZE, "%08d", i);
+                tadd(map, key, (void*)(intptr_t)(i + 1));
+            }
+            // Overwriting keeps the map's copy
+            tput(map, key, (void*)(intptr_t)nbElements);
+            memset(key, 'x', sizeof(key) - 1);
+            key[sizeof(key) - 1] = 0;
+
+            for(i=0; i<nbElements; i++) {
+                snprintf(key, MAX_KEY_SIZE, "%08d", i);
+                errors += (tget(map, key) != (void*)(intptr_t)(i + 1));
+            }
+            if(m != 2) {
+                errors += (tfirst(map, &cursor) != 1);
+                errors += (cursor.key == key || strcmp(cursor.key, "00000000") != 0);
+                // Cursors keep their key once it is deleted, and the
+                // chunk holding the map's copy freed
+                for(i=0; i<nbElements/2; i++) {
+                    snprintf(key, MAX_KEY_SIZE, "%08d", i);
+                    tdel(map, key);
+                }
+                snprintf(key, MAX_KEY_SIZE, "%08d", nbElements/2);
+                errors += (tnext(map, &cursor) != 1 || strcmp(cursor.key, key) != 0);
+            }
+
+            for(i=0; i<nbElements; i++) {
+                snprintf(key, MAX_KEY_SIZE, "%08d", i);
+                tdel(map, key);
+            }
+            // Readers of RCU maps may hold keys a while longer
+            if(m != 3) {
+                errors += (round == 1 && counter.bytes != bytes);
+                bytes = counter.bytes;
+            }
+        }
+        printf("   Map %d bytes left with no key: %ld\n", m, counter.bytes);
+
+        for(i=0; i<nbElements; i++) {
+            snprintf(key, MAX_KEY_SIZE, "%08d", i);
+            tadd(map, key, key);
+        }
+        tclear(map);
+        errors += (tget(map, key) != NULL);
+        tadd(map, key, key);
+        errors += (tget(map, "x") != NULL || tget(map, key) != key);
+        tfree(map);
+        errors += (counter.bytes != 0);
+    }
+
+    if(errors == 0) {
+        fprintf(stderr, "PASS!\n");
+    } else {
+        fprintf(stderr, "FAIL!\n");
+    }
+}
+
+
+// B+ tree maps of each key kind against AVL maps: keys added in random
+// order, half of them deleted, and the rest walked in order
+void btreeTest(const int nbElements) {
+    AllocCounter counter;
+    tmap_config config;
+    tmap* map;
+    tmap* avlMap;
+    tcursor cursor;
+    RangeCtx range;
+    char (*keys)[MAX_KEY_SIZE];
+    void** ordered;
+    int* shuffled;
+    void* key;
+    int errors = 0;
+    int m, i, j, t;
+
+    printf("---------------------------------------------------------\n");
+    printf("Test B+ tree maps\n");
+
+    keys = malloc(nbElements * MAX_KEY_SIZE);
+    ordered = malloc(nbElements * sizeof(void*));
+    shuffled = malloc(nbElements * sizeof(int));
+    if(keys == NULL || ordered == NULL || shuffled == NULL) {
+        fprintf(stderr, "btreeTest: Allocation failed: %s\n", strerror(errno));
+        exit(-1);
+    }
+    srand(1);
+    for(i=0; i<nbElements; i++) {
+        snprintf(keys[i], MAX_KEY_SIZE, "%08d", i);
+        shuffled[i] = i;
+    }
+    for(i=nbElements-1; i>0; i--) {
+        j = rand() % (i + 1);
+        t = shuffled[i];
+        shuffled[i] = shuffled[j];
+        shuffled[j] = t;
+    }
+
+    // Compare function, string and integer keys
+    for(m=0; m<3; m++) {
+        memset(&counter, 0, sizeof(counter));
+        memset(&config, 0, sizeof(config));
+        config.keyKind = m == 0 ? TMAP_KEY_PTR : (m == 1 ? TMAP_KEY_STRING : TMAP_KEY_U64);
+        config.cmp = compare;
+        config.alloc = ctxAlloc;
+        config.free = ctxFree;
+        config.allocCtx = &counter;
+        config.flags = TMAP_BTREE;
+        map = tinit_ex(&config);
+        config.flags = 0;
+        avlMap = tinit_ex(&config);
+
+        for(i=0; i<nbElements; i++) {
+            ordered[i] = m == 2 ? TMAP_U64(i) : keys[i];
+        }
+        for(i=0; i<nbElements; i++) {
+            key = ordered[shuffled[i]];
+            tadd(map, key, keys[shuffled[i]]);
+            tadd(avlMap, key, keys[shuffled[i]]);
+        }
+
+        clock_t tClock = clock();
+        for(i=0; i<nbElements; i++) {
+            errors += (tget(map, ordered[shuffled[i]]) != keys[shuffled[i]]);
+        }
+        tClock = clock() - tClock;
+        fprintf(stderr, "[%-5d] Map %d B+ tree access time: %-3.2f seconds\n", nbElements, m, (float)tClock/CLOCKS_PER_SEC);
+        tClock = clock();
+        for(i=0; i<nbElements; i++) {
+            errors += (tget(avlMap, ordered[shuffled[i]]) != keys[shuffled[i]]);
+        }
+        tClock = clock() - tClock;
+        fprintf(stderr, "[%-5d] Map %d AVL tree access time: %-3.2f seconds\n", nbElements, m, (float)tClock/CLOCKS_PER_SEC);
+        errors += (ttreeroot(map) != NULL);
+
+        // Odd keys are left, in order
+        for(i=0; i<nbElements; i++) {
+            if(shuffled[i] % 2 == 0) {
+                tdel(map, ordered[shuffled[i]]);
+            }
+        }
+        for(i=0; i<nbElements; i++) {
+            errors += (tget(map, ordered[i]) != (i % 2 ? keys[i] : NULL));
+        }
+        i = 1;
+        if(tfirst(map, &cursor)) {
+            do {
+                errors += (i >= nbElements || cursor.key != ordered[i] || cursor.value != keys[i]);
+                i += 2;
+            } while(tnext(map, &cursor));
+        }
+        errors += (i != 1 + 2*(nbElements/2));
+        if(nbElements > 10) {
+            errors += (!tlower_bound(map, ordered[4], &cursor) || cursor.key != ordered[5]);
+            errors += (!tprev(map, &cursor) || cursor.key != ordered[3]);
+            if(m != 2) {
+                memset(&range, 0, sizeof(range));
+                errors += (trange(map, keys[3], keys[9], rangeAction, &range) != 3);
+                errors += (range.previous != keys[7] || range.errors != 0);
+            }
+        }
+
+        // Ordered input fills leaves
+        tbuild(map, ordered, (void**)ordered, nbElements, TMAP_BUILD_SORTED);
+        for(i=0; i<nbElements; i++) {
+            errors += (tget(map, ordered[i]) != ordered[i]);
+        }
+        tclear(map);
+        errors += (tfirst(map, &cursor) != 0);
+        tadd(map, ordered[0], keys[0]);
+        errors += (tget(map, ordered[0]) != keys[0]);
+
+        tfree(avlMap);
+        tfree(map);
+        errors += (counter.bytes != 0);
+    }
+
+    free(shuffled);
+    free(ordered);
+    free(keys);
+
+    if(errors == 0) {
+        fprintf(stderr, "PASS!\n");
+    } else {
+        fprintf(stderr, "FAIL!\n");
+    }
+}
+
+
+
+// Radix tree maps against string AVL maps, on paths and zero padded ids
+// sharing long prefixes, keys prefix of others and bytes above 0x7F
+void artTest(const int nbElements) {
+    static const char* prefixes[] = { "", "/", "/usr/", "/usr/local/share/doc/", "0000", "00001",
+                                      "ab", "abc", "\xff", "\xff\xff", "x", "/usr/local/share/doc/9" };
+    AllocCounter counter;
+    tmap_config config;
+    tmap* map;
+    tmap* avlMap;
+    tcursor cursor;
+    tcursor avlCursor;
+    RangeCtx range;
+    char (*keys)[2*MAX_KEY_SIZE];
+    int errors = 0;
+    int nbKeys = nbElements < 100 ? 100 : nbElements;
+    size_t count;
+    int i, p;
+
+    printf("---------------------------------------------------------\n");
+    printf("Test radix tree maps\n");
+
+    keys = malloc(nbKeys * 2*MAX_KEY_SIZE);
+    if(keys == NULL) {
+        fprintf(stderr, "artTest: Allocation failed: %s\n", strerror(errno));
+        exit(-1);
+    }
+    srand(1);
+    for(i=0; i<nbKeys; i++) {
+        switch(i % 4) {
+            case 0:
+                snprintf(keys[i], 2*MAX_KEY_SIZE, "%09d", rand() % (4*nbKeys));
+                break;
+            case 1:
+                snprintf(keys[i], 2*MAX_KEY_SIZE, "/usr/local/share/doc/%d", i);
+                break;
+            case 2:
+                snprintf(keys[i], 2*MAX_KEY_SIZE, "/usr/%x", i);
+                break;
+            default:
+                snprintf(keys[i], 2*MAX_KEY_SIZE, "%d", i % 1000);
+                break;
+        }
+    }
+    strcpy(keys[0], "");
+    strcpy(keys[4], "ab");
+    strcpy(keys[8], "abc");
+    strcpy(keys[12], "\xff");
+    strcpy(keys[16], "\xff\xff" "a");
+
+    memset(&counter, 0, sizeof(counter));
+    memset(&config, 0, sizeof(config));
+    config.keyKind = TMAP_KEY_STRING;
+    config.alloc = ctxAlloc;
+    config.free = ctxFree;
+    config.allocCtx = &counter;
+    config.flags = TMAP_ART;
+    map = tinit_ex(&config);
+    avlMap = tinit_str(TMAP_ALLOW_OVERWRITE, SINGLE_THREADED);
+
+    for(i=0; i<nbKeys; i++) {
+        tadd(map, keys[i], keys[i]);
+        tadd(avlMap, keys[i], keys[i]);
+    }
+
+    clock_t tClock = clock();
+    for(i=0; i<nbKeys; i++) {
+        errors += (tget(map, keys[i]) == NULL || strcmp(tget(map, keys[i]), keys[i]) != 0);
+    }
+    tClock = clock() - tClock;
+    fprintf(stderr, "[%-5d] Radix tree access time: %-3.2f seconds\n", nbKeys, (float)tClock/CLOCKS_PER_SEC);
+    tClock = clock();
+    for(i=0; i<nbKeys; i++) {
+        errors += (tget(avlMap, keys[i]) == NULL || strcmp(tget(avlMap, keys[i]), keys[i]) != 0);
+    }
+    tClock = clock() - tClock;
+    fprintf(stderr, "[%-5d] AVL tree access time:   %-3.2f seconds\n", nbKeys, (float)tClock/CLOCKS_PER_SEC);
+    errors += (tget(map, "a") != NULL || tget(map, "/usr/local/share/doc/") != NULL);
+    errors += (tget(map, "/usr/local/share/doc/1x") != NULL || tget(map, "abcd") != NULL);
+
+    for(i=0; i<nbKeys; i+=3) {
+        tdel(map, keys[i]);
+        tdel(avlMap, keys[i]);
+    }
+    tdel(map, "/usr/local/share/doc/");
+
+    // Same keys in the same order, from any position
+    errors += (tfirst(map, &cursor) != tfirst(avlMap, &avlCursor));
+    do {
+        errors += (cursor.key != avlCursor.key);
+    } while(tnext(map, &cursor) + tnext(avlMap, &avlCursor) == 2);
+    errors += (tnext(map, &cursor) != tnext(avlMap, &avlCursor));
+    errors += (tlast(map, &cursor) != tlast(avlMap, &avlCursor) || cursor.key != avlCursor.key);
+    for(i=0; i<nbKeys; i++) {
+        errors += (tlower_bound(map, keys[i], &cursor) != tlower_bound(avlMap, keys[i], &avlCursor));
+        errors += (cursor.key != avlCursor.key);
+        errors += (tupper_bound(map, keys[i], &cursor) != tupper_bound(avlMap, keys[i], &avlCursor));
+        errors += (cursor.key != avlCursor.key);
+        cursor.key = avlCursor.key = keys[i];
+        errors += (tprev(map, &cursor) != tprev(avlMap, &avlCursor) || cursor.key != avlCursor.key);
+    }
+
+    for(p=0; p<sizeof(prefixes)/sizeof(prefixes[0]); p++) {
+        memset(&range, 0, sizeof(range));
+        count = tprefix(map, prefixes[p], rangeAction, &range);
+        errors += range.errors;
+        memset(&range, 0, sizeof(range));
+        errors += (tprefix(avlMap, prefixes[p], rangeAction, &range) != count);
+        errors += range.errors;
+        printf("   Keys starting with \"%s\": %zu\n", prefixes[p], count);
+        memset(&range, 0, sizeof(range));
+        errors += (trange(map, (void*)prefixes[p], keys[nbKeys-1], rangeAction, &range)
+                   != trange(avlMap, (void*)prefixes[p], keys[nbKeys-1], rangeAction, &range));
+    }
+    memset(&range, 0, sizeof(range));
+    range.limit = 3;
+    errors += (tprefix(map, "/usr/", rangeAction, &range) != 3);
+
+    tclear(map);
+    errors += (tfirst(map, &cursor) != 0 || tget(map, keys[1]) != NULL);
+    errors += (tprefix(map, "", rangeAction, &range) != 0);
+    tadd(map, keys[1], keys[1]);
+    errors += (tget(map, keys[1]) != keys[1]);
+
+    tfree(avlMap);
+    tfree(map);
+    errors += (counter.bytes != 0);
+    free(keys);
+
+    if(errors == 0) {
+        fprintf(stderr, "PASS!\n");
+    } else {
+        fprintf(stderr, "FAIL!\n");
+    }
+}
+
+
+// Maps saved with tsave and mapped back with topen, for each key kind:
+// same keys, values and order as the map saved
+void fileTest(const int nbElements) {
+    const int nbKeys = nbElements < 100 ? 100 : nbElements;
+    tmap_config config;
+    tmap* map;
+    tmap* fileMap;
+    tcursor cursor;
+    tcursor fileCursor;
+    RangeCtx range;
+    char (*keys)[MAX_KEY_SIZE];
+    char path[64];
+    int* ids;
+    void* key;
+    int errors = 0;
+    int m, i;
+
+    printf("---------------------------------------------------------\n");
+    printf("Test map files (tsave, topen)\n");
+
+    keys = malloc(nbKeys * MAX_KEY_SIZE);
+    ids = malloc(nbKeys * sizeof(int));
+    if(keys == NULL || ids == NULL) {
+        fprintf(stderr, "fileTest: Allocation failed: %s\n", strerror(errno));
+        exit(-1);
+    }
+    for(i=0; i<nbKeys; i++) {
+        snprintf(keys[i], MAX_KEY_SIZE, "%09d", i*7);
+        ids[i] = i;
+    }
+    snprintf(path, sizeof(path), "/tmp/maptest-%d.tmap", (int)getpid());
+
+    // String keys with int values, integer keys and values, fixed size
+    // keys with no value
+    for(m=0; m<3; m++) {
+        memset(&config, 0, sizeof(config));
+        config.keyKind = m == 0 ? TMAP_KEY_STRING : (m == 1 ? TMAP_KEY_U64 : TMAP_KEY_PTR);
+        config.cmp = compare;
+        config.keySize = MAX_KEY_SIZE;
+        map = tinit_ex(&config);
+        for(i=0; i<nbKeys; i++) {
+            tadd(map, m == 1 ? TMAP_U64(i*7) : keys[i], m == 0 ? &ids[i] : (m == 1 ? TMAP_U64(i) : NULL));
+        }
+        errors += (tsave(map, path, m == 0 ? sizeof(int) : 0) != 0);
+
+        clock_t tClock = clock();
+        fileMap = topen(path, compare);
+        tClock = clock() - tClock;
+        fprintf(stderr, "[%-5d] Map %d open time:   %-3.2f seconds\n", nbKeys, m, (float)tClock/CLOCKS_PER_SEC);
+        if(fileMap == NULL) {
+            fprintf(stderr, "fileTest: topen failed: %s\n", strerror(errno));
+            errors++;
+            tfree(map);
+            continue;
+        }
+
+        tClock = clock();
+        for(i=0; i<nbKeys; i++) {
+            key = m == 1 ? TMAP_U64(i*7) : keys[i];
+            switch(m) {
+                case 0:
+                    errors += (tget(fileMap, key) == NULL || *(int*)tget(fileMap, key) != i);
+                    break;
+                case 1:
+                    errors += (tget(fileMap, key) != TMAP_U64(i));
+                    break;
+                default:
+                    errors += (tget(fileMap, key) != NULL);
+                    errors += (!tlower_bound(fileMap, key, &cursor) || strcmp(cursor.key, key) != 0);
+                    break;
+            }
+        }
+        tClock = clock() - tClock;
+        fprintf(stderr, "[%-5d] Map %d access time: %-3.2f seconds\n", nbKeys, m, (float)tClock/CLOCKS_PER_SEC);
+        errors += (tget(fileMap, m == 1 ? TMAP_U64(1) : "000000001") != NULL);
+
+        // Same order from any position
+        errors += (tfirst(map, &cursor) != tfirst(fileMap, &fileCursor));
+        for(i=0; i<nbKeys; i++) {
+            if(m == 1) {
+                errors += (cursor.key != fileCursor.key);
+            } else {
+                errors += (strcmp(cursor.key, fileCursor.key) != 0 || cursor.key == fileCursor.key);
+            }
+            tnext(map, &cursor);
+            tnext(fileMap, &fileCursor);
+        }
+        errors += (tnext(fileMap, &fileCursor) != 0);
+        key = m == 1 ? TMAP_U64(20) : "000000020";
+        errors += (!tupper_bound(fileMap, key, &fileCursor) || tget(fileMap, fileCursor.key) != tget(fileMap, m == 1 ? TMAP_U64(21) : keys[3]));
+        fileCursor.key = key;
+        errors += (!tprev(fileMap, &fileCursor) || tget(fileMap, fileCursor.key) != tget(fileMap, m == 1 ? TMAP_U64(14) : keys[2]));
+        if(m != 1) {
+            memset(&range, 0, sizeof(range));
+            errors += (trange(fileMap, NULL, NULL, rangeAction, &range) != nbKeys);
+            memset(&range, 0, sizeof(range));
+            errors += (tprefix(fileMap, "0000000", rangeAction, &range) != (m == 0 ? 15 : 0));
+        }
+
+        tfree(fileMap);
+        tfree(map);
+    }
+
+    // Hash maps have no order to save, other files can't be opened
+    map = tinit_hash(hash, compare, TMAP_ALLOW_OVERWRITE, SINGLE_THREADED);
+    errors += (tsave(map, path, 0) != -1);
+    tfree(map);
+    errors += (topen("/dev/null", NULL) != NULL);
+    errors += (topen(path, NULL) != NULL);
+
+    // Headers with an unknown key kind, more entries or larger values
+    // than the file holds
+    for(m=0; m<3; m++) {
+        uint32_t keyKind = 7;
+        // Count whose entries wrap around to 8 bytes
+        uint64_t huge = m == 1 ? 0x0AAAAAAAAAAAAAABULL : (uint64_t)1 << 40;
+        int fd;
+
+        map = tinit_u64(TMAP_ALLOW_OVERWRITE, SINGLE_THREADED);
+        tadd(map, TMAP_U64(1), &ids[0]);
+        errors += (tsave(map, path, m == 2 ? sizeof(int) : 0) != 0);
+        tfree(map);
+        fd = open(path, O_WRONLY);
+        // keyKind, valueSize and count offsets
+        errors += (fd < 0 || pwrite(fd, m == 0 ? (void*)&keyKind : (void*)&huge,
+                                    m == 0 ? sizeof(keyKind) : sizeof(huge), m == 0 ? 16 : (m == 1 ? 40 : 32)) <= 0);
+        close(fd);
+        errno = 0;
+        errors += (topen(path, NULL) != NULL || errno != EINVAL);
+    }
+    unlink(path);
+
+    free(ids);
+    free(keys);
+
+    if(errors == 0) {
+        fprintf(stderr, "PASS!\n");
+    } else {
+        fprintf(stderr, "FAIL!\n");
+    }
+}
+
+
+typedef struct SnapCtx {
+    char* previous;
+    int count;
+    int errors;
+} SnapCtx;
+
+// Values are the index of their key, which is twice the index
+static int snapAction(const void* key, void* value, void* ctx) {
+    SnapCtx* snap = (SnapCtx*)ctx;
+
+    snap->errors += (*(int*)value * 2 != atoi(key));
+    if(snap->previous != NULL && strcmp(snap->previous, key) >= 0) {
+        snap->errors++;
+    }
+    snap->previous = (char*)key;
+    snap->count++;
+    return 0;
+}
+
+
+// Map snapshots keep the keys and values they were taken with whatever
+// the map goes through, and memory held for them goes when they do
+int snapshotCheck(tmap* snap, char (*keys)[MAX_KEY_SIZE], int* ids, const int nbKeys) {
+    tcursor cursor;
+    SnapCtx ctx;
+    int errors = 0;
+    int i;
+
+    for(i=0; i<nbKeys; i++) {
+        errors += (tget(snap, keys[i]) != &ids[i]);
+    }
+    errors += (tget(snap, "000000001") != NULL);
+
+    errors += (tfirst(snap, &cursor) != 1 || strcmp(cursor.key, keys[0]) != 0);
+    for(i=1; i<nbKeys && tnext(snap, &cursor); i++) {
+        errors += (strcmp(cursor.key, keys[i]) != 0 || cursor.value != &ids[i]);
+    }
+    errors += (i != nbKeys);
+
+    memset(&ctx, 0, sizeof(ctx));
+    errors += (trange(snap, NULL, NULL, snapAction, &ctx) != nbKeys);
+    errors += ctx.errors;
+
+    nbVisited = 0;
+    maxDepth = 0;
+    ttwalk(ttreeroot(snap), depthAction);
+    errors += (nbVisited != nbKeys);
+    return errors;
+}
+
+
+void snapshotTest(const int nbElements) {
+    const int nbKeys = nbElements < 100 ? 100 : nbElements;
+    AllocCounter counter;
+    tmap_config config;
+    tmap* map;
+    tmap* snap;
+    tmap* snap2;
+    char (*keys)[MAX_KEY_SIZE];
+    char key[MAX_KEY_SIZE];
+    int* ids;
+    int errors = 0;
+    int m, i;
+
+    printf("---------------------------------------------------------\n");
+    printf("Test map snapshots (tsnapshot)\n");
+
+    keys = malloc(2 * nbKeys * MAX_KEY_SIZE);
+    ids = malloc(2 * nbKeys * sizeof(int));
+    if(keys == NULL || ids == NULL) {
+        fprintf(stderr, "snapshotTest: Allocation failed: %s\n", strerror(errno));
+        exit(-1);
+    }
+    for(i=0; i<2*nbKeys; i++) {
+        snprintf(keys[i], MAX_KEY_SIZE, "%09d", i*2);
+        ids[i] = i;
+    }
+
+    // String keys, then copied string keys on a locked map
+    for(m=0; m<2; m++) {
+        memset(&counter, 0, sizeof(counter));
+        memset(&config, 0, sizeof(config));
+        config.keyKind = TMAP_KEY_STRING;
+        config.multitask = m == 0 ? SINGLE_THREADED : MULTI_THREAD_SAFE;
+        config.flags = m == 0 ? 0 : TMAP_COPY_KEYS;
+        config.alloc = ctxAlloc;
+        config.free = ctxFree;
+        config.allocCtx = &counter;
+        map = tinit_ex(&config);
+        for(i=0; i<nbKeys; i++) {
+            tadd(map, keys[i], &ids[i]);
+        }
+
+        clock_t tClock = clock();
+        snap = tsnapshot(map);
+        tClock = clock() - tClock;
+        fprintf(stderr, "[%-5d] Map %d snapshot time: %-3.2f seconds\n", nbKeys, m, (float)tClock/CLOCKS_PER_SEC);
+
+        // Every other key deleted, others given another value, new keys
+        for(i=0; i<nbKeys; i++) {
+            if(i & 1) {
+                tdel(map, keys[i]);
+            } else {
+                tput(map, keys[i], &ids[nbKeys + i]);
+            }
+        }
+        for(i=nbKeys; i<2*nbKeys; i++) {
+            tadd(map, keys[i], &ids[i]);
+        }
+        errors += (tget(map, keys[1]) != NULL || tget(map, keys[0]) != &ids[nbKeys]);
+        errors += snapshotCheck(snap, keys, ids, nbKeys);
+
+        // A second snapshot sees the new keys only, whatever the map
+        // goes through next
+        for(i=0; i<nbKeys; i++) {
+            tdel(map, keys[i]);
+        }
+        snap2 = tsnapshot(map);
+        tclear(map);
+        for(i=0; i<nbKeys; i++) {
+            snprintf(key, MAX_KEY_SIZE, "%09d", i*2 + 1);
+            tadd(map, key, &ids[i]);
+        }
+        errors += snapshotCheck(snap2, keys + nbKeys, ids + nbKeys, nbKeys);
+        errors += snapshotCheck(snap, keys, ids, nbKeys);
+
+        tfree(snap);
+        errors += snapshotCheck(snap2, keys + nbKeys, ids + nbKeys, nbKeys);
+        tfree(snap2);
+
+        // Map works in place again
+        tclear(map);
+        for(i=0; i<nbKeys; i++) {
+            tadd(map, keys[i], &ids[i]);
+        }
+        errors += snapshotCheck(map, keys, ids, nbKeys);
+        tfree(map);
+        errors += (counter.bytes != 0);
+    }
+
+    // Tree maps only, and not MULTI_THREAD_RCU ones
+    map = tinit_hash(hash, compare, TMAP_ALLOW_OVERWRITE, SINGLE_THREADED);
+    errors += (tsnapshot(map) != NULL);
+    tfree(map);
+    map = tinit_str(TMAP_ALLOW_OVERWRITE, MULTI_THREAD_RCU);
+    errors += (tsnapshot(map) != NULL);
+    tfree(map);
+
+    free(ids);
+    free(keys);
+
+    if(errors == 0) {
+        fprintf(stderr, "PASS!\n");
+    } else {
+        fprintf(stderr, "FAIL!\n");
+    }
+}
+
+
+typedef struct EvictCtx {
+    char last[MAX_KEY_SIZE];
+    int count;
+    int errors;
+} EvictCtx;
+
+// Values are the index of their key, which is twice the index
+static void evictAction(void* key, void* value, void* ctx) {
+    EvictCtx* evict = (EvictCtx*)ctx;
+
+    evict->errors += (*(int*)value * 2 != atoi(key));
+    strncpy(evict->last, key, MAX_KEY_SIZE - 1);
+    evict->count++;
+}
+
+
+// Bounded maps keep their most recently used keys, whatever the engine
+void lruTest(const int nbElements) {
+    const int nbKeys = nbElements < 100 ? 100 : nbElements;
+    const int capacity = nbKeys / 4;
+    AllocCounter counter;
+    tmap_config config;
+    EvictCtx evict;
+    tmap* map;
+    char (*keys)[MAX_KEY_SIZE];
+    int* ids;
+    int errors = 0;
+    int m, i;
+
+    printf("---------------------------------------------------------\n");
+    printf("Test bounded maps (capacity, evict)\n");
+
+    keys = malloc(nbKeys * MAX_KEY_SIZE);
+    ids = malloc(nbKeys * sizeof(int));
+    if(keys == NULL || ids == NULL) {
+        fprintf(stderr, "lruTest: Allocation failed: %s\n", strerror(errno));
+        exit(-1);
+    }
+    for(i=0; i<nbKeys; i++) {
+        snprintf(keys[i], MAX_KEY_SIZE, "%09d", i*2);
+        ids[i] = i;
+    }
+
+    // Tree, hash table, B+ tree, radix tree, tree copying its keys
+    for(m=0; m<5; m++) {
+        memset(&counter, 0, sizeof(counter));
+        memset(&evict, 0, sizeof(evict));
+        memset(&config, 0, sizeof(config));
+        config.keyKind = TMAP_KEY_STRING;
+        config.hash = m == 1 ? hash : NULL;
+        config.flags = m == 2 ? TMAP_BTREE : (m == 3 ? TMAP_ART : (m == 4 ? TMAP_COPY_KEYS : 0));
+        config.multitask = m == 4 ? MULTI_THREAD_RWLOCK : SINGLE_THREADED;
+        config.alloc = ctxAlloc;
+        config.free = ctxFree;
+        config.allocCtx = &counter;
+        config.blockSize = 64;
+        config.capacity = capacity;
+        config.evict = evictAction;
+        config.evictCtx = &evict;
+        map = tinit_ex(&config);
+
+        for(i=0; i<capacity; i++) {
+            tadd(map, keys[i], &ids[i]);
+        }
+        errors += (evict.count != 0);
+
+        // First key used, the second one is the least recently used
+        errors += (tget(map, keys[0]) != &ids[0]);
+        tadd(map, keys[capacity], &ids[capacity]);
+        errors += (evict.count != 1 || strcmp(evict.last, keys[1]) != 0);
+        errors += (tget(map, keys[0]) != &ids[0] || tget(map, keys[1]) != NULL);
+
+        // Setting a key uses it too
+        tput(map, keys[2], &ids[2]);
+        tadd(map, keys[capacity+1], &ids[capacity+1]);
+        errors += (evict.count != 2 || strcmp(evict.last, keys[3]) != 0);
+
+        clock_t tClock = clock();
+        for(i=capacity+2; i<nbKeys; i++) {
+            tadd(map, keys[i], &ids[i]);
+        }
+        tClock = clock() - tClock;
+        fprintf(stderr, "[%-5d] Map %d insertion time: %-3.2f seconds\n", nbKeys, m, (float)tClock/CLOCKS_PER_SEC);
+        errors += (evict.count != nbKeys - capacity);
+        for(i=nbKeys-capacity; i<nbKeys; i++) {
+            errors += (tget(map, keys[i]) != &ids[i]);
+        }
+        errors += (tget(map, keys[nbKeys-capacity-1]) != NULL);
+
+        // Deleted keys make room
+        tdel(map, keys[nbKeys-1]);
+        tadd(map, keys[0], &ids[0]);
+        errors += (evict.count != nbKeys - capacity);
+        tadd(map, keys[1], &ids[1]);
+        errors += (evict.count != nbKeys - capacity + 1);
+        errors += evict.errors;
+
+        // Cleared map starts over
+        tclear(map);
+        for(i=0; i<capacity; i++) {
+            tadd(map, keys[i], &ids[i]);
+        }
+        errors += (evict.count != nbKeys - capacity + 1);
+
+        tfree(map);
+        errors += (counter.bytes != 0);
+    }
+
+    free(ids);
+    free(keys);
+
+    if(errors == 0) {
+        fprintf(stderr, "PASS!\n");
+    } else {
+        fprintf(stderr, "FAIL!\n");
+    }
+}
+
+
+static void* keepAction(const void* key, void* value, void* ctx) {
+    ((int*)ctx)[0] += (value != NULL);
+    return ctx;
+}
+
+
+// Keys given a time to live can't be found once expired, and are removed
+// a bounded number at a time
+void ttlTest(const int nbElements) {
+    const int nbKeys = nbElements < 100 ? 100 : nbElements;
+    const uint64_t ttl = 100;
+    AllocCounter counter;
+    tmap_config config;
+    tmap* map;
+    char (*keys)[MAX_KEY_SIZE];
+    int* ids;
+    int errors = 0;
+    int seen;
+    size_t removed;
+    int m, i;
+
+    printf("---------------------------------------------------------\n");
+    printf("Test keys expiring (tadd_ttl, texpire)\n");
+
+    keys = malloc(nbKeys * MAX_KEY_SIZE);
+    ids = malloc(nbKeys * sizeof(int));
+    if(keys == NULL || ids == NULL) {
+        fprintf(stderr, "ttlTest: Allocation failed: %s\n", strerror(errno));
+        exit(-1);
+    }
+    for(i=0; i<nbKeys; i++) {
+        snprintf(keys[i], MAX_KEY_SIZE, "%09d", i*2);
+        ids[i] = i;
+    }
+
+    // Tree, hash table, B+ tree, bounded tree
+    for(m=0; m<4; m++) {
+        memset(&counter, 0, sizeof(counter));
+        memset(&config, 0, sizeof(config));
+        config.keyKind = TMAP_KEY_STRING;
+        config.hash = m == 1 ? hash : NULL;
+        config.flags = TMAP_TTL | (m == 2 ? TMAP_BTREE : 0);
+        config.multitask = m == 3 ? MULTI_THREAD_SAFE : MULTI_THREAD_RWLOCK;
+        config.capacity = m == 3 ? nbKeys : 0;
+        config.noOverwrite = TMAP_NO_OVERWRITE;
+        config.alloc = ctxAlloc;
+        config.free = ctxFree;
+        config.allocCtx = &counter;
+        map = tinit_ex(&config);
+
+        // Even keys expire, odd ones don't
+        for(i=0; i<nbKeys; i++) {
+            if(i & 1) {
+                tadd(map, keys[i], &ids[i]);
+            } else {
+                tadd_ttl(map, keys[i], &ids[i], ttl);
+            }
+        }
+        for(i=0; i<nbKeys; i++) {
+            errors += (tget(map, keys[i]) != &ids[i]);
+        }
+
+        usleep(1500 * ttl);
+        for(i=0; i<nbKeys; i++) {
+            errors += (tget(map, keys[i]) != ((i & 1) ? &ids[i] : NULL));
+        }
+        clock_t tClock = clock();
+        removed = texpire(map, 10);
+        errors += (removed != 10);
+        removed += texpire(map, nbKeys);
+        tClock = clock() - tClock;
+        fprintf(stderr, "[%-5d] Map %d expiry time: %-3.2f seconds\n", nbKeys, m, (float)tClock/CLOCKS_PER_SEC);
+        errors += (removed != (size_t)nbKeys/2);
+        errors += (texpire(map, nbKeys) != 0);
+
+        // Expired keys are taken as absent, even before being removed,
+        // and the key set again doesn't expire
+        tadd_ttl(map, keys[0], &ids[0], ttl/2);
+        tadd_ttl(map, keys[2], &ids[2], ttl/2);
+        tadd_ttl(map, keys[4], &ids[4], ttl/2);
+        errors += (tput(map, keys[4], &ids[4]) != &ids[4]);
+        usleep(1500 * ttl/2);
+        errors += (tput(map, keys[0], &ids[0]) != NULL);
+        seen = 0;
+        tcompute(map, keys[2], keepAction, &seen);
+        errors += (seen != 0);
+        tdel(map, keys[2]);
+        tadd(map, keys[2], &ids[2]);
+        usleep(1500 * ttl/2);
+        errors += (tget(map, keys[0]) != &ids[0] || tget(map, keys[2]) != &ids[2]);
+        // Setting a value kept the deadline
+        errors += (tget(map, keys[4]) != NULL);
+
+        tfree(map);
+        errors += (counter.bytes != 0);
+    }
+
+    free(ids);
+    free(keys);
+
+    if(errors == 0) {
+        fprintf(stderr, "PASS!\n");
+    } else {
+        fprintf(stderr, "FAIL!\n");
+    }
+}
+
+
+// Lookups of a map with a Bloom filter find the keys there are, and only
+// those, as the filter is rebuilt after keys are removed and as it grows
+void bloomTest(const int nbElements) {
+    const int nbKeys = nbElements < 100 ? 100 : nbElements;
+    AllocCounter counter;
+    tmap_config config;
+    tmap* map;
+    char (*keys)[MAX_KEY_SIZE];
+    void** batch;
+    int* ids;
+    int errors = 0;
+    int m, i;
+
+    printf("---------------------------------------------------------\n");
+    printf("Test maps with a Bloom filter (TMAP_BLOOM)\n");
+
+    // Keys of even index are added, odd ones never
+    keys = malloc(2 * nbKeys * MAX_KEY_SIZE);
+    ids = malloc(2 * nbKeys * sizeof(int));
+    batch = malloc(2 * nbKeys * sizeof(void*));
+    if(keys == NULL || ids == NULL || batch == NULL) {
+        fprintf(stderr, "bloomTest: Allocation failed: %s\n", strerror(errno));
+        exit(-1);
+    }
+    for(i=0; i<2*nbKeys; i++) {
+        snprintf(keys[i], MAX_KEY_SIZE, "%09d", i);
+        ids[i] = i;
+    }
+
+    // Tree, hash table, integer keys, fixed size keys hashed by the client
+    for(m=0; m<4; m++) {
+        memset(&counter, 0, sizeof(counter));
+        memset(&config, 0, sizeof(config));
+        config.keyKind = m == 2 ? TMAP_KEY_U64 : (m == 3 ? TMAP_KEY_PTR : TMAP_KEY_STRING);
+        config.cmp = m == 3 ? compare : NULL;
+        config.keySize = m == 3 ? MAX_KEY_SIZE : 0;
+        config.hash = m == 1 || m == 3 ? hash : NULL;
+        config.flags = TMAP_BLOOM;
+        config.multitask = MULTI_THREAD_RWLOCK;
+        config.alloc = ctxAlloc;
+        config.free = ctxFree;
+        config.allocCtx = &counter;
+        map = tinit_ex(&config);
+
+#define BLOOM_KEY(i) (m == 2 ? TMAP_U64(i) : (void*)keys[i])
+        for(i=0; i<2*nbKeys; i+=2) {
+            tadd(map, BLOOM_KEY(i), &ids[i]);
+        }
+        clock_t tClock = clock();
+        for(i=0; i<2*nbKeys; i++) {
+            errors += (tget(map, BLOOM_KEY(i)) != ((i & 1) ? NULL : &ids[i]));
+        }
+        tClock = clock() - tClock;
+        fprintf(stderr, "[%-5d] Map %d lookup time: %-3.2f seconds\n", nbKeys, m, (float)tClock/CLOCKS_PER_SEC);
+        for(i=0; i<2*nbKeys; i++) {
+            batch[i] = BLOOM_KEY(i);
+        }
+        tget_batch(map, batch, batch, 2*nbKeys);
+        for(i=0; i<2*nbKeys; i++) {
+            errors += (batch[i] != ((i & 1) ? NULL : &ids[i]));
+        }
+        // Fixed size keys equal to the ones added, other bytes after
+        // their NUL
+        for(i=0; m == 3 && i<2*nbKeys; i+=2) {
+            char key[MAX_KEY_SIZE];
+
+            memset(key, 'x', sizeof(key));
+            strcpy(key, keys[i]);
+            errors += (tget(map, key) != &ids[i]);
+        }
+
+        // Most keys removed, the filter forgets them
+        for(i=0; i<2*nbKeys; i+=2) {
+            if(i % 8 != 0) {
+                tdel(map, BLOOM_KEY(i));
+            }
+        }
+        for(i=0; i<2*nbKeys; i++) {
+            errors += (tget(map, BLOOM_KEY(i)) != (i % 8 == 0 ? &ids[i] : NULL));
+        }
+
+        // All keys added back, and the odd ones
+        for(i=0; i<2*nbKeys; i++) {
+            tadd(map, BLOOM_KEY(i), &ids[i]);
+        }
+        for(i=0; i<2*nbKeys; i++) {
+            errors += (tget(map, BLOOM_KEY(i)) != &ids[i]);
+        }
+
+        tclear(map);
+        for(i=0; i<2*nbKeys; i++) {
+            errors += (tget(map, BLOOM_KEY(i)) != NULL);
+        }
+        tadd(map, BLOOM_KEY(1), &ids[1]);
+        errors += (tget(map, BLOOM_KEY(1)) != &ids[1]);
+#undef BLOOM_KEY
+
+        tfree(map);
+        errors += (counter.bytes != 0);
+    }
+
+    free(batch);
+    free(ids);
+    free(keys);
+
+    if(errors == 0) {
+        fprintf(stderr, "PASS!\n");
+    } else {
+        fprintf(stderr, "FAIL!\n");
+    }
+}
+
+
+// Lookups repeated are answered by the thread's cache, which no change
+// of the map leaves stale
+void lookupCacheTest(const int nbElements) {
+    const int nbKeys = nbElements < 100 ? 100 : nbElements;
+    const char* longKey = "a key too long for the lookup cache";
+    AllocCounter counter;
+    tmap_config config;
+    tmap* map;
+    char (*keys)[MAX_KEY_SIZE];
+    unsigned long hits, misses;
+    int* ids;
+    int errors = 0;
+    int m, i;
+
+    printf("---------------------------------------------------------\n");
+    printf("Test per thread lookup cache (TMAP_LOOKUP_CACHE)\n");
+
+    keys = malloc(nbKeys * MAX_KEY_SIZE);
+    ids = malloc(nbKeys * sizeof(int));
+    if(keys == NULL || ids == NULL) {
+        fprintf(stderr, "lookupCacheTest: Allocation failed: %s\n", strerror(errno));
+        exit(-1);
+    }
+    for(i=0; i<nbKeys; i++) {
+        snprintf(keys[i], MAX_KEY_SIZE, "%09d", i);
+        ids[i] = i;
+    }
+
+    // Tree, hash table, integer keys, fixed size keys
+    for(m=0; m<4; m++) {
+        memset(&counter, 0, sizeof(counter));
+        memset(&config, 0, sizeof(config));
+        config.keyKind = m == 2 ? TMAP_KEY_U64 : (m == 3 ? TMAP_KEY_PTR : TMAP_KEY_STRING);
+        config.cmp = m == 3 ? compare : NULL;
+        config.keySize = m == 3 ? MAX_KEY_SIZE : 0;
+        config.hash = m == 1 ? hash : NULL;
+        config.flags = TMAP_LOOKUP_CACHE;
+        config.multitask = MULTI_THREAD_RWLOCK;
+        config.alloc = ctxAlloc;
+        config.free = ctxFree;
+        config.allocCtx = &counter;
+        map = tinit_ex(&config);
+
+#define CACHE_KEY(i) (m == 2 ? TMAP_U64(i) : (void*)keys[i])
+        for(i=0; i<nbKeys; i+=2) {
+            tadd(map, CACHE_KEY(i), &ids[i]);
+        }
+        // Each key looked up twice in a row, missing ones too
+        clock_t tClock = clock();
+        for(i=0; i<nbKeys; i++) {
+            errors += (tget(map, CACHE_KEY(i)) != ((i & 1) ? NULL : &ids[i]));
+            errors += (tget(map, CACHE_KEY(i)) != ((i & 1) ? NULL : &ids[i]));
+        }
+        tClock = clock() - tClock;
+        fprintf(stderr, "[%-5d] Map %d lookup time: %-3.2f seconds\n", nbKeys, m, (float)tClock/CLOCKS_PER_SEC);
+        tcache_stats(map, &hits, &misses);
+        errors += (hits != (unsigned long)nbKeys || misses != (unsigned long)nbKeys);
+
+        // Keys set, added and deleted after being cached
+        errors += (tget(map, CACHE_KEY(0)) != &ids[0] || tget(map, CACHE_KEY(1)) != NULL);
+        tput(map, CACHE_KEY(0), &ids[1]);
+        errors += (tget(map, CACHE_KEY(0)) != &ids[1]);
+        tadd(map, CACHE_KEY(1), &ids[1]);
+        errors += (tget(map, CACHE_KEY(1)) != &ids[1]);
+        tdel(map, CACHE_KEY(1));
+        errors += (tget(map, CACHE_KEY(1)) != NULL);
+        tclear(map);
+        errors += (tget(map, CACHE_KEY(0)) != NULL);
+
+        // Keys that don't fit are looked up in the map every time
+        if(m < 2) {
+            tadd(map, (void*)longKey, &ids[2]);
+            errors += (tget(map, (void*)longKey) != &ids[2]);
+            errors += (tget(map, (void*)longKey) != &ids[2]);
+        }
+#undef CACHE_KEY
+
+        tfree(map);
+        errors += (counter.bytes != 0);
+    }
+
+    // Maps without the flag report nothing
+    map = tinit(compare, TMAP_ALLOW_OVERWRITE, SINGLE_THREADED);
+    tadd(map, keys[0], &ids[0]);
+    errors += (tget(map, keys[0]) != &ids[0]);
+    tcache_stats(map, &hits, &misses);
+    errors += (hits != 0 || misses != 0);
+    tfree(map);
+
+    free(ids);
+    free(keys);
+
+    if(errors == 0) {
+        fprintf(stderr, "PASS!\n");
+    } else {
+        fprintf(stderr, "FAIL!\n");
+    }
+}
+
+
+static unsigned long statsCompares = 0;
+
+
+static int countingCompare(const void* pa, const void* pb) {
+    ++statsCompares;
+    return compare(pa, pb);
+}
+
+
+// Statistics follow keys added and deleted, count operations and the
+// comparisons they make, and account for the memory the map allocated
+void statsTest(const int nbElements) {
+    const int nbKeys = nbElements < 100 ? 100 : nbElements;
+    AllocCounter counter;
+    tmap_stats stats;
+    tmap_config config;
+    tmap* map;
+    char (*keys)[MAX_KEY_SIZE];
+    unsigned long compares;
+    unsigned int bits;
+    int* ids;
+    int errors = 0;
+    int m, i;
+
+    printf("---------------------------------------------------------\n");
+    printf("Test map statistics (tstats, TMAP_STATS)\n");
+
+    keys = malloc(nbKeys * MAX_KEY_SIZE);
+    ids = malloc(nbKeys * sizeof(int));
+    if(keys == NULL || ids == NULL) {
+        fprintf(stderr, "statsTest: Allocation failed: %s\n", strerror(errno));
+        exit(-1);
+    }
+    for(i=0; i<nbKeys; i++) {
+        snprintf(keys[i], MAX_KEY_SIZE, "%09d", i);
+        ids[i] = i;
+    }
+    // Levels of a perfectly balanced tree of the keys left
+    for(bits=0; (1 << bits) <= nbKeys/2; ++bits);
+
+    // Tree with the client's compare function, hash table, B+ tree,
+    // radix tree, tree with copied keys in MULTI_THREAD_RCU mode, tree
+    // of expiring keys with a bloom filter, without operation counters
+    for(m=0; m<6; m++) {
+        memset(&counter, 0, sizeof(counter));
+        memset(&config, 0, sizeof(config));
+        config.keyKind = m == 0 ? TMAP_KEY_PTR : TMAP_KEY_STRING;
+        config.cmp = m == 0 ? countingCompare : NULL;
+        config.hash = m == 1 ? hash : NULL;
+        config.flags = (m == 5 ? TMAP_TTL | TMAP_BLOOM : TMAP_STATS) | (m == 2 ? TMAP_BTREE : 0)
+                       | (m == 3 ? TMAP_ART : 0) | (m == 4 ? TMAP_COPY_KEYS : 0);
+        config.multitask = m == 4 ? MULTI_THREAD_RCU : MULTI_THREAD_RWLOCK;
+        config.alloc = ctxAlloc;
+        config.free = ctxFree;
+        config.allocCtx = &counter;
+        map = tinit_ex(&config);
+
+        for(i=0; i<nbKeys; i++) {
+            if(m == 5) {
+                tadd_ttl(map, keys[i], &ids[i], 3600*1000);
+            } else {
+                tadd(map, keys[i], &ids[i]);
+            }
+        }
+        statsCompares = 0;
+        for(i=0; i<nbKeys; i++) {
+            errors += (tget(map, keys[i]) != &ids[i]);
+        }
+        compares = statsCompares;
+        for(i=0; i<nbKeys; i+=2) {
+            tdel(map, keys[i]);
+        }
+
+        clock_t tClock = clock();
+        tstats(map, &stats);
+        tClock = clock() - tClock;
+        fprintf(stderr, "[%-5d] Map %d stats time: %-3.2f seconds\n", nbKeys, m, (float)tClock/CLOCKS_PER_SEC);
+        printf("Map %d: %zu keys, %zu blocks, %zu bytes, %zu free slots (%zu bytes), "
+               "height %u, average depth %.2f, compares per get %.2f\n",
+               m, stats.count, stats.blocks, stats.bytes, stats.freeSlots, stats.wastedBytes,
+               stats.height, stats.averageDepth, (double)stats.compares[TMAP_OP_GET]/nbKeys);
+
+        errors += (stats.count != (size_t)nbKeys/2);
+        errors += (stats.blocks == 0 || stats.bytes < stats.blocks * sizeof(tnode));
+        // All the map allocated but the map itself, its lock and counters,
+        // and RCU's lists of retired nodes
+        errors += (stats.bytes > (size_t)counter.bytes || (m != 4 && counter.bytes - stats.bytes > 1024));
+        errors += (m != 4 && (stats.freeSlots != (size_t)nbKeys/2 || stats.wastedBytes < stats.freeSlots * sizeof(tnode)));
+        if(m == 0 || m == 4 || m == 5) {
+            // AVL trees are at most 1.44 times as high as they could be
+            errors += (stats.height < bits || stats.height > 1.45 * bits);
+            errors += (stats.averageDepth < 1 || stats.averageDepth > stats.height);
+        } else if(m == 2) {
+            errors += (stats.height < 2 || stats.averageDepth != stats.height);
+        } else {
+            errors += (stats.height != 0 || stats.averageDepth != 0);
+        }
+        if(m == 5) {
+            errors += (stats.ops[TMAP_OP_GET] != 0 || stats.compares[TMAP_OP_GET] != 0);
+        } else {
+            errors += (stats.ops[TMAP_OP_GET] != (unsigned long)nbKeys);
+            errors += (stats.ops[TMAP_OP_PUT] != (unsigned long)nbKeys);
+            errors += (stats.ops[TMAP_OP_DEL] != (unsigned long)nbKeys/2);
+            // Radix trees compare keys at their leaves only
+            errors += (m != 3 && stats.compares[TMAP_OP_GET] < (unsigned long)nbKeys);
+            errors += (m == 0 && stats.compares[TMAP_OP_GET] != compares);
+        }
+
+        tclear(map);
+        tstats(map, &stats);
+        errors += (stats.count != 0);
+        tfree(map);
+    }
+
+    free(ids);
+    free(keys);
+
+    if(errors == 0) {
+        fprintf(stderr, "PASS!\n");
+    } else {
+        fprintf(stderr, "FAIL!\n");
+    }
+}
+
+
+// Hash indexed maps: keys stay found while the table grows a few groups
+// at a time, and slots of deleted keys are reused, from memory aligned
+// on 8 bytes only
+void hashTest(const int nbElements) {
+    const int nbKeys = nbElements < 100 ? 100 : nbElements;
+    AllocCounter counter;
+    tmap_config config;
+    tmap_stats stats;
+    tmap* map;
+    char (*keys)[MAX_KEY_SIZE];
+    long bytes = 0;
+    int* ids;
+    int errors = 0;
+    int round, i;
+
+    printf("---------------------------------------------------------\n");
+    printf("Test hash indexed maps (resize, deleted slots)\n");
+
+    keys = malloc(nbKeys * MAX_KEY_SIZE);
+    ids = malloc(nbKeys * sizeof(int));
+    if(keys == NULL || ids == NULL) {
+        fprintf(stderr, "hashTest: Allocation failed: %s\n", strerror(errno));
+        exit(-1);
+    }
+    for(i=0; i<nbKeys; i++) {
+        snprintf(keys[i], MAX_KEY_SIZE, "%09d", i);
+        ids[i] = i;
+    }
+
+    memset(&counter, 0, sizeof(counter));
+    memset(&config, 0, sizeof(config));
+    config.keyKind = TMAP_KEY_STRING;
+    config.hash = hash;
+    config.alloc = misalignedAlloc;
+    config.free = misalignedFree;
+    config.allocCtx = &counter;
+    map = tinit_ex(&config);
+
+    // Keys added before the table last grew may still be in the old one
+    for(i=0; i<nbKeys; i++) {
+        tadd(map, keys[i], &ids[i]);
+        errors += (tget(map, keys[i]) != &ids[i] || tget(map, keys[i/2]) != &ids[i/2]);
+    }
+    for(i=0; i<nbKeys; i++) {
+        errors += (tget(map, keys[i]) != &ids[i]);
+    }
+
+    // Odd keys deleted and added back: the table doesn't keep growing
+    for(round=0; round<4; round++) {
+        for(i=1; i<nbKeys; i+=2) {
+            tdel(map, keys[i]);
+        }
+        for(i=0; i<nbKeys; i++) {
+            errors += (tget(map, keys[i]) != ((i & 1) ? NULL : &ids[i]));
+        }
+        for(i=1; i<nbKeys; i+=2) {
+            tadd(map, keys[i], &ids[i]);
+        }
+        if(round == 1) {
+            bytes = counter.bytes;
+        }
+    }
+    printf("   Bytes after round 2: %ld, round 4: %ld\n", bytes, counter.bytes);
+    errors += (counter.bytes > bytes);
+    for(i=0; i<nbKeys; i++) {
+        errors += (tget(map, keys[i]) != &ids[i]);
+    }
+    tstats(map, &stats);
+    errors += (stats.count != (size_t)nbKeys);
+
+    tfree(map);
+    errors += (counter.bytes != 0);
+
+    free(ids);
+    free(keys);
+
+    if(errors == 0) {
+        fprintf(stderr, "PASS!\n");
+    } else {
+        fprintf(stderr, "FAIL!\n");
+    }
+}
+
+
+void memleakTest(const int nbElements) {
+    tmap* map;
+    map = tinit(compare, TMAP_ALLOW_OVERWRITE, SINGLE_THREADED);
+
+    char** buf;
+    buf = (char**)malloc(nbElements*sizeof(char*)+MAX_KEY_SIZE*nbElements);
+    if(buf == NULL) {
+        fprintf(stderr, "memleakTest: Allocation failed: %s\n", strerror(errno));
+        exit(-1);
+    }
+
+    int baseOffset = nbElements*sizeof(char*);
+    for(int i=0; i<nbElements; i++) {
+        buf[i] = (char*)buf + baseOffset + i * MAX_KEY_SIZE;
+        snprintf(buf[i], MAX_KEY_SIZE, "%06d", i*2);
+    }
+
+    int cycle = 1;
+    while(1) {
+        printf("Cycle: %d Adding elements...\n", cycle);
+        for(int i=0; i<nbElements; i++) {
+            tadd(map, buf[i], buf[i]);
+        }
+        printf("Cycle: %d Deleting elements...\n", cycle);
+        for(int i=0; i<nbElements; i++) {
+            tdel(map, buf[i]);
+        }
+        cycle++;
+    }
+}
+
+
+void printHelp(char* argv[]) {
+    printf("\
+Usage: %s [-h] [-t <b|o|u|r|c|bl|cu|gb|cf|pi|ps|ck|bt|ar|fs|p|pa|ph|mt|mts|mtr|a>] [-e <nbElements>] [-p <parallel>] [-s] [-i <iterations>\n\
+    -t:\n\
+        b:   basic map accessor test\n\
+        o:   key/value overwrite test\n\
+        u:   upsert test (tput, tinsert_if_absent, tcompute)\n\
+        r:   freed node slots reuse test\n\
+        c:   clear test (tclear, tfree)\n\
+        bl:  bulk load test (tbuild)\n\
+        cu:  cursor and range test\n\
+        gb:  batched lookup test (tget_batch)\n\
+        cf:  per map configuration test (tinit_ex, treserve)\n\
+        pi:  64 bit integer keys test\n\
+        ps:  string keys test\n\
+        ck:  copied keys test (TMAP_COPY_KEYS)\n\
+        bt:  B+ tree map test\n\
+        ar:  radix tree map test (tinit_art, tprefix)\n\
+        fs:  map file test (tsave, topen)\n\
+        sn:  map snapshot test (tsnapshot)\n\
+        lr:  bounded map test (capacity, evict)\n\
+        tl:  expiring keys test (tadd_ttl, texpire)\n\
+        bf:  Bloom filter test (TMAP_BLOOM)\n\
+        lc:  per thread lookup cache test (TMAP_LOOKUP_CACHE)\n\
+        st:  map statistics test (tstats, TMAP_STATS)\n\
+        ht:  hash indexed map test (resize, deleted slots)\n\
+        p:   performance test\n\
+        pa:  performance test with client's memory allocator\n\
+        ph:  performance test with a hash indexed map\n\
+        mt:  multi threaded test\n\
+        mts: multi threaded test on a sharded map\n\
+        mp:  multi process test on a map in shared memory (tinit_shared)\n\
+        mtr: multi threaded readers with a writer (rwlock, seqlock and rcu modes)\n\
+        ml:  memory leak test\n\
+        a:   run all tests except the infinite loop memory leak one\n\
+    -e:\n\
+        Performance test: total number of elements to create\n\
+        Multi[thread|proc] test: number of elements to create == (int)nbElements/parallel\n\
+    -p:\n\
+        Number of tasks (threads or processes) to create\n\
+    -s:\n\
+        Force multithreaded/multiprocess tests to run map with single thread support to cause errors\n\
+    -i:\n\
+        Iterate 'iterations' number of times over the requested test(s)\n\
+\n\
+Note:\n\
+- You should run the perf test with %s -t p -e nbElements > /dev/null\n\
+-s: The test is still run in multithreaded fashion, but the map\n\
+    object is configured to work as in single threaded mode, which should cause errors/crash.\n", argv[0], argv[0]);
+}
+
+
+int main(int argc, char* argv[]) {
+    int c;
+    char test[4];
+    unsigned int nbElements = 4000;
+    int nbParallelTasks = 10;
+    int singleThreadedMode = 0;
+    int mapMultiTaskMode = SINGLE_THREADED;
+    int iterations = 1;
+
+    if(argc == 1) {
+        printHelp(argv);
+        exit(0);
+    }
+
+    while ((c = getopt (argc, argv, "ht:e:p:si:m")) != -1) {
+        switch (c)
+        {
+            case 't':
+                strncpy(test, optarg, 4);
+                break;
+            case 'h':
+                printHelp(argv);
+                exit(0);
+                break;
+            case 'e':
+                nbElements = atoi(optarg);
+                break;
+            case 'i':
+                iterations = atoi(optarg);
+                break;
+            case 'p':
+                nbParallelTasks = atoi(optarg);
+                break;
+            case 's':
+                singleThreadedMode = 1;
+                break;
+            default:
+                fprintf(stderr, "Bad argument: %c\n", c);
+        }
+    }
+
+    printf("===============================\n");
+    printf("Run parameters:\n");
+    printf("   %-25s%d\n", "Number of elements:", nbElements);
+    printf("   %-25s%d\n", "Number of tasks:", nbParallelTasks);
+    printf("   %-25s%d\n", "Single threaded mode:", singleThreadedMode);
+    printf("===============================\n\n");
+
+    for(int i=1;i<=iterations;i++) {
+        fprintf(stderr, "              ++++++++++++++++\n");
+        fprintf(stderr, "               ITERATION %d\n", i);
+        fprintf(stderr, "              ++++++++++++++++\n\n");
+
+        if(!strcmp(test, "b") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## basicAccessorTest ##############\n");
+            basicAccessorTest(mapMultiTaskMode);
+        }
+
+        // Signal handler works only the first time
+        if((iterations == 1) && (!strcmp(test, "o") || !strcmp(test, "a"))) {
+            fprintf(stderr, "############## overwriteTest ##############\n");
+            overwriteTest(mapMultiTaskMode);
+        }
+
+        if(!strcmp(test, "u") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## upsertTest ##############\n");
+            upsertTest(mapMultiTaskMode);
+        }
+
+        if(!strcmp(test, "r") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## slotReuseTest ##############\n");
+            slotReuseTest(nbElements);
+        }
+
+        if(!strcmp(test, "c") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## clearTest ##############\n");
+            clearTest(nbElements);
+        }
+
+        if(!strcmp(test, "bl") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## buildTest ##############\n");
+            buildTest(nbElements);
+        }
+
+        if(!strcmp(test, "cu") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## cursorTest ##############\n");
+            cursorTest(nbElements);
+        }
+
+        if(!strcmp(test, "gb") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## batchTest ##############\n");
+            batchTest(nbElements);
+        }
+
+        if(!strcmp(test, "cf") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## configTest ##############\n");
+            configTest(nbElements);
+        }
+
+        if(!strcmp(test, "pi") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## u64Test ##############\n");
+            u64Test(nbElements);
+        }
+
+        if(!strcmp(test, "ps") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## stringKeyTest ##############\n");
+            stringKeyTest(nbElements);
+        }
+
+        if(!strcmp(test, "ck") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## copyKeysTest ##############\n");
+            copyKeysTest(nbElements);
+        }
+
+        if(!strcmp(test, "bt") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## btreeTest ##############\n");
+            btreeTest(nbElements);
+        }
+
+        if(!strcmp(test, "ar") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## artTest ##############\n");
+            artTest(nbElements);
+        }
+
+        if(!strcmp(test, "fs") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## fileTest ##############\n");
+            fileTest(nbElements);
+        }
+
+        if(!strcmp(test, "sn") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## snapshotTest ##############\n");
+            snapshotTest(nbElements);
+        }
+
+        if(!strcmp(test, "lr") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## lruTest ##############\n");
+            lruTest(nbElements);
+        }
+
+        if(!strcmp(test, "tl") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## ttlTest ##############\n");
+            ttlTest(nbElements);
+        }
+
+        if(!strcmp(test, "bf") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## bloomTest ##############\n");
+            bloomTest(nbElements);
+        }
+
+        if(!strcmp(test, "lc") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## lookupCacheTest ##############\n");
+            lookupCacheTest(nbElements);
+        }
+
+        if(!strcmp(test, "st") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## statsTest ##############\n");
+            statsTest(nbElements);
+        }
+
+        if(!strcmp(test, "ht") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## hashTest ##############\n");
+            hashTest(nbElements);
+        }
+
+        if(!strcmp(test, "p") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## mapPerformanceTest ##############\n");
+            mapPerformanceTest(nbElements, mapMultiTaskMode, 0, 0);
         }
 
         if(!strcmp(test, "pa") || !strcmp(test, "a")) {
             fprintf(stderr, "############## mapPerformanceTest ##############\n");
             fprintf(stderr, "############## +custom allocator  ##############\n");
-            mapPerformanceTest(nbElements, mapMultiTaskMode, 1);
+            mapPerformanceTest(nbElements, mapMultiTaskMode, 1, 0);
+        }
+
+        if(!strcmp(test, "ph") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## mapPerformanceTest ##############\n");
+            fprintf(stderr, "############## +hash indexed      ##############\n");
+            mapPerformanceTest(nbElements, mapMultiTaskMode, 0, 1);
         }
 
         if(!strcmp(test, "mt") || !strcmp(test, "a")) {
@@ -451,6 +2773,38 @@ int main(int argc, char* argv[]) {
             printf("Elements/thread: %d\n", nbElPerThread);
             multithreadTest(nbParallelTasks, nbElPerThread, singleThreadedMode);
         }
+
+        if(!strcmp(test, "mts") || !strcmp(test, "a")) {
+            int nbElPerThread = nbElements/nbParallelTasks;
+            fprintf(stderr, "############## multithreadShardedTest ##############\n");
+            printf("Elements/thread: %d, shards: %d\n", nbElPerThread, nbParallelTasks*4);
+            multithreadShardedTest(nbParallelTasks, nbElPerThread, nbParallelTasks*4);
+        }
+
+        if(!strcmp(test, "mp") || !strcmp(test, "a")) {
+            int nbElPerProc = nbElements/nbParallelTasks;
+            fprintf(stderr, "############## multiprocessTest ##############\n");
+            printf("Elements/process: %d\n", nbElPerProc);
+            multiprocessTest(nbParallelTasks, nbElPerProc);
+        }
+
+        if(!strcmp(test, "mtr") || !strcmp(test, "a")) {
+            fprintf(stderr, "############## multithreadReadTest ##############\n");
+            fprintf(stderr, "############## +rwlock            ##############\n");
+            multithreadReadTest(nbParallelTasks, nbElements, MULTI_THREAD_RWLOCK, 0);
+            fprintf(stderr, "############## multithreadReadTest ##############\n");
+            fprintf(stderr, "############## +seqlock           ##############\n");
+            multithreadReadTest(nbParallelTasks, nbElements, MULTI_THREAD_SEQLOCK, 0);
+            fprintf(stderr, "############## multithreadReadTest ##############\n");
+            fprintf(stderr, "############## +rcu               ##############\n");
+            multithreadReadTest(nbParallelTasks, nbElements, MULTI_THREAD_RCU, 0);
+            fprintf(stderr, "############## multithreadReadTest ##############\n");
+            fprintf(stderr, "############## +rwlock, lookup cache ###########\n");
+            multithreadReadTest(nbParallelTasks, nbElements, MULTI_THREAD_RWLOCK, TMAP_LOOKUP_CACHE);
+            fprintf(stderr, "############## multithreadReadTest ##############\n");
+            fprintf(stderr, "############## +rcu, lookup cache ##############\n");
+            multithreadReadTest(nbParallelTasks, nbElements, MULTI_THREAD_RCU, TMAP_LOOKUP_CACHE);
+        }
     }
 
     if(!strcmp(test, "ml")) {
@@ -23,6 +23,7 @@ SOFTWARE.
 *********************************************************************************/
 
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -44,6 +45,7 @@ char** gKeys;
 
 typedef struct ThreadParam {
     tmap* map;
+    tmap_sharded* smap;
     int id;
     int nbElemPerThread;
     pthread_barrier_t* barrierWaitThreadLaunch;
@@ -59,15 +61,28 @@ compare(const void* pa, const void* pb)
 }
 
 
+// Hash function for sharded maps of string keys (FNV-1a)
+static uint64_t
+hash(const void* key)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for(const char* c = key; *c != 0; ++c) {
+        h ^= (unsigned char)*c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+
 // Verify the map was correctly set by the threads
 // If you run this test with '-s' option, it will crash the program.
-int verify(tmap* map, const int nbTasks, const int nbElementsPerTask) {
+int verify(tmap* map, tmap_sharded* smap, const int nbTasks, const int nbElementsPerTask) {
     void* value;
     printf("Verification\n");
     int errors = 0;
 
     for(int i=0; i<nbTasks*nbElementsPerTask; i++) {
-        value = tget(map, gKeys[i]);
+        value = smap ? tsget(smap, gKeys[i]) : tget(map, gKeys[i]);
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wint-to-pointer-cast"
         if(value != (void*)i) {
@@ -86,6 +101,7 @@ int verify(tmap* map, const int nbTasks, const int nbElementsPerTask) {
 void* threadWork(void* args) {
     ThreadParam* pArgs = (ThreadParam*)args;
     tmap* map = pArgs->map;
+    tmap_sharded* smap = pArgs->smap;
     const int id = pArgs->id;
     const int nbElemPerThread = pArgs->nbElemPerThread;
     pthread_barrier_t* threadLaunchSyncBarrier = pArgs->barrierWaitThreadLaunch;
@@ -105,9 +121,15 @@ void* threadWork(void* args) {
     for(i=start; i<=end; i++) {
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wint-to-pointer-cast"
-        tadd(map, gKeys[i], (void*)i);
-        tdel(map, gKeys[i]);
-        tadd(map, gKeys[i], (void*)i);
+        if(smap) {
+            tsadd(smap, gKeys[i], (void*)i);
+            tdel(tshard(smap, gKeys[i]), gKeys[i]);
+            tsadd(smap, gKeys[i], (void*)i);
+        } else {
+            tadd(map, gKeys[i], (void*)i);
+            tdel(map, gKeys[i]);
+            tadd(map, gKeys[i], (void*)i);
+        }
 #pragma GCC diagnostic pop
     }
 
@@ -153,30 +175,20 @@ void freeKeyMem() {
 // Launch a bunch of threads waiting at a barrier, when they've
 // all reached it, unblock them all and let them do their work.
 // Wait for all threads to complete and verify the results.
-void multithreadTest(const int nbThreads, int nbElemPerThread, const int singleThreadedMode) {
+// Either 'map' or 'smap' is used.
+static void runThreads(const int nbThreads, int nbElemPerThread, tmap* map, tmap_sharded* smap) {
     pthread_t* threads = malloc(nbThreads*sizeof(pthread_t));
     pthread_barrier_t barrierWaitThreadLaunch;
     pthread_barrier_t barrierWaitChildStart;
+    struct timespec start, end;
 
     pthread_barrier_init(&barrierWaitThreadLaunch, NULL, nbThreads+1);
     pthread_barrier_init(&barrierWaitChildStart, NULL, nbThreads+1);
 
-    setKeyMem(nbThreads*nbElemPerThread, MAX_KEY_SIZE);
-
-    // Our map (string to string)
-    tmap* map;
-
-    if(singleThreadedMode) {
-        // This is to show that using multithreaded for the map
-        // configured in single threaded mode will crash the program.
-        map = tinit(compare, TMAP_NO_OVERWRITE, SINGLE_THREADED);
-    } else {
-        map = tinit(compare, TMAP_NO_OVERWRITE, MULTI_THREAD_SAFE);
-    }
-
     ThreadParam* pThreadArgs = malloc(sizeof(ThreadParam)*nbThreads);
     for(int i=0; i<nbThreads; i++) {
         pThreadArgs[i].map = map;
+        pThreadArgs[i].smap = smap;
         pThreadArgs[i].nbElemPerThread = nbElemPerThread;
         pThreadArgs[i].barrierWaitThreadLaunch = &barrierWaitThreadLaunch;
         pThreadArgs[i].barrierWaitChildStart = &barrierWaitChildStart;
@@ -193,18 +205,20 @@ void multithreadTest(const int nbThreads, int nbElemPerThread, const int singleT
     printf("Unblocking all threads\n");
     pthread_barrier_wait(&barrierWaitChildStart);
 
-    // Wait for processes to complete
-    clock_t tClock = clock();
+    // Wait for processes to complete, wall clock time since
+    // clock() adds up all threads' CPU time
+    clock_gettime(CLOCK_MONOTONIC, &start);
     for(int tid=0; tid<nbThreads; tid++) {
         pthread_join(threads[tid], NULL);
     }
-    tClock = clock() - tClock;
+    clock_gettime(CLOCK_MONOTONIC, &end);
     fprintf(stderr, "[%-5d*%d] Map init time:     %-3.2f seconds\n",
-            nbThreads, nbElemPerThread, (float)tClock/CLOCKS_PER_SEC);
+            nbThreads, nbElemPerThread,
+            (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
 
     // Verification
-    tClock = clock();
-    int error = verify(map, nbThreads, nbElemPerThread);
+    clock_t tClock = clock();
+    int error = verify(map, smap, nbThreads, nbElemPerThread);
     tClock = clock() - tClock;
     fprintf(stderr, "[%-5d*%d] Verification time: %-3.2f seconds\n",
             nbThreads, nbElemPerThread, (float)tClock/CLOCKS_PER_SEC);
@@ -214,12 +228,310 @@ void multithreadTest(const int nbThreads, int nbElemPerThread, const int singleT
         fprintf(stderr, "FAIL\n");
     }
 
+    pthread_barrier_destroy(&barrierWaitThreadLaunch);
+    pthread_barrier_destroy(&barrierWaitChildStart);
+    free(threads);
+    free(pThreadArgs);
+}
+
+
+void multithreadTest(const int nbThreads, int nbElemPerThread, const int singleThreadedMode) {
+    setKeyMem(nbThreads*nbElemPerThread, MAX_KEY_SIZE);
+
+    // Our map (string to string)
+    tmap* map;
+
+    if(singleThreadedMode) {
+        // This is to show that using multithreaded for the map
+        // configured in single threaded mode will crash the program.
+        map = tinit(compare, TMAP_NO_OVERWRITE, SINGLE_THREADED);
+    } else {
+        map = tinit(compare, TMAP_NO_OVERWRITE, MULTI_THREAD_SAFE);
+    }
+
+    runThreads(nbThreads, nbElemPerThread, map, NULL);
+
     // Memory cleanup
     tfree(map);
+    freeKeyMem();
+}
+
+
+// Same as multithreadTest, on a map split over 'nbShards' shards
+void multithreadShardedTest(const int nbThreads, int nbElemPerThread, const int nbShards) {
+    setKeyMem(nbThreads*nbElemPerThread, MAX_KEY_SIZE);
 
+    tmap_sharded* smap = tinit_sharded(nbShards, hash, compare, TMAP_NO_OVERWRITE, MULTI_THREAD_SAFE);
+
+    runThreads(nbThreads, nbElemPerThread, NULL, smap);
+
+    tsfree(smap);
+    freeKeyMem();
+}
+
+
+// A worker dying with the map locked
+static void* dieAction(const void* key, void* value, void* ctx) {
+    _exit(0);
+    return value;
+}
+
+
+// Same as multithreadTest, with processes sharing a map in shared memory
+void multiprocessTest(const int nbProcs, int nbElemPerProc) {
+    tmap_config config;
+    char name[64];
+    int status;
+    pid_t pid;
+
+    setKeyMem(nbProcs*nbElemPerProc, MAX_KEY_SIZE);
+
+    memset(&config, 0, sizeof(config));
+    config.keyKind = TMAP_KEY_STRING;
+    config.noOverwrite = TMAP_NO_OVERWRITE;
+    config.flags = TMAP_STATS;
+    snprintf(name, sizeof(name), "/maptest-%d", (int)getpid());
+
+    // Workers with an even id are forked before the map exists and
+    // attach it once told it's created
+    int ready[2];
+    char go;
+    if(pipe(ready) != 0) {
+        fprintf(stderr, "multiprocessTest: pipe failed: %s\n", strerror(errno));
+        fprintf(stderr, "FAIL\n");
+        freeKeyMem();
+        return;
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    tmap* map = NULL;
+    for(int id=0; id<nbProcs; id++) {
+        if(id % 2 == 1 && map == NULL) {
+            map = tinit_shared(name, 64*1024*1024, &config);
+            if(map == NULL) {
+                fprintf(stderr, "multiprocessTest: tinit_shared failed: %s\n", strerror(errno));
+                exit(-1);
+            }
+        }
+        if(fork() == 0) {
+            int first = id*nbElemPerProc;
+            if(map == NULL) {
+                close(ready[1]);
+                if(read(ready[0], &go, 1) != 1 || (map = tattach_shared(name)) == NULL) {
+                    exit(1);
+                }
+            }
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wint-to-pointer-cast"
+            for(int i=first; i<first + nbElemPerProc; i++) {
+                tadd(map, gKeys[i], (void*)i);
+                tdel(map, gKeys[i]);
+                tadd(map, gKeys[i], (void*)i);
+            }
+#pragma GCC diagnostic pop
+            tfree(map);
+            exit(0);
+        }
+    }
+    if(map == NULL) {
+        map = tinit_shared(name, 64*1024*1024, &config);
+        if(map == NULL) {
+            fprintf(stderr, "multiprocessTest: tinit_shared failed: %s\n", strerror(errno));
+            exit(-1);
+        }
+    }
+    close(ready[0]);
+    for(int id=0; id<nbProcs; id++) {
+        if(write(ready[1], "g", 1) != 1) {
+            break;
+        }
+    }
+    close(ready[1]);
+    int errors = 0;
+    for(int id=0; id<nbProcs; id++) {
+        wait(&status);
+        errors += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stderr, "[%-5d*%d] Map init time:     %-3.2f seconds\n",
+            nbProcs, nbElemPerProc,
+            (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    errors += verify(map, NULL, nbProcs, nbElemPerProc);
+
+    // Statistics live in the segment: all workers' operations count
+    tmap_stats stats;
+    tstats(map, &stats);
+    if(stats.ops[TMAP_OP_PUT] != 2*(uint64_t)nbProcs*nbElemPerProc ||
+       stats.ops[TMAP_OP_DEL] != (uint64_t)nbProcs*nbElemPerProc) {
+        printf("ERROR: shared map counted %lu puts and %lu deletes\n",
+               (unsigned long)stats.ops[TMAP_OP_PUT], (unsigned long)stats.ops[TMAP_OP_DEL]);
+        errors++;
+    }
+
+    // A full segment leaves the map as it is and sets ENOMEM. Keys are
+    // copied into the segment, they are made up until it's full.
+    char small[64];
+    char key[32];
+    snprintf(small, sizeof(small), "/maptest-small-%d", (int)getpid());
+    tmap* full = tinit_shared(small, 512*1024, &config);
+    if(full == NULL) {
+        errors++;
+    } else {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wint-to-pointer-cast"
+        int added = 0;
+        errno = 0;
+        while(errno == 0) {
+            snprintf(key, sizeof(key), "full-%d", added);
+            tadd(full, key, (void*)(added + 1));
+            added += errno == 0;
+        }
+        errno = 0;
+        tadd(full, key, (void*)(added + 1));
+        int lost = errno != ENOMEM || added == 0 || tget(full, key) != NULL;
+        for(int i=0; i<added; i++) {
+            snprintf(key, sizeof(key), "full-%d", i);
+            lost += tget(full, key) != (void*)(i + 1);
+        }
+#pragma GCC diagnostic pop
+        tstats(full, &stats);
+        if(lost || stats.count != (size_t)added) {
+            printf("ERROR: full segment after %d keys, errno %d\n", added, errno);
+            errors++;
+        }
+        tfree(full);
+    }
+    errno = 0;
+    errors += tinit_shared(small, 4096, &config) != NULL || errno != ENOMEM;
+    config.flags = TMAP_LOOKUP_CACHE;
+    errno = 0;
+    errors += tinit_shared(small, 1024*1024, &config) != NULL || errno != EINVAL;
+
+    // A process dying while holding the map lock doesn't leave others
+    // waiting, the map is unusable: they exit with an error
+    pid = fork();
+    if(pid == 0) {
+        tcompute(map, gKeys[0], dieAction, NULL);
+        exit(1);
+    }
+    waitpid(pid, &status, 0);
+    errors += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    for(int i=0; i<2; i++) {
+        pid = fork();
+        if(pid == 0) {
+            tget(map, gKeys[0]);
+            exit(0);
+        }
+        waitpid(pid, &status, 0);
+        errors += !WIFEXITED(status) || WEXITSTATUS(status) == 0;
+    }
+    if(errors == 0) {
+        fprintf(stderr, "PASS\n");
+    } else {
+        fprintf(stderr, "FAIL\n");
+    }
+
+    tfree(map);
+    freeKeyMem();
+}
+
+
+typedef struct ReaderParam {
+    tmap* map;
+    int nbElements;
+    int* stop;
+    int errors;
+    long lookups;
+} ReaderParam;
+
+
+// Keys in the lower half of the map never change, keys in the upper
+// half come and go but always map to their index when present.
+static void* readerWork(void* args) {
+    ReaderParam* pArgs = (ReaderParam*)args;
+    void* value;
+    int i = 0;
+
+    while(!__atomic_load_n(pArgs->stop, __ATOMIC_RELAXED)) {
+        value = tget(pArgs->map, gKeys[i]);
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wint-to-pointer-cast"
+        if(value != (void*)i && (value != NULL || i < pArgs->nbElements/2)) {
+            printf("ERROR: %s -> %p expected %p\n", gKeys[i], value, (void*)i);
+#pragma GCC diagnostic pop
+            pArgs->errors++;
+        }
+        pArgs->lookups++;
+        i = (i + 7) % pArgs->nbElements;
+    }
+    return NULL;
+}
+
+
+// Readers look keys up while a single writer keeps deleting and adding
+// back the upper half of the keys. Maps with 'flags' have string keys.
+void multithreadReadTest(const int nbThreads, int nbElements, const int multitask, const int flags) {
+    pthread_t* threads = malloc(nbThreads*sizeof(pthread_t));
+    ReaderParam* pThreadArgs = malloc(sizeof(ReaderParam)*nbThreads);
+    int stop = 0;
+    int errors = 0;
+    long lookups = 0;
+
+    setKeyMem(nbElements, MAX_KEY_SIZE);
+    tmap* map;
+    if(flags == 0) {
+        map = tinit(compare, TMAP_ALLOW_OVERWRITE, multitask);
+    } else {
+        tmap_config config;
+        memset(&config, 0, sizeof(config));
+        config.keyKind = TMAP_KEY_STRING;
+        config.multitask = multitask;
+        config.flags = flags;
+        map = tinit_ex(&config);
+    }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wint-to-pointer-cast"
+    for(int i=0; i<nbElements; i++) {
+        tadd(map, gKeys[i], (void*)i);
+    }
+
+    for(int tid=0; tid<nbThreads; tid++) {
+        pThreadArgs[tid].map = map;
+        pThreadArgs[tid].nbElements = nbElements;
+        pThreadArgs[tid].stop = &stop;
+        pThreadArgs[tid].errors = 0;
+        pThreadArgs[tid].lookups = 0;
+        pthread_create(&threads[tid], NULL, readerWork, &pThreadArgs[tid]);
+    }
+
+    for(int cycle=0; cycle<20; cycle++) {
+        for(int i=nbElements/2; i<nbElements; i++) {
+            tdel(map, gKeys[i]);
+        }
+        for(int i=nbElements/2; i<nbElements; i++) {
+            tadd(map, gKeys[i], (void*)i);
+        }
+    }
+#pragma GCC diagnostic pop
+
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    for(int tid=0; tid<nbThreads; tid++) {
+        pthread_join(threads[tid], NULL);
+        errors += pThreadArgs[tid].errors;
+        lookups += pThreadArgs[tid].lookups;
+    }
+
+    printf("Lookups done by readers: %ld\n", lookups);
+    if(errors == 0) {
+        fprintf(stderr, "PASS\n");
+    } else {
+        fprintf(stderr, "FAIL\n");
+    }
+
+    tfree(map);
     freeKeyMem();
-    pthread_barrier_destroy(&barrierWaitThreadLaunch);
-    pthread_barrier_destroy(&barrierWaitChildStart);
     free(threads);
     free(pThreadArgs);
 }